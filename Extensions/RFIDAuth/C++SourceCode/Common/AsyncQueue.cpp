@@ -0,0 +1,152 @@
+#include "AsyncQueue.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+struct PendingCommand
+{
+    DWORD token;
+    AsyncQueue::Job job;
+    CompletionCallback callback;
+};
+
+struct CompletedCommand
+{
+    DWORD result;
+    std::vector<BYTE> data;
+};
+
+struct AsyncQueue::State
+{
+    std::deque<PendingCommand> queue;
+    std::map<DWORD, CompletedCommand> completed;
+    DWORD nextToken = 1;
+    DWORD runningToken = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    bool inCallback = false;
+};
+
+AsyncQueue::AsyncQueue() : state(std::make_shared<State>()) { thread = std::thread(run, state); }
+
+AsyncQueue::~AsyncQueue() { stop(); }
+
+DWORD AsyncQueue::submit(Job job, CompletionCallback callback)
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    DWORD token = state->nextToken++;
+
+    // Token 0 is never handed out
+    if (state->nextToken == 0)
+    {
+        state->nextToken = 1;
+    }
+
+    state->queue.push_back({token, std::move(job), callback});
+    state->cv.notify_all();
+    return token;
+}
+
+AsyncStatus AsyncQueue::fetch(DWORD token, DWORD& result, std::vector<BYTE>& data)
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    auto it = state->completed.find(token);
+
+    if (it != state->completed.end())
+    {
+        result = it->second.result;
+        data = std::move(it->second.data);
+        state->completed.erase(it);
+        return AsyncStatus::DONE;
+    }
+
+    if (state->runningToken == token)
+    {
+        return AsyncStatus::PENDING;
+    }
+
+    for (const PendingCommand& command : state->queue)
+    {
+        if (command.token == token)
+        {
+            return AsyncStatus::PENDING;
+        }
+    }
+
+    return AsyncStatus::UNKNOWN_TOKEN;
+}
+
+void AsyncQueue::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+
+    bool detach;
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->stopping = true;
+        state->queue.clear();
+        state->cv.notify_all();
+        state->cv.wait(lock, [this] { return state->runningToken == 0; });
+        detach = state->inCallback;
+    }
+
+    if (detach)
+    {
+        thread.detach();
+    }
+    else
+    {
+        thread.join();
+    }
+}
+
+void AsyncQueue::run(std::shared_ptr<State> state)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+
+    for (;;)
+    {
+        state->cv.wait(lock, [&state] { return state->stopping || !state->queue.empty(); });
+
+        if (state->stopping)
+        {
+            break;
+        }
+
+        PendingCommand command = std::move(state->queue.front());
+        state->queue.pop_front();
+        state->runningToken = command.token;
+        lock.unlock();
+
+        std::vector<BYTE> data;
+        DWORD result = command.job(data);
+
+        lock.lock();
+        state->runningToken = 0;
+        state->cv.notify_all();
+
+        if (state->stopping)
+        {
+            break;
+        }
+
+        if (!command.callback)
+        {
+            state->completed[command.token] = {result, std::move(data)};
+            continue;
+        }
+
+        state->inCallback = true;
+        lock.unlock();
+        command.callback(command.token, result, data.data(), (DWORD)data.size());
+        lock.lock();
+        state->inCallback = false;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "Platform.h"
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/* Invoked on the worker thread when a queued command completed. data holds
+ * what the synchronous function would have written into its buffer. */
+typedef void(__stdcall* CompletionCallback)(DWORD token, DWORD result, const BYTE* data, DWORD length);
+
+enum class AsyncStatus
+{
+    DONE,
+    PENDING,
+    UNKNOWN_TOKEN
+};
+
+/* Runs the commands of one session on a worker thread in the order they were
+ * queued, so callers never block on the serial line. */
+class AsyncQueue
+{
+   public:
+    /* Runs on the worker thread. Fills data and returns the result code of the command. */
+    using Job = std::function<DWORD(std::vector<BYTE>& data)>;
+
+    AsyncQueue();
+    AsyncQueue(const AsyncQueue&) = delete;
+    AsyncQueue& operator=(const AsyncQueue&) = delete;
+    ~AsyncQueue();
+
+    /* Queue a command and return its token. If callback is null, the result
+     * is kept until it is fetched once with fetch(). */
+    DWORD submit(Job job, CompletionCallback callback);
+    AsyncStatus fetch(DWORD token, DWORD& result, std::vector<BYTE>& data);
+
+    /* Discard all queued commands and wait for the running one. Same
+     * semantics as CardMonitor::stop() regarding a callback in progress. */
+    void stop();
+
+   private:
+    struct State;
+
+    std::shared_ptr<State> state;
+    std::thread thread;
+
+    static void run(std::shared_ptr<State> state);
+};
@@ -0,0 +1,45 @@
+#include "CardEventQueue.h"
+#include <algorithm>
+#include <cstring>
+
+constexpr size_t CardEventQueue::Capacity;
+
+bool CardEventQueue::push(CardEvent event, const BYTE* uid, DWORD uidLength, ULONGLONG timestamp)
+{
+    const size_t index = tail.load(std::memory_order_relaxed);
+
+    /* The consumer releases a slot only after it copied it */
+    if (index - head.load(std::memory_order_acquire) == Capacity)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    QueuedCardEvent& slot = slots[index % Capacity];
+    slot.event = (DWORD)event;
+    slot.uidLength = uid != nullptr ? std::min(uidLength, MaxUidLength) : 0;
+    slot.timestamp = timestamp;
+
+    if (slot.uidLength > 0)
+    {
+        memcpy(slot.uid, uid, slot.uidLength);
+    }
+
+    tail.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+size_t CardEventQueue::drain(QueuedCardEvent* events, size_t capacity, DWORD& lost)
+{
+    const size_t first = head.load(std::memory_order_relaxed);
+    const size_t count = std::min(capacity, tail.load(std::memory_order_acquire) - first);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        events[i] = slots[(first + i) % Capacity];
+    }
+
+    head.store(first + count, std::memory_order_release);
+    lost = dropped.exchange(0, std::memory_order_relaxed);
+    return count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "Platform.h"
+#include "CardMonitor.h"
+#include <atomic>
+
+/* A card event as the consumer receives it. The timestamp is in milliseconds since the Unix epoch. */
+struct QueuedCardEvent
+{
+    DWORD event;  // CardEvent
+    DWORD uidLength;
+    ULONGLONG timestamp;
+    BYTE uid[MaxUidLength];
+};
+
+/* Fixed ring of card events from the monitoring thread, the only producer,
+ * to one consumer that drains all pending events in one call. Neither side
+ * takes a lock or allocates: each one owns its index and publishes it with
+ * a release store, so a burst of events never waits for the consumer. When
+ * the ring is full the new event is dropped and counted, and the next drain
+ * reports the count so the consumer knows its view of the card is stale. */
+class CardEventQueue
+{
+   public:
+    static constexpr size_t Capacity = 64;
+
+    /* Producer side. Returns false if the event was dropped. */
+    bool push(CardEvent event, const BYTE* uid, DWORD uidLength, ULONGLONG timestamp);
+    /* Consumer side. Move up to capacity events into events, oldest first, and return their number. lost receives the
+     * number of events dropped since the last drain. */
+    size_t drain(QueuedCardEvent* events, size_t capacity, DWORD& lost);
+
+   private:
+    /* The indices count all events ever pushed and read, each on a cache line of its own */
+    std::atomic<size_t> head{0};  // Written by the consumer
+    char headPadding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail{0};  // Written by the producer
+    char tailPadding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<DWORD> dropped{0};
+    QueuedCardEvent slots[Capacity];
+};
@@ -0,0 +1,200 @@
+#include "CardMonitor.h"
+#include "CardEventQueue.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+
+constexpr std::chrono::milliseconds CardMonitor::MinReconnectDelay;
+constexpr std::chrono::milliseconds CardMonitor::MaxReconnectDelay;
+
+struct CardMonitor::State
+{
+    PollFunction poll;
+    CardEventCallback callback;
+    std::chrono::milliseconds interval;
+    ReconnectFunction reconnect;
+    CardEventQueue* queue;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    bool polling = false;
+    bool inCallback = false;
+};
+
+CardMonitor::CardMonitor(PollFunction poll, CardEventCallback callback, std::chrono::milliseconds interval,
+                         ReconnectFunction reconnect, CardEventQueue* queue)
+    : state(std::make_shared<State>())
+{
+    state->poll = std::move(poll);
+    state->callback = callback;
+    state->interval = interval;
+    state->reconnect = std::move(reconnect);
+    state->queue = queue;
+    thread = std::thread(run, state);
+}
+
+CardMonitor::~CardMonitor() { stop(); }
+
+void CardMonitor::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+
+    bool detach;
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->stopping = true;
+        state->cv.notify_all();
+        state->cv.wait(lock, [this] { return !state->polling; });
+        detach = state->inCallback;
+    }
+
+    /* A thread that is inside the callback may wait for the thread calling
+     * stop(), so it is left to finish on its own. It owns its state. */
+    if (detach)
+    {
+        thread.detach();
+    }
+    else
+    {
+        thread.join();
+    }
+}
+
+void CardMonitor::notify(State& state, std::unique_lock<std::mutex>& lock, CardEvent event, const BYTE* uid,
+                         DWORD uidLength)
+{
+    ULONGLONG timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+
+    /* Queued before the callback, a thread that stop() detaches in the callback pushes no more events */
+    if (state.queue)
+    {
+        state.queue->push(event, uid, uidLength, timestamp);
+    }
+
+    if (!state.callback)
+    {
+        return;
+    }
+
+    state.inCallback = true;
+    lock.unlock();
+    state.callback((DWORD)event, uid, uidLength, timestamp);
+    lock.lock();
+    state.inCallback = false;
+}
+
+bool CardMonitor::reconnect(State& state, std::unique_lock<std::mutex>& lock)
+{
+    std::chrono::milliseconds delay = MinReconnectDelay;
+
+    for (unsigned int attempt = 1;; attempt++)
+    {
+        if (state.cv.wait_for(lock, delay, [&state] { return state.stopping; }))
+        {
+            return false;
+        }
+
+        state.polling = true;
+        lock.unlock();
+
+        const bool connected = state.reconnect(attempt);
+
+        lock.lock();
+        state.polling = false;
+        state.cv.notify_all();
+
+        if (state.stopping)
+        {
+            return false;
+        }
+
+        if (connected)
+        {
+            notify(state, lock, CardEvent::CONNECTION_RESTORED, nullptr, 0);
+            return true;
+        }
+
+        delay = std::min(delay * 2, MaxReconnectDelay);
+    }
+}
+
+void CardMonitor::run(std::shared_ptr<State> state)
+{
+    BYTE uid[MaxUidLength]{};
+    BYTE lastUid[MaxUidLength]{};
+    DWORD uidLength = 0;
+    DWORD lastUidLength = 0;
+    bool present = false;
+    bool reconnected = false;
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+
+    while (!state->stopping)
+    {
+        state->polling = true;
+        lock.unlock();
+
+        memcpy(lastUid, uid, sizeof(uid));
+        lastUidLength = uidLength;
+        /* The card may have been swapped while the connection was lost */
+        PollResult result = state->poll(uid, uidLength, present && !reconnected);
+        reconnected = false;
+
+        lock.lock();
+        state->polling = false;
+        state->cv.notify_all();
+
+        if (state->stopping)
+        {
+            break;
+        }
+
+        if (result == PollResult::CONNECTION_LOST)
+        {
+            /* The card that was present before is compared with the one found after reconnecting */
+            memcpy(uid, lastUid, sizeof(uid));
+            uidLength = lastUidLength;
+            notify(*state, lock, CardEvent::CONNECTION_LOST, uid, 0);
+
+            if (!state->reconnect || !reconnect(*state, lock))
+            {
+                break;
+            }
+
+            reconnected = true;
+            continue;
+        }
+
+        if (result == PollResult::CARD_PRESENT)
+        {
+            if (!present || uidLength != lastUidLength || memcmp(uid, lastUid, uidLength) != 0)
+            {
+                notify(*state, lock, CardEvent::INSERTED, uid, uidLength);
+            }
+
+            present = true;
+        }
+        else
+        {
+            memcpy(uid, lastUid, sizeof(uid));
+            uidLength = lastUidLength;
+
+            if (present)
+            {
+                notify(*state, lock, CardEvent::REMOVED, uid, uidLength);
+                uidLength = 0;
+            }
+
+            present = false;
+        }
+
+        state->cv.wait_for(lock, state->interval, [&state] { return state->stopping; });
+    }
+}
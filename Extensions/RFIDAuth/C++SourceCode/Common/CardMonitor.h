@@ -0,0 +1,75 @@
+#pragma once
+#include "Platform.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+enum class CardEvent : DWORD
+{
+    REMOVED = 0,
+    INSERTED = 1,
+    CONNECTION_LOST = 2,
+    CONNECTION_RESTORED = 3
+};
+
+enum class PollResult
+{
+    CARD_PRESENT,
+    NO_CARD,
+    CONNECTION_LOST
+};
+
+constexpr DWORD MaxUidLength = 32;
+
+class CardEventQueue;
+
+/* Invoked on the monitoring thread. The timestamp is in milliseconds since the Unix epoch. */
+typedef void(__stdcall* CardEventCallback)(DWORD event, const BYTE* uid, DWORD uidLength, ULONGLONG timestamp);
+
+/* Polls a reader on a background thread and reports insert and remove
+ * transitions. After reporting CONNECTION_LOST the thread stops by itself,
+ * unless it has a reconnect function. Then it tries to reconnect after a delay
+ * that doubles from MinReconnectDelay up to MaxReconnectDelay and reports
+ * CONNECTION_RESTORED once it succeeded. The first poll after that reads the
+ * card again, so a card that was swapped meanwhile is reported. Events go
+ * to the callback, to the queue or to both. */
+class CardMonitor
+{
+   public:
+    /* Query the reader once. uid still holds the UID of the previous poll, so
+     * the function may leave it untouched if it knows the card is unchanged. */
+    using PollFunction = std::function<PollResult(BYTE* uid, DWORD& uidLength, bool cardPresent)>;
+    /* Open the connection again. attempt counts the attempts since the
+     * connection was lost, starting at 1. Returns true once the reader can be
+     * polled again. */
+    using ReconnectFunction = std::function<bool(unsigned int attempt)>;
+
+    /* The longest delay bounds the time from the reader coming back to the first poll */
+    static constexpr std::chrono::milliseconds MinReconnectDelay{50};
+    static constexpr std::chrono::milliseconds MaxReconnectDelay{400};
+
+    /* The queue must outlive the monitor, which is its only producer */
+    CardMonitor(PollFunction poll, CardEventCallback callback, std::chrono::milliseconds interval,
+                ReconnectFunction reconnect = nullptr, CardEventQueue* queue = nullptr);
+    CardMonitor(const CardMonitor&) = delete;
+    CardMonitor& operator=(const CardMonitor&) = delete;
+    ~CardMonitor();
+
+    /* Returns as soon as the poll function is no longer running. An event that
+     * was detected right before may still be delivered after stop() returned,
+     * because the callback can block on the caller's event loop. */
+    void stop();
+
+   private:
+    struct State;
+
+    std::shared_ptr<State> state;
+    std::thread thread;
+
+    static void run(std::shared_ptr<State> state);
+    /* Called with the mutex of the state locked, which is released during the callback */
+    static void notify(State& state, std::unique_lock<std::mutex>& lock, CardEvent event, const BYTE* uid,
+                       DWORD uidLength);
+    static bool reconnect(State& state, std::unique_lock<std::mutex>& lock);
+};
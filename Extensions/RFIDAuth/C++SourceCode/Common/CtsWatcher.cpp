@@ -0,0 +1,129 @@
+#include "CtsWatcher.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+constexpr std::chrono::milliseconds CtsWatcher::WaitSlice;
+
+static ULONGLONG unixMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+struct CtsWatcher::State
+{
+    LineFunction onLine;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<LineEvent> queue;
+    size_t changes = 0;
+    bool stopping = false;
+    bool stopped = false;
+};
+
+CtsWatcher::CtsWatcher(Transport& port, LineFunction onLine) : state(std::make_shared<State>())
+{
+    state->onLine = std::move(onLine);
+
+    /* The state is read before the constructor returns, so a change right after it is queued */
+    bool cts = false;
+    IoStatus status = port.getCts(cts);
+    thread = std::thread(run, state, std::ref(port), cts, status);
+}
+
+CtsWatcher::~CtsWatcher() { stop(); }
+
+void CtsWatcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->stopping = true;
+        state->cv.notify_all();
+    }
+
+    /* The thread never calls back into JS, so it can always be joined */
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+size_t CtsWatcher::take(LineEvent* events, size_t capacity, Clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait_until(lock, deadline, [this] { return !state->queue.empty() || state->stopped; });
+
+    size_t count = 0;
+
+    while (count < capacity && !state->queue.empty())
+    {
+        events[count++] = state->queue.front();
+        state->queue.pop_front();
+    }
+
+    return count;
+}
+
+size_t CtsWatcher::changes() const
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->changes;
+}
+
+size_t CtsWatcher::waitForChange(size_t seen, Clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait_until(lock, deadline, [this, seen] { return state->changes != seen || state->stopped; });
+    return state->changes;
+}
+
+void CtsWatcher::run(std::shared_ptr<State> state, Transport& port, bool cts, IoStatus status)
+{
+    while (status != IoStatus::IO_ERROR)
+    {
+        state->onLine(cts);
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+
+            if (state->stopping)
+            {
+                break;
+            }
+        }
+
+        const bool last = cts;
+        status = port.waitCtsChange(cts, Clock::now() + WaitSlice);
+
+        if (status != IoStatus::SUCCESS || cts == last)
+        {
+            continue;
+        }
+
+        const ULONGLONG timestamp = unixMilliseconds();
+        std::lock_guard<std::mutex> lock(state->mutex);
+
+        if (state->queue.size() == QueueCapacity)
+        {
+            state->queue.pop_front();
+        }
+
+        state->queue.push_back({(DWORD)(cts ? CardEvent::INSERTED : CardEvent::REMOVED), timestamp});
+        state->changes++;
+        state->cv.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    if (status == IoStatus::IO_ERROR)
+    {
+        const ULONGLONG timestamp = unixMilliseconds();
+        state->queue.push_back({(DWORD)CardEvent::CONNECTION_LOST, timestamp});
+        state->changes++;
+    }
+
+    state->stopped = true;
+    state->cv.notify_all();
+}
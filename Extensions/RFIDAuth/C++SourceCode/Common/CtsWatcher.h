@@ -0,0 +1,57 @@
+#pragma once
+#include "Platform.h"
+#include "CardMonitor.h"
+#include "Transport.h"
+#include <functional>
+#include <memory>
+#include <thread>
+
+/* A change of the CTS line. event is a CardEvent, the timestamp is in milliseconds since the Unix epoch. */
+struct LineEvent
+{
+    DWORD event;
+    ULONGLONG timestamp;
+};
+
+/* Blocks on CTS changes of a port on a background thread and queues every
+ * change with the time it was detected. Readers that signal a present card or
+ * key with CTS are watched this way without any traffic on the line. An error
+ * of the port queues CONNECTION_LOST and ends the thread. */
+class CtsWatcher
+{
+   public:
+    /* Invoked on the watcher thread with the state of the line, after every change and at least every WaitSlice */
+    using LineFunction = std::function<void(bool cts)>;
+
+    /* The oldest event is dropped when the queue is full */
+    static constexpr size_t QueueCapacity = 64;
+    /* Longest single wait on the port, which bounds the time stop() takes */
+    static constexpr std::chrono::milliseconds WaitSlice{50};
+
+    /* The port must outlive the watcher or stop() must be called before it is closed */
+    CtsWatcher(Transport& port, LineFunction onLine);
+    CtsWatcher(const CtsWatcher&) = delete;
+    CtsWatcher& operator=(const CtsWatcher&) = delete;
+    ~CtsWatcher();
+
+    /* Wait until at least one event is queued or the deadline passes, then
+     * move up to capacity events into events, oldest first. Returns the number
+     * of events. Returns 0 right away once the watcher stopped. */
+    size_t take(LineEvent* events, size_t capacity, Clock::time_point deadline);
+
+    /* Number of changes seen so far. waitForChange() blocks until it differs
+     * from seen or the deadline passes and returns the new count. */
+    size_t changes() const;
+    size_t waitForChange(size_t seen, Clock::time_point deadline);
+
+    /* Returns once the thread ended. Blocked calls of take() and waitForChange() return. */
+    void stop();
+
+   private:
+    struct State;
+
+    std::shared_ptr<State> state;
+    std::thread thread;
+
+    static void run(std::shared_ptr<State> state, Transport& port, bool cts, IoStatus status);
+};
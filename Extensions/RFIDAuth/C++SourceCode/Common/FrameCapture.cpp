@@ -0,0 +1,90 @@
+#include "FrameCapture.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+constexpr size_t FrameCapture::Slots;
+constexpr size_t FrameCapture::MaxFrameBytes;
+
+/* pcap with nanosecond timestamps, readers tell the byte order from the magic number */
+static constexpr DWORD pcapMagic = 0xA1B23C4D;
+static constexpr DWORD linkTypeUser0 = 147;
+
+static void append(std::vector<BYTE>& file, DWORD value)
+{
+    const BYTE* bytes = (const BYTE*)&value;
+    file.insert(file.end(), bytes, bytes + sizeof(value));
+}
+
+void FrameCapture::record(FrameDirection direction, const BYTE* frame, size_t length)
+{
+    const ULONGLONG index = next.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[index % Slots];
+
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time = Clock::now().time_since_epoch().count();
+    slot.length = (DWORD)length;
+    slot.direction = direction;
+    memcpy(slot.frame, frame, std::min(length, MaxFrameBytes));
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+bool FrameCapture::dump(const std::string& path) const
+{
+    const ULONGLONG end = next.load(std::memory_order_acquire);
+    const ULONGLONG begin = end > Slots ? end - Slots : 0;
+
+    /* Wall-clock time of the monotonic clock's epoch */
+    const auto epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch() - Clock::now().time_since_epoch());
+
+    std::vector<BYTE> file;
+    file.reserve(24 + (size_t)(end - begin) * (16 + 1 + MaxFrameBytes));
+    append(file, pcapMagic);
+    append(file, 2 | 4 << 16);  // version 2.4
+    append(file, 0);            // time zone
+    append(file, 0);            // accuracy of the timestamps
+    append(file, (DWORD)(1 + MaxFrameBytes));
+    append(file, linkTypeUser0);
+
+    for (ULONGLONG index = begin; index < end; index++)
+    {
+        const Slot& slot = slots[index % Slots];
+        const ULONGLONG sequence = slot.sequence.load(std::memory_order_acquire);
+
+        if (sequence != 2 * index + 2)
+        {
+            continue;
+        }
+
+        BYTE frame[MaxFrameBytes];
+        const Clock::rep time = slot.time;
+        const DWORD length = slot.length;
+        const FrameDirection direction = slot.direction;
+        const size_t captured = std::min<size_t>(length, MaxFrameBytes);
+        memcpy(frame, slot.frame, captured);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        /* Overwritten while it was copied */
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+        {
+            continue;
+        }
+
+        const auto nanoseconds =
+            epoch + std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::duration(time));
+        append(file, (DWORD)(nanoseconds.count() / 1000000000));
+        append(file, (DWORD)(nanoseconds.count() % 1000000000));
+        append(file, (DWORD)(1 + captured));
+        append(file, 1 + length);
+        file.push_back((BYTE)direction);
+        file.insert(file.end(), frame, frame + captured);
+    }
+
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write((const char*)file.data(), (std::streamsize)file.size());
+    stream.close();
+    return !stream.fail();
+}
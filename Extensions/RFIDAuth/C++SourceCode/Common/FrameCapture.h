@@ -0,0 +1,46 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+#include <string>
+
+enum class FrameDirection : BYTE
+{
+    SENT = 0,     // host to reader
+    RECEIVED = 1  // reader to host
+};
+
+/* Keeps the last Slots frames that went over the line of a session with
+ * their direction and time, so the traffic before a fault can be examined
+ * after the fact. Recording claims a slot with one atomic increment and
+ * copies the frame, it takes no lock and never blocks. Each slot is guarded
+ * by a sequence number like a seqlock: the dump skips slots that are written
+ * or overwritten while it copies them. Frames longer than MaxFrameBytes are
+ * truncated, their original length is kept. */
+class FrameCapture
+{
+   public:
+    static constexpr size_t Slots = 512;
+    /* Covers the longest iDTRONIC frame and an EKS response of 128 bytes with every byte doubled */
+    static constexpr size_t MaxFrameBytes = 272;
+
+    void record(FrameDirection direction, const BYTE* frame, size_t length);
+
+    /* Write the captured frames, oldest first, to a pcap file with nanosecond timestamps and link type USER0. Each
+     * packet starts with the FrameDirection followed by the frame. The monotonic times of the frames are converted to
+     * wall-clock time when the file is written. */
+    bool dump(const std::string& path) const;
+
+   private:
+    struct Slot
+    {
+        /* 2 * index + 1 while frame index is written, 2 * index + 2 once it is complete */
+        std::atomic<ULONGLONG> sequence{0};
+        Clock::rep time;
+        DWORD length;
+        FrameDirection direction;
+        BYTE frame[MaxFrameBytes];
+    };
+
+    std::atomic<ULONGLONG> next{0};
+    Slot slots[Slots];
+};
@@ -0,0 +1,308 @@
+#pragma once
+#include "Platform.h"
+#include <cstddef>
+
+/* Encoders and decoders for the frames of the EKS and iDTRONIC readers. They
+ * work on caller-provided buffers only, never allocate and never write past
+ * the given capacity. Decoding happens in place: the result points into or
+ * overwrites the received bytes. */
+
+enum class DecodeStatus
+{
+    INCOMPLETE,
+    COMPLETE,
+    ERR_FRAMING,
+    ERR_OVERFLOW,
+    ERR_CHECKSUM
+};
+
+/***************************************************** EKS ******************************************************/
+
+/* An EKS frame is a body with doubled DLEs followed by DLE ETX BCC. The first
+ * body byte is the length of the body. The BCC is the XOR of the unstuffed
+ * body bytes, DLE and ETX. */
+struct EKSFrame
+{
+    static constexpr BYTE DLE = 0x10;
+    static constexpr BYTE ETX = 0x03;
+
+    /* Size of the tail (DLE ETX BCC) */
+    static constexpr size_t TailSize = 3;
+
+    /* Largest possible frame for a body of length bytes, when every byte is a DLE */
+    static constexpr size_t maxEncodedSize(size_t length) { return 2 * length + TailSize; }
+
+    /* Encode body into out. Returns the frame length or 0 if the frame does not fit into capacity. */
+    static constexpr size_t encode(const BYTE* body, size_t length, BYTE* out, size_t capacity)
+    {
+        size_t n = 0;
+        BYTE bcc = 0x00;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            const BYTE b = body[i];
+
+            if (n + (b == DLE ? 2 : 1) + TailSize > capacity)
+            {
+                return 0;
+            }
+
+            /* The DLE byte needs to be sent twice */
+            if (b == DLE)
+            {
+                out[n++] = DLE;
+            }
+
+            out[n++] = b;
+            bcc ^= b;
+        }
+
+        if (n + TailSize > capacity)
+        {
+            return 0;
+        }
+
+        out[n++] = DLE;
+        out[n++] = ETX;
+        out[n++] = bcc ^ DLE ^ ETX;
+        return n;
+    }
+
+    /* Strip the doubled DLEs of a received frame in place and check the BCC.
+     * On COMPLETE, the body is at the start of frame and bodyLength bytes long.
+     * Bytes after the end of the frame are ignored. */
+    static constexpr DecodeStatus decode(BYTE* frame, size_t length, size_t& bodyLength)
+    {
+        size_t n = 0;
+        BYTE bcc = 0x00;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            const BYTE b = frame[i];
+
+            if (b != DLE)
+            {
+                frame[n++] = b;
+                bcc ^= b;
+                continue;
+            }
+
+            if (++i == length)
+            {
+                return DecodeStatus::INCOMPLETE;
+            }
+
+            if (frame[i] == DLE)
+            {
+                frame[n++] = DLE;
+                bcc ^= DLE;
+                continue;
+            }
+
+            if (frame[i] != ETX)
+            {
+                return DecodeStatus::ERR_FRAMING;
+            }
+
+            if (++i == length)
+            {
+                return DecodeStatus::INCOMPLETE;
+            }
+
+            bodyLength = n;
+            return frame[i] == (BYTE)(bcc ^ DLE ^ ETX) ? DecodeStatus::COMPLETE : DecodeStatus::ERR_CHECKSUM;
+        }
+
+        return DecodeStatus::INCOMPLETE;
+    }
+};
+
+/* Decodes an EKS frame from chunks of any size as they arrive, for replies
+ * whose length is only known at the end of the frame. */
+class EKSFrameDecoder
+{
+    BYTE* out;
+    size_t capacity;
+    size_t length = 0;
+    BYTE bcc = 0x00;
+    bool pendingDle = false;
+    bool awaitingBcc = false;
+    DecodeStatus status = DecodeStatus::INCOMPLETE;
+
+   public:
+    EKSFrameDecoder(BYTE* out, size_t capacity) : out(out), capacity(capacity) {}
+
+    /* Consume a chunk of received bytes. Bytes after the end of the frame are ignored. */
+    DecodeStatus feed(const BYTE* chunk, size_t size)
+    {
+        for (size_t i = 0; i < size && status == DecodeStatus::INCOMPLETE; i++)
+        {
+            const BYTE b = chunk[i];
+
+            if (awaitingBcc)
+            {
+                status = b == bcc ? DecodeStatus::COMPLETE : DecodeStatus::ERR_CHECKSUM;
+            }
+            else if (pendingDle)
+            {
+                pendingDle = false;
+
+                if (b == EKSFrame::DLE)
+                {
+                    append(b);
+                }
+                else if (b == EKSFrame::ETX)
+                {
+                    bcc ^= EKSFrame::DLE ^ EKSFrame::ETX;
+                    awaitingBcc = true;
+                }
+                else
+                {
+                    status = DecodeStatus::ERR_FRAMING;
+                }
+            }
+            else if (b == EKSFrame::DLE)
+            {
+                pendingDle = true;
+            }
+            else
+            {
+                append(b);
+            }
+        }
+
+        return status;
+    }
+
+    /* Number of unstuffed bytes written to the output buffer */
+    size_t size() const { return length; }
+
+   private:
+    void append(BYTE b)
+    {
+        if (length == capacity)
+        {
+            status = DecodeStatus::ERR_OVERFLOW;
+            return;
+        }
+
+        out[length++] = b;
+        bcc ^= b;
+    }
+};
+
+/*************************************************** iDTRONIC ***************************************************/
+
+/* A command of the iDTRONIC readers and the allowed number of parameter bytes */
+struct IDTRONICCommand
+{
+    BYTE code;
+    BYTE minParameters;
+    BYTE maxParameters;
+};
+
+/* A decoded reply. data points into the received frame. */
+struct IDTRONICReply
+{
+    BYTE address;
+    BYTE status;
+    const BYTE* data;
+    size_t dataLength;
+};
+
+/* Requests are STX address length command parameters... checksum ETX, replies
+ * carry a status byte in place of the command. length counts the command or
+ * status byte and the data, the checksum is the XOR of address to data. */
+struct IDTRONICFrame
+{
+    static constexpr BYTE STX = 0xAA;
+    static constexpr BYTE ETX = 0xBB;
+
+    /* STX, address and length */
+    static constexpr size_t HeaderSize = 3;
+    /* STX, address, length, checksum and ETX */
+    static constexpr size_t Overhead = 5;
+    /* The length byte limits a frame to 255 bytes of command and data */
+    static constexpr size_t MaxFrameSize = Overhead + 0xFF;
+
+    /* Encode a request into out. Returns the frame length or 0 if the number
+     * of parameters does not match the command or the frame does not fit into capacity. */
+    static constexpr size_t encode(BYTE address, const IDTRONICCommand& command, const BYTE* parameters,
+                                   size_t parameterLength, BYTE* out, size_t capacity)
+    {
+        if (parameterLength < command.minParameters || parameterLength > command.maxParameters ||
+            parameterLength + 1 > 0xFF || parameterLength + 1 + Overhead > capacity)
+        {
+            return 0;
+        }
+
+        size_t n = 0;
+        out[n++] = STX;
+        out[n++] = address;
+        out[n++] = (BYTE)(parameterLength + 1);
+        out[n++] = command.code;
+
+        for (size_t i = 0; i < parameterLength; i++)
+        {
+            out[n++] = parameters[i];
+        }
+
+        BYTE checkSum = 0x00;
+
+        for (size_t i = 1; i < n; i++)
+        {
+            checkSum ^= out[i];
+        }
+
+        out[n++] = checkSum;
+        out[n++] = ETX;
+        return n;
+    }
+
+    /* Number of bytes that follow a received header */
+    static constexpr size_t remaining(const BYTE* header) { return header[2] + 2; }
+
+    /* Validate a received frame in place. Bytes after the end of the frame are ignored. */
+    static constexpr DecodeStatus decode(const BYTE* frame, size_t length, IDTRONICReply& reply)
+    {
+        if (length < HeaderSize)
+        {
+            return DecodeStatus::INCOMPLETE;
+        }
+
+        if (frame[0] != STX || frame[2] == 0)
+        {
+            return DecodeStatus::ERR_FRAMING;
+        }
+
+        const size_t frameLength = HeaderSize + remaining(frame);
+
+        if (length < frameLength)
+        {
+            return DecodeStatus::INCOMPLETE;
+        }
+
+        if (frame[frameLength - 1] != ETX)
+        {
+            return DecodeStatus::ERR_FRAMING;
+        }
+
+        BYTE checkSum = 0x00;
+
+        for (size_t i = 1; i < frameLength - 2; i++)
+        {
+            checkSum ^= frame[i];
+        }
+
+        if (checkSum != frame[frameLength - 2])
+        {
+            return DecodeStatus::ERR_CHECKSUM;
+        }
+
+        reply.address = frame[1];
+        reply.status = frame[3];
+        reply.data = &frame[4];
+        reply.dataLength = frame[2] - 1u;
+        return DecodeStatus::COMPLETE;
+    }
+};
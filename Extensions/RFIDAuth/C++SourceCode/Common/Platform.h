@@ -0,0 +1,35 @@
+#pragma once
+
+// The reader drivers are written against the Win32 types. On other platforms
+// (e.g. TwinCAT/BSD or a Linux build box) the few types and macros they rely
+// on are provided here so the protocol code compiles unchanged.
+
+#ifdef _WIN32
+/* The min and max macros of Windows.h would break std::min and std::max */
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <cstdint>
+
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef uint64_t ULONGLONG;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef void VOID;
+typedef void* HANDLE;
+
+#define TRUE 1
+#define FALSE 0
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+#define __stdcall
+#define __declspec(x) __attribute__((visibility("default")))
+#endif
+
+#include <chrono>
+
+/* All timeouts and deadlines of the drivers are based on this monotonic clock */
+using Clock = std::chrono::steady_clock;
@@ -0,0 +1,232 @@
+#include "ReaderDiscovery.h"
+#include "FrameCodec.h"
+#include "SerialPort.h"
+#include <algorithm>
+#include <cctype>
+#include <thread>
+
+constexpr std::chrono::milliseconds ReaderDiscovery::ProbeTimeout;
+
+static constexpr IDTRONICCommand CMD_GetVersionNum{0x86, 0, 0};
+
+static constexpr BYTE EKS_STX = 0x02;
+static constexpr BYTE EKS_DLE = EKSFrame::DLE;
+
+/* A Baltech reader in autoread mode sends at least a 4 byte UID as hex digits, optionally followed by CR or LF */
+static constexpr size_t MinBaltechDigits = 8;
+
+/* True if received holds nothing but hex digits and line breaks, like the UIDs of a reader in autoread mode. complete
+ * is set once a line with a whole UID ended. The first line may have been cut off when the port was opened. */
+static bool isAutoread(const BYTE* received, size_t length, bool& complete)
+{
+    size_t digits = 0;
+    complete = false;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (isxdigit(received[i]))
+        {
+            digits++;
+        }
+        else if (received[i] == '\r' || received[i] == '\n')
+        {
+            complete = complete || digits >= MinBaltechDigits;
+            digits = 0;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return complete || digits >= MinBaltechDigits;
+}
+
+ReaderType ReaderDiscovery::probeIDTRONIC(const std::string& device, DWORD& address)
+{
+    SerialPort port;
+
+    if (!port.open(device, 9600, Parity::NONE))
+    {
+        return ReaderType::NONE;
+    }
+
+    BYTE request[IDTRONICFrame::MaxFrameSize];
+    const size_t length = IDTRONICFrame::encode(0x00, CMD_GetVersionNum, nullptr, 0, request, sizeof(request));
+    const Clock::time_point deadline = Clock::now() + ProbeTimeout;
+    port.purge();
+
+    if (port.write(request, length, deadline) != IoStatus::SUCCESS)
+    {
+        return ReaderType::NONE;
+    }
+
+    /* Whatever arrives is either the reply or, from a Baltech reader, a UID that was read meanwhile */
+    BYTE received[IDTRONICFrame::MaxFrameSize];
+    size_t total = 0;
+
+    while (total < sizeof(received))
+    {
+        size_t count = 0;
+
+        if (port.readSome(received + total, sizeof(received) - total, count, deadline) != IoStatus::SUCCESS)
+        {
+            break;
+        }
+
+        total += count;
+        IDTRONICReply reply{};
+        bool complete = false;
+
+        if (IDTRONICFrame::decode(received, total, reply) == DecodeStatus::COMPLETE)
+        {
+            address = reply.address;
+            return ReaderType::IDTRONIC;
+        }
+
+        if (isAutoread(received, total, complete) && complete)
+        {
+            return ReaderType::BALTECH;
+        }
+    }
+
+    bool complete = false;
+    return isAutoread(received, total, complete) ? ReaderType::BALTECH : ReaderType::NONE;
+}
+
+bool ReaderDiscovery::probeEKS(const std::string& device)
+{
+    SerialPort port;
+
+    if (!port.open(device, 9600, Parity::EVEN))
+    {
+        return false;
+    }
+
+    const Clock::time_point deadline = Clock::now() + ProbeTimeout;
+    BYTE answer = 0x00;
+    port.purge();
+
+    if (port.write(&EKS_STX, 1, deadline) != IoStatus::SUCCESS ||
+        port.read(&answer, 1, deadline) != IoStatus::SUCCESS || answer != EKS_DLE)
+    {
+        return false;
+    }
+
+    /* An empty frame with a wrong BCC, the reader answers NAK and waits for the next STX */
+    const BYTE abort[]{EKSFrame::DLE, EKSFrame::ETX, 0x00};
+
+    if (port.write(abort, sizeof(abort), deadline) == IoStatus::SUCCESS)
+    {
+        port.read(&answer, 1, deadline);
+    }
+
+    return true;
+}
+
+ReaderType ReaderDiscovery::probe(const std::string& device, ReaderType expected, DWORD& address)
+{
+    address = 0;
+    const bool eksFirst = expected == ReaderType::NONE || expected == ReaderType::EKS;
+
+    if (eksFirst && probeEKS(device))
+    {
+        return ReaderType::EKS;
+    }
+
+    const ReaderType type = probeIDTRONIC(device, address);
+
+    if (type != ReaderType::NONE)
+    {
+        return type;
+    }
+
+    return !eksFirst && probeEKS(device) ? ReaderType::EKS : ReaderType::NONE;
+}
+
+void ReaderDiscovery::probe(const std::vector<std::string>& devices, std::vector<DiscoveredReader>& readers)
+{
+    readers.assign(devices.size(), DiscoveredReader{0, (DWORD)ReaderType::NONE, 0});
+    std::vector<std::thread> threads;
+    threads.reserve(devices.size());
+
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        threads.emplace_back([&devices, &readers, i]
+                             { readers[i].type = (DWORD)probe(devices[i], ReaderType::NONE, readers[i].address); });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+size_t ReaderDiscovery::discover(DWORD knownPort, ReaderType knownType, DiscoveredReader* readers, size_t capacity)
+{
+    if (capacity == 0)
+    {
+        return 0;
+    }
+
+    DWORD address = 0;
+    ReaderType type =
+        knownPort != 0 ? probe(SerialPort::deviceName(knownPort), knownType, address) : ReaderType::NONE;
+
+    if (type != ReaderType::NONE)
+    {
+        readers[0] = {knownPort, (DWORD)type, address};
+        return 1;
+    }
+
+    BYTE ports[255];
+    const size_t portCount = SerialPort::enumerate(ports, sizeof(ports));
+    std::sort(ports, ports + portCount);
+
+    std::vector<std::string> devices;
+    std::vector<DWORD> numbers;
+
+    for (size_t i = 0; i < portCount; i++)
+    {
+        /* The known port was probed already */
+        if (ports[i] != knownPort)
+        {
+            devices.push_back(SerialPort::deviceName(ports[i]));
+            numbers.push_back(ports[i]);
+        }
+    }
+
+    std::vector<DiscoveredReader> found;
+    probe(devices, found);
+    size_t count = 0;
+
+    for (size_t i = 0; i < found.size() && count < capacity; i++)
+    {
+        if (found[i].type != (DWORD)ReaderType::NONE)
+        {
+            readers[count] = found[i];
+            readers[count++].port = numbers[i];
+        }
+    }
+
+    return count;
+}
+
+DWORD ReaderDiscovery::locate(ReaderType type, DWORD address)
+{
+    DiscoveredReader readers[32];
+    const size_t count = discover(0, ReaderType::NONE, readers, sizeof(readers) / sizeof(readers[0]));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        /* Every iDTRONIC reader answers the probe to address 0 with its own address */
+        const bool sameAddress = type != ReaderType::IDTRONIC || address == 0 || readers[i].address == address;
+
+        if (readers[i].type == (DWORD)type && sameAddress)
+        {
+            return readers[i].port;
+        }
+    }
+
+    return 0;
+}
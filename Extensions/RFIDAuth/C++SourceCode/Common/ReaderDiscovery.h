@@ -0,0 +1,55 @@
+#pragma once
+#include "Platform.h"
+#include <string>
+#include <vector>
+
+enum class ReaderType : DWORD
+{
+    NONE = 0,
+    EKS = 1,
+    IDTRONIC = 2,
+    BALTECH = 3
+};
+
+/* A reader found on a serial port. type is a ReaderType. */
+struct DiscoveredReader
+{
+    DWORD port;
+    DWORD type;
+    DWORD address;  // Bus address of an iDTRONIC reader, 0 for the others
+};
+
+/* Finds readers on serial ports without knowing the port or the type in
+ * advance. A port is probed for every type in turn at 9600 baud, the expected
+ * type first:
+ *
+ *  - EKS: STX answered with DLE. The handshake is ended with a frame with a wrong BCC, which the reader rejects with
+ *    NAK, so it is ready for the next connection at once.
+ *  - iDTRONIC: CMD_GetVersionNum to address 0, which every reader answers with its own address
+ *  - Baltech: the reader only sends when a card is presented, with autoread a UID in hex digits. It is recognized if
+ *    that happens while the port is probed for an iDTRONIC reader, which uses the same line settings.
+ *
+ * Every probe waits at most ProbeTimeout. Ports are probed at the same time,
+ * one thread each, so discovery takes as long as probing a single port. Ports
+ * that are in use cannot be opened and are skipped. */
+class ReaderDiscovery
+{
+   public:
+    static constexpr std::chrono::milliseconds ProbeTimeout{200};
+
+    /* Probe one device for every reader type, starting with expected unless it is NONE. Returns ReaderType::NONE if no
+     * reader answers. */
+    static ReaderType probe(const std::string& device, ReaderType expected, DWORD& address);
+    /* Probe all devices at the same time. readers receives one entry per device with the port left 0. */
+    static void probe(const std::vector<std::string>& devices, std::vector<DiscoveredReader>& readers);
+    /* Probe knownPort for knownType first, e.g. the reader found last time. If no reader answers there, all ports of
+     * the system are probed. Copies up to capacity readers in the order of their port and returns their number. */
+    static size_t discover(DWORD knownPort, ReaderType knownType, DiscoveredReader* readers, size_t capacity);
+    /* Probe all ports of the system for a reader of type, an iDTRONIC reader at address unless it is 0. Returns its
+     * port or 0. Used to find a reader whose USB adapter came back under another port number. */
+    static DWORD locate(ReaderType type, DWORD address);
+
+   private:
+    static ReaderType probeIDTRONIC(const std::string& device, DWORD& address);
+    static bool probeEKS(const std::string& device);
+};
@@ -0,0 +1,34 @@
+#include "RetryPolicy.h"
+#include <algorithm>
+#include <thread>
+
+void Retrier::sleepBackoff(const RetryPolicy& policy, unsigned int retry)
+{
+    /* The doubling is capped before it could overflow */
+    const std::chrono::milliseconds backoff =
+        std::min<std::chrono::milliseconds>(policy.backoff * (1 << std::min(retry, 16u)), policy.maxBackoff);
+    std::chrono::milliseconds jitter(0);
+
+    /* Half of the backoff is random, so readers that failed together do not retry in lockstep */
+    if (backoff.count() >= 2)
+    {
+        std::lock_guard<std::mutex> lock(randomMutex);
+        jitter = std::chrono::milliseconds(random() % (backoff.count() / 2 + 1));
+    }
+
+    std::this_thread::sleep_for(backoff - jitter);
+}
+
+void Retrier::count(Attempt result, bool repeated)
+{
+    if (result != Attempt::DONE)
+    {
+        failed++;
+    }
+    else if (repeated)
+    {
+        recovered++;
+    }
+}
+
+RetryCounters Retrier::counters() const { return {resends, retries, recovered, failed}; }
@@ -0,0 +1,90 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+#include <mutex>
+#include <random>
+
+/* How often a command is sent again when its reply is missing or corrupted */
+struct RetryPolicy
+{
+    /* Resends right away after a corrupted reply or a NAK. The reader is
+     * alive, so waiting would only cost time. */
+    unsigned int resends;
+    /* Retries after a timeout, each after a backoff of backoff * 2^n with
+     * jitter, at most maxBackoff */
+    unsigned int retries;
+    std::chrono::milliseconds backoff;
+    std::chrono::milliseconds maxBackoff;
+};
+
+/* Default for commands that can be repeated without harm, e.g. reads and writes of the same data */
+constexpr RetryPolicy DefaultRetryPolicy{2, 2, std::chrono::milliseconds(10), std::chrono::milliseconds(200)};
+/* For commands that must not run twice, e.g. an increment whose reply was lost after it was executed */
+constexpr RetryPolicy NoRetryPolicy{0, 0, std::chrono::milliseconds(0), std::chrono::milliseconds(0)};
+
+/* Counters of a session, exported by the drivers */
+struct RetryCounters
+{
+    DWORD resends;
+    DWORD retries;
+    DWORD recovered;  // commands that succeeded after a resend or retry
+    DWORD failed;     // commands whose last attempt failed as well
+};
+
+/* Result of one attempt of a command */
+enum class Attempt
+{
+    DONE,  // a reply was received or repeating cannot help
+    CORRUPTED,
+    TIMED_OUT,
+    FAILED  // the port failed before the command was sent, it is not repeated
+};
+
+/* Repeats commands according to a RetryPolicy and counts the repetitions.
+ * Thread safe. */
+class Retrier
+{
+   public:
+    /* Call attempt until it returns DONE or the policy allows no further
+     * attempt, and return the result of the last attempt */
+    template <typename Function>
+    Attempt run(const RetryPolicy& policy, Function attempt)
+    {
+        unsigned int resent = 0;
+        unsigned int retried = 0;
+
+        for (;;)
+        {
+            const Attempt result = attempt();
+
+            if (result == Attempt::CORRUPTED && resent < policy.resends)
+            {
+                resent++;
+                resends++;
+            }
+            else if (result == Attempt::TIMED_OUT && retried < policy.retries)
+            {
+                sleepBackoff(policy, retried++);
+                retries++;
+            }
+            else
+            {
+                count(result, resent + retried > 0);
+                return result;
+            }
+        }
+    }
+
+    RetryCounters counters() const;
+
+   private:
+    std::atomic<DWORD> resends{0};
+    std::atomic<DWORD> retries{0};
+    std::atomic<DWORD> recovered{0};
+    std::atomic<DWORD> failed{0};
+    std::mutex randomMutex;
+    std::minstd_rand random;
+
+    void sleepBackoff(const RetryPolicy& policy, unsigned int retry);
+    void count(Attempt result, bool repeated);
+};
@@ -0,0 +1,101 @@
+#include "RttEstimator.h"
+#include <algorithm>
+
+constexpr std::chrono::milliseconds RttEstimator::MinTimeout;
+
+/* Limits the doubling, the ceiling is reached long before */
+static constexpr unsigned int maxBackoff = 16;
+
+Clock::duration RttEstimator::timeout(const Entry& entry)
+{
+    if (entry.samples == 0)
+    {
+        return entry.ceiling;
+    }
+
+    const Clock::duration estimate = std::max<Clock::duration>(entry.smoothed + 4 * entry.variation, MinTimeout);
+    return std::min(estimate * (1 << entry.backoff), entry.ceiling);
+}
+
+Clock::duration RttEstimator::timeout(DWORD exchange, Clock::duration ceiling)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(exchange);
+
+    if (it == entries.end())
+    {
+        /* Drop an arbitrary estimate rather than growing without bounds, it is measured again when needed */
+        if (entries.size() == MaxExchanges)
+        {
+            entries.erase(entries.begin());
+        }
+
+        it = entries.emplace(exchange, Entry{0, {}, {}, ceiling, 0}).first;
+    }
+
+    it->second.ceiling = ceiling;
+    return timeout(it->second);
+}
+
+void RttEstimator::sample(DWORD exchange, Clock::duration rtt)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(exchange);
+
+    if (it == entries.end())
+    {
+        return;
+    }
+
+    Entry& entry = it->second;
+
+    if (entry.samples == 0)
+    {
+        entry.smoothed = rtt;
+        entry.variation = rtt / 2;
+    }
+    else
+    {
+        const Clock::duration error = rtt > entry.smoothed ? rtt - entry.smoothed : entry.smoothed - rtt;
+        entry.variation += (error - entry.variation) / 4;
+        entry.smoothed += (rtt - entry.smoothed) / 8;
+    }
+
+    entry.samples++;
+    entry.backoff = 0;
+}
+
+void RttEstimator::timedOut(DWORD exchange)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(exchange);
+
+    if (it != entries.end() && it->second.backoff < maxBackoff)
+    {
+        it->second.backoff++;
+    }
+}
+
+void RttEstimator::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+size_t RttEstimator::estimates(RttEstimate* estimates, size_t capacity) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+
+    for (auto it = entries.begin(); it != entries.end() && count < capacity; ++it, ++count)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        const Entry& entry = it->second;
+        estimates[count] = {it->first, entry.samples, (DWORD)duration_cast<microseconds>(entry.smoothed).count(),
+                            (DWORD)duration_cast<microseconds>(entry.variation).count(),
+                            (DWORD)duration_cast<microseconds>(timeout(entry)).count()};
+    }
+
+    return count;
+}
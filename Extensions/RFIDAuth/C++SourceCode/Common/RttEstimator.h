@@ -0,0 +1,56 @@
+#pragma once
+#include "Platform.h"
+#include <map>
+#include <mutex>
+
+/* The estimate of one kind of exchange with a reader, all times in microseconds. The meaning of exchange is defined by
+ * the driver. */
+struct RttEstimate
+{
+    DWORD exchange;
+    DWORD samples;
+    DWORD smoothed;
+    DWORD variation;
+    DWORD timeout;
+};
+
+/* Derives reply timeouts from the measured round trip times like TCP derives
+ * its retransmission timeout (RFC 6298): the timeout is SRTT + 4 * RTTVAR,
+ * where SRTT and RTTVAR are smoothed with gains of 1/8 and 1/4, and at least
+ * MinTimeout. The fixed timeout of the command is passed as ceiling and used
+ * as long as an exchange has no sample. Every timeout doubles the timeout of
+ * the exchange until the next reply, so a reader that became slower is
+ * measured again instead of failing for good.
+ *
+ * The reader needs longer for some commands than for others, so every kind
+ * of exchange is estimated on its own. Thread safe. */
+class RttEstimator
+{
+   public:
+    static constexpr std::chrono::milliseconds MinTimeout{50};
+    static constexpr size_t MaxExchanges = 64;
+
+    Clock::duration timeout(DWORD exchange, Clock::duration ceiling);
+    void sample(DWORD exchange, Clock::duration rtt);
+    void timedOut(DWORD exchange);
+    /* Forget all estimates, e.g. after the line rate changed */
+    void reset();
+
+    /* Copy up to capacity estimates in the order of exchange and return their number */
+    size_t estimates(RttEstimate* estimates, size_t capacity) const;
+
+   private:
+    struct Entry
+    {
+        DWORD samples;
+        Clock::duration smoothed;
+        Clock::duration variation;
+        Clock::duration ceiling;
+        unsigned int backoff;
+    };
+
+    static Clock::duration timeout(const Entry& entry);
+
+    mutable std::mutex mutex;
+    std::map<DWORD, Entry> entries;
+};
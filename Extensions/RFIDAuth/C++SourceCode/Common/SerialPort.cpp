@@ -0,0 +1,701 @@
+#include "SerialPort.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#include <thread>
+#include <unistd.h>
+#endif
+
+/* Milliseconds until the deadline, rounded up so a wait never ends early */
+static long long remainingMilliseconds(Clock::time_point deadline)
+{
+    auto remaining = deadline - Clock::now();
+
+    if (remaining <= Clock::duration::zero())
+    {
+        return 0;
+    }
+
+    return std::chrono::duration_cast<std::chrono::milliseconds>(remaining + std::chrono::milliseconds(1) -
+                                                                 Clock::duration(1))
+        .count();
+}
+
+SerialPort::~SerialPort() { close(); }
+
+bool SerialPort::reopen(const std::string& device)
+{
+    const std::string target = device.empty() ? path : device;
+    return !target.empty() && open(target, rate, lineParity);
+}
+
+LineCounters SerialPort::lineCounters()
+{
+    countLineErrors();
+    return {bytesSent, bytesReceived, parityErrors, framingErrors, overruns, breaks};
+}
+
+#ifdef _WIN32
+
+std::string SerialPort::deviceName(unsigned int port)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "\\\\.\\COM%u", port);
+    return name;
+}
+
+size_t SerialPort::enumerate(BYTE* ports, size_t capacity)
+{
+    HKEY hKEY;
+    size_t count = 0;
+    LPCWSTR data_Set = L"HARDWARE\\DEVICEMAP\\SERIALCOMM\\";
+    long ret = RegOpenKeyExW(HKEY_LOCAL_MACHINE, data_Set, 0, KEY_READ, &hKEY);
+
+    if (ret != ERROR_SUCCESS)
+    {
+        return 0;
+    }
+
+    DWORD dwIndex = 0, lpcchValueName = 256, lpcbData = 256;
+    WCHAR lpValueName[256]{}, lpData[128]{};
+
+    for (; ret == ERROR_SUCCESS && count < capacity; dwIndex++)
+    {
+        ret = RegEnumValueW(hKEY, dwIndex, lpValueName, &lpcchValueName, NULL, NULL, (LPBYTE)lpData, &lpcbData);
+
+        if (ret == ERROR_SUCCESS)
+        {
+            ports[count++] = (BYTE)_wtoi(lpData + 3);
+        }
+
+        lpcchValueName = 256;
+        lpcbData = sizeof(lpData);
+    }
+
+    RegCloseKey(hKEY);
+    return count;
+}
+
+bool SerialPort::open(const std::string& device, unsigned int baudRate, Parity parity)
+{
+    close();
+
+    handle = CreateFileA(device.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED,
+                         NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    DCB dcb{};
+    dcb.DCBlength = sizeof(dcb);
+    SetupComm(handle, 1024, 256);
+
+    if (!GetCommState(handle, &dcb))
+    {
+        close();
+        return false;
+    }
+
+    dcb.BaudRate = baudRate;
+    dcb.ByteSize = 8;
+    dcb.StopBits = ONESTOPBIT;
+    dcb.fParity = parity != Parity::NONE;
+    dcb.Parity = parity == Parity::EVEN ? EVENPARITY : parity == Parity::ODD ? ODDPARITY : NOPARITY;
+
+    if (!SetCommState(handle, &dcb))
+    {
+        close();
+        return false;
+    }
+
+    /* ReadFile completes as soon as at least one byte is queued. The overall
+     * wait is bounded by the deadline passed to readSome(), not by the driver. */
+    COMMTIMEOUTS timeouts{};
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = 60000;
+
+    readEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    writeEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ctsEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    if (!SetCommTimeouts(handle, &timeouts) || !SetCommMask(handle, EV_CTS) || !readEvent || !writeEvent ||
+        !ctsEvent)
+    {
+        close();
+        return false;
+    }
+
+    PurgeComm(handle, PURGE_TXCLEAR | PURGE_RXCLEAR);
+    rate = baudRate;
+    path = device;
+    lineParity = parity;
+    return true;
+}
+
+void SerialPort::close()
+{
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        PurgeComm(handle, PURGE_RXCLEAR);
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+
+    if (readEvent)
+    {
+        CloseHandle(readEvent);
+        readEvent = nullptr;
+    }
+
+    if (writeEvent)
+    {
+        CloseHandle(writeEvent);
+        writeEvent = nullptr;
+    }
+
+    if (ctsEvent)
+    {
+        CloseHandle(ctsEvent);
+        ctsEvent = nullptr;
+    }
+}
+
+bool SerialPort::isOpen() const { return handle != INVALID_HANDLE_VALUE; }
+
+bool SerialPort::setBaudRate(unsigned int baudRate)
+{
+    DCB dcb{};
+    dcb.DCBlength = sizeof(dcb);
+
+    /* SetCommState waits until the transmit queue is empty */
+    if (!GetCommState(handle, &dcb))
+    {
+        return false;
+    }
+
+    dcb.BaudRate = baudRate;
+
+    if (!SetCommState(handle, &dcb))
+    {
+        return false;
+    }
+
+    rate = baudRate;
+    return true;
+}
+
+/* Wait for an overlapped operation until the deadline and cancel it if it is still pending */
+static IoStatus completeOverlapped(HANDLE handle, OVERLAPPED& ov, DWORD& transferred, Clock::time_point deadline)
+{
+    if (WaitForSingleObject(ov.hEvent, (DWORD)remainingMilliseconds(deadline)) != WAIT_OBJECT_0)
+    {
+        CancelIoEx(handle, &ov);
+    }
+
+    if (GetOverlappedResult(handle, &ov, &transferred, TRUE))
+    {
+        return IoStatus::SUCCESS;
+    }
+
+    return GetLastError() == ERROR_OPERATION_ABORTED ? IoStatus::TIMEOUT : IoStatus::IO_ERROR;
+}
+
+IoStatus SerialPort::readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline)
+{
+    received = 0;
+
+    do
+    {
+        OVERLAPPED ov{};
+        ov.hEvent = readEvent;
+        DWORD transferred = 0;
+
+        if (!ReadFile(handle, buffer, (DWORD)capacity, &transferred, &ov))
+        {
+            if (GetLastError() != ERROR_IO_PENDING)
+            {
+                return IoStatus::IO_ERROR;
+            }
+
+            IoStatus status = completeOverlapped(handle, ov, transferred, deadline);
+
+            if (status != IoStatus::SUCCESS)
+            {
+                return status;
+            }
+        }
+
+        if (transferred)
+        {
+            received = transferred;
+            bytesReceived.fetch_add(transferred, std::memory_order_relaxed);
+            return IoStatus::SUCCESS;
+        }
+    } while (Clock::now() < deadline);
+
+    return IoStatus::TIMEOUT;
+}
+
+IoStatus SerialPort::write(const BYTE* buffer, size_t length, Clock::time_point deadline)
+{
+    OVERLAPPED ov{};
+    ov.hEvent = writeEvent;
+    DWORD transferred = 0;
+
+    if (!WriteFile(handle, buffer, (DWORD)length, &transferred, &ov))
+    {
+        if (GetLastError() != ERROR_IO_PENDING)
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        IoStatus status = completeOverlapped(handle, ov, transferred, deadline);
+
+        if (status != IoStatus::SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    bytesSent.fetch_add(transferred, std::memory_order_relaxed);
+    return transferred == length ? IoStatus::SUCCESS : IoStatus::IO_ERROR;
+}
+
+void SerialPort::purge()
+{
+    countLineErrors();
+    PurgeComm(handle, PURGE_TXCLEAR | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_RXABORT);
+}
+
+void SerialPort::countLineErrors()
+{
+    DWORD errors = 0;
+
+    if (handle == INVALID_HANDLE_VALUE || !ClearCommError(handle, &errors, NULL))
+    {
+        return;
+    }
+
+    parityErrors += (errors & CE_RXPARITY) ? 1 : 0;
+    framingErrors += (errors & CE_FRAME) ? 1 : 0;
+    overruns += (errors & (CE_OVERRUN | CE_RXOVER)) ? 1 : 0;
+    breaks += (errors & CE_BREAK) ? 1 : 0;
+}
+
+IoStatus SerialPort::getCts(bool& cts)
+{
+    DWORD dwModemStatus;
+
+    if (!GetCommModemStatus(handle, &dwModemStatus))
+    {
+        return IoStatus::IO_ERROR;
+    }
+
+    cts = (dwModemStatus & MS_CTS_ON) != 0;
+    return IoStatus::SUCCESS;
+}
+
+IoStatus SerialPort::waitCtsChange(bool& cts, Clock::time_point deadline)
+{
+    const bool last = cts;
+
+    do
+    {
+        OVERLAPPED ov{};
+        ov.hEvent = ctsEvent;
+        DWORD mask = 0;
+        DWORD transferred = 0;
+        bool pending = false;
+
+        /* The wait is started before the line is read, so a change in between is not missed */
+        if (!WaitCommEvent(handle, &mask, &ov))
+        {
+            if (GetLastError() != ERROR_IO_PENDING)
+            {
+                return IoStatus::IO_ERROR;
+            }
+
+            pending = true;
+        }
+
+        IoStatus status = getCts(cts);
+
+        if (status != IoStatus::SUCCESS || cts != last)
+        {
+            if (pending)
+            {
+                CancelIoEx(handle, &ov);
+                GetOverlappedResult(handle, &ov, &transferred, TRUE);
+            }
+
+            return status;
+        }
+
+        if (pending)
+        {
+            status = completeOverlapped(handle, ov, transferred, deadline);
+
+            if (status != IoStatus::SUCCESS)
+            {
+                return status;
+            }
+        }
+
+        /* Two changes in a row leave the line as it was, then the wait starts over */
+        status = getCts(cts);
+
+        if (status != IoStatus::SUCCESS || cts != last)
+        {
+            return status;
+        }
+    } while (Clock::now() < deadline);
+
+    return IoStatus::TIMEOUT;
+}
+
+#else
+
+static speed_t toSpeed(unsigned int baudRate)
+{
+    switch (baudRate)
+    {
+        case 1200:
+            return B1200;
+        case 2400:
+            return B2400;
+        case 4800:
+            return B4800;
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        case 230400:
+            return B230400;
+        default:
+            return B0;
+    }
+}
+
+/* Parity, framing, overrun and break counters of the UART driver, which count from when it was loaded. Pseudo-terminals
+ * and USB adapters without counters fail. */
+static bool readErrorCounts(int fd, int (&counts)[4])
+{
+#ifdef TIOCGICOUNT
+    serial_icounter_struct icount{};
+
+    if (fd < 0 || ioctl(fd, TIOCGICOUNT, &icount) != 0)
+    {
+        return false;
+    }
+
+    counts[0] = icount.parity;
+    counts[1] = icount.frame;
+    counts[2] = icount.overrun + icount.buf_overrun;
+    counts[3] = icount.brk;
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string SerialPort::deviceName(unsigned int port)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/dev/ttyUSB%u", port);
+    return name;
+}
+
+size_t SerialPort::enumerate(BYTE* ports, size_t capacity)
+{
+    size_t count = 0;
+    DIR* dir = opendir("/dev");
+
+    if (!dir)
+    {
+        return 0;
+    }
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (count < capacity && strncmp(entry->d_name, "ttyUSB", 6) == 0)
+        {
+            ports[count++] = (BYTE)atoi(entry->d_name + 6);
+        }
+    }
+
+    closedir(dir);
+    return count;
+}
+
+bool SerialPort::open(const std::string& device, unsigned int baudRate, Parity parity)
+{
+    close();
+
+    speed_t speed = toSpeed(baudRate);
+
+    if (speed == B0)
+    {
+        return false;
+    }
+
+    fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    termios tio{};
+
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        close();
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cflag &= ~(CSIZE | CSTOPB | PARENB | PARODD | CRTSCTS);
+    tio.c_cflag |= CS8 | CLOCAL | CREAD;
+
+    if (parity != Parity::NONE)
+    {
+        tio.c_cflag |= PARENB | (parity == Parity::ODD ? PARODD : 0);
+    }
+
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        close();
+        return false;
+    }
+
+    tcflush(fd, TCIOFLUSH);
+
+    {
+        /* Errors from before the port was opened are not counted */
+        std::lock_guard<std::mutex> lock(errorMutex);
+        readErrorCounts(fd, errorBase);
+    }
+
+    rate = baudRate;
+    path = device;
+    lineParity = parity;
+    return true;
+}
+
+void SerialPort::close()
+{
+    if (fd >= 0)
+    {
+        tcflush(fd, TCIFLUSH);
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool SerialPort::isOpen() const { return fd >= 0; }
+
+bool SerialPort::setBaudRate(unsigned int baudRate)
+{
+    speed_t speed = toSpeed(baudRate);
+    termios tio{};
+
+    if (speed == B0 || tcgetattr(fd, &tio) != 0)
+    {
+        return false;
+    }
+
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    if (tcsetattr(fd, TCSADRAIN, &tio) != 0)
+    {
+        return false;
+    }
+
+    rate = baudRate;
+    return true;
+}
+
+/* Block in poll() until the file descriptor is ready or the deadline passes */
+static IoStatus waitFor(int fd, short events, Clock::time_point deadline)
+{
+    for (;;)
+    {
+        pollfd pfd{fd, events, 0};
+        int ret = poll(&pfd, 1, (int)remainingMilliseconds(deadline));
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return IoStatus::IO_ERROR;
+        }
+
+        if (ret == 0)
+        {
+            return IoStatus::TIMEOUT;
+        }
+
+        if (pfd.revents & (POLLERR | POLLNVAL))
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        return IoStatus::SUCCESS;
+    }
+}
+
+IoStatus SerialPort::readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline)
+{
+    received = 0;
+
+    for (;;)
+    {
+        IoStatus status = waitFor(fd, POLLIN, deadline);
+
+        if (status != IoStatus::SUCCESS)
+        {
+            return status;
+        }
+
+        ssize_t ret = ::read(fd, buffer, capacity);
+
+        if (ret > 0)
+        {
+            received = (size_t)ret;
+            bytesReceived.fetch_add((ULONGLONG)ret, std::memory_order_relaxed);
+            return IoStatus::SUCCESS;
+        }
+
+        /* Zero bytes after a successful poll means the other side hung up */
+        if (ret == 0 || (errno != EAGAIN && errno != EINTR))
+        {
+            return IoStatus::IO_ERROR;
+        }
+    }
+}
+
+IoStatus SerialPort::write(const BYTE* buffer, size_t length, Clock::time_point deadline)
+{
+    size_t total = 0;
+
+    while (total < length)
+    {
+        ssize_t ret = ::write(fd, buffer + total, length - total);
+
+        if (ret > 0)
+        {
+            total += (size_t)ret;
+            bytesSent.fetch_add((ULONGLONG)ret, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (ret < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        IoStatus status = waitFor(fd, POLLOUT, deadline);
+
+        if (status != IoStatus::SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    return IoStatus::SUCCESS;
+}
+
+void SerialPort::purge()
+{
+    countLineErrors();
+    tcflush(fd, TCIOFLUSH);
+}
+
+void SerialPort::countLineErrors()
+{
+    int current[4];
+    std::lock_guard<std::mutex> lock(errorMutex);
+
+    if (!readErrorCounts(fd, current))
+    {
+        return;
+    }
+
+    std::atomic<DWORD>* counters[4]{&parityErrors, &framingErrors, &overruns, &breaks};
+
+    for (int i = 0; i < 4; i++)
+    {
+        *counters[i] += (DWORD)(current[i] - errorBase[i]);
+        errorBase[i] = current[i];
+    }
+}
+
+IoStatus SerialPort::getCts(bool& cts)
+{
+    int lines = 0;
+
+    if (ioctl(fd, TIOCMGET, &lines) != 0)
+    {
+        return IoStatus::IO_ERROR;
+    }
+
+    cts = (lines & TIOCM_CTS) != 0;
+    return IoStatus::SUCCESS;
+}
+
+IoStatus SerialPort::waitCtsChange(bool& cts, Clock::time_point deadline)
+{
+    /* TIOCMIWAIT could block until the next change, but it can neither time
+     * out nor be woken up without a signal. The line is sampled instead, which
+     * costs no traffic on the line either. */
+    constexpr std::chrono::milliseconds sampleInterval(5);
+    const bool last = cts;
+
+    for (;;)
+    {
+        IoStatus status = getCts(cts);
+
+        if (status != IoStatus::SUCCESS || cts != last)
+        {
+            return status;
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        if (now >= deadline)
+        {
+            return IoStatus::TIMEOUT;
+        }
+
+        std::this_thread::sleep_for(std::min<Clock::duration>(sampleInterval, deadline - now));
+    }
+}
+
+#endif
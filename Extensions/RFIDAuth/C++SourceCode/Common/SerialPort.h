@@ -0,0 +1,72 @@
+#pragma once
+#include "Transport.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+
+enum class Parity : BYTE
+{
+    NONE,
+    ODD,
+    EVEN
+};
+
+/* Serial port transport. On Windows the port is opened for overlapped I/O and
+ * every wait is a WaitForSingleObject on the completion event, CTS changes are
+ * awaited with WaitCommEvent. Elsewhere the port is a termios file descriptor
+ * and waits are done with poll(), which also works with pseudo-terminals.
+ *
+ * Line errors are collected before every command and when the counters are
+ * read. ClearCommError only reports which errors occurred since the last
+ * call, so on Windows an error counts once per command. On Linux the error
+ * counters of the UART driver (TIOCGICOUNT) are added up. */
+class SerialPort : public Transport
+{
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE readEvent = nullptr;
+    HANDLE writeEvent = nullptr;
+    HANDLE ctsEvent = nullptr;
+#else
+    int fd = -1;
+    std::mutex errorMutex;
+    int errorBase[4]{};  // Error counters of the driver when they were last added up
+#endif
+    unsigned int rate = 0;
+    std::string path;
+    Parity lineParity = Parity::NONE;
+    std::atomic<ULONGLONG> bytesSent{0};
+    std::atomic<ULONGLONG> bytesReceived{0};
+    std::atomic<DWORD> parityErrors{0};
+    std::atomic<DWORD> framingErrors{0};
+    std::atomic<DWORD> overruns{0};
+    std::atomic<DWORD> breaks{0};
+
+    /* Add the line errors since the last call to the counters */
+    void countLineErrors();
+
+   public:
+    SerialPort() = default;
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+    ~SerialPort() override;
+
+    /* Returns the device path of a numbered port, e.g. \\.\COM3 or /dev/ttyUSB3 */
+    static std::string deviceName(unsigned int port);
+    /* Write the numbers of all serial ports of the system into ports. Returns the number of ports found. */
+    static size_t enumerate(BYTE* ports, size_t capacity);
+
+    bool open(const std::string& device, unsigned int baudRate, Parity parity);
+    void close();
+    bool isOpen() const;
+
+    IoStatus readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline) override;
+    IoStatus write(const BYTE* buffer, size_t length, Clock::time_point deadline) override;
+    void purge() override;
+    IoStatus getCts(bool& cts) override;
+    IoStatus waitCtsChange(bool& cts, Clock::time_point deadline) override;
+    bool setBaudRate(unsigned int baudRate) override;
+    unsigned int baudRate() const override { return rate; }
+    bool reopen(const std::string& device) override;
+    LineCounters lineCounters() override;
+};
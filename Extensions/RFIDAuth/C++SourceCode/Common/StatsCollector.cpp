@@ -0,0 +1,51 @@
+#include "StatsCollector.h"
+
+void StatsCollector::completed(BYTE command, Clock::duration latency, bool succeeded)
+{
+    const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    size_t bucket = 0;
+
+    while (bucket < LatencyBuckets - 1 && microseconds > (long long)LatencyBounds[bucket] * 1000)
+    {
+        bucket++;
+    }
+
+    Entry& entry = entries[command];
+    entry.count.fetch_add(1, std::memory_order_relaxed);
+    entry.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    if (!succeeded)
+    {
+        entry.failed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+size_t StatsCollector::commands(CommandStats* stats, size_t capacity) const
+{
+    size_t count = 0;
+
+    for (size_t command = 0; command < 256 && count < capacity; command++)
+    {
+        const Entry& entry = entries[command];
+
+        /* The counters are read one by one, a command that completes meanwhile may be counted in part */
+        if (entry.count.load(std::memory_order_relaxed) == 0 && entry.timeouts.load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+
+        CommandStats& out = stats[count++];
+        out.command = (DWORD)command;
+        out.count = entry.count.load(std::memory_order_relaxed);
+        out.failed = entry.failed.load(std::memory_order_relaxed);
+        out.timeouts = entry.timeouts.load(std::memory_order_relaxed);
+        out.checksumErrors = entry.checksumErrors.load(std::memory_order_relaxed);
+
+        for (size_t bucket = 0; bucket < LatencyBuckets; bucket++)
+        {
+            out.latency[bucket] = entry.latency[bucket].load(std::memory_order_relaxed);
+        }
+    }
+
+    return count;
+}
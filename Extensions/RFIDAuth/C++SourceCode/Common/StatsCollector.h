@@ -0,0 +1,58 @@
+#pragma once
+#include "Platform.h"
+#include "RetryPolicy.h"
+#include "Transport.h"
+#include <atomic>
+
+/* Upper bounds of the latency buckets in milliseconds. A command that took
+ * longer than the last bound is counted in one more bucket. */
+constexpr DWORD LatencyBounds[]{1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000};
+constexpr size_t LatencyBuckets = sizeof(LatencyBounds) / sizeof(LatencyBounds[0]) + 1;
+
+/* Counters of one command of a session, exported by the drivers. The meaning of command is defined by the driver. */
+struct CommandStats
+{
+    DWORD command;
+    DWORD count;
+    DWORD failed;          // no valid reply after the last repetition
+    DWORD timeouts;        // attempts without a reply
+    DWORD checksumErrors;  // attempts with a corrupted reply or a NAK
+    /* Commands by the time from the first request to the last reply, see LatencyBounds */
+    DWORD latency[LatencyBuckets];
+};
+
+/* Counters of a whole session, exported by the drivers */
+struct SessionStats
+{
+    LineCounters line;
+    RetryCounters retries;
+};
+
+/* Counts the commands of a session and sorts their latencies into a fixed
+ * histogram. Every command code has its own counters, so recording is a few
+ * relaxed atomic increments without a lock and can stay on in the field. */
+class StatsCollector
+{
+   public:
+    /* One attempt of command got no reply or a corrupted one */
+    void timedOut(BYTE command) { entries[command].timeouts.fetch_add(1, std::memory_order_relaxed); }
+    void corrupted(BYTE command) { entries[command].checksumErrors.fetch_add(1, std::memory_order_relaxed); }
+    /* command completed after all its attempts */
+    void completed(BYTE command, Clock::duration latency, bool succeeded);
+
+    /* Copy the counters of up to capacity commands that were sent at least once, in the order of their code. Returns
+     * their number. */
+    size_t commands(CommandStats* stats, size_t capacity) const;
+
+   private:
+    struct Entry
+    {
+        std::atomic<DWORD> count{0};
+        std::atomic<DWORD> failed{0};
+        std::atomic<DWORD> timeouts{0};
+        std::atomic<DWORD> checksumErrors{0};
+        std::atomic<DWORD> latency[LatencyBuckets]{};
+    };
+
+    Entry entries[256];
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include "Platform.h"
+#include <cstddef>
+#include <string>
+
+enum class IoStatus
+{
+    SUCCESS,
+    TIMEOUT,
+    IO_ERROR
+};
+
+/* Bytes and line errors of a transport since it was created. Line errors are
+ * only counted where the port reports them and stay 0 elsewhere. */
+struct LineCounters
+{
+    ULONGLONG bytesSent;
+    ULONGLONG bytesReceived;
+    DWORD parityErrors;   // CE_RXPARITY
+    DWORD framingErrors;  // CE_FRAME
+    DWORD overruns;       // CE_OVERRUN and CE_RXOVER
+    DWORD breaks;         // CE_BREAK
+};
+
+/* A byte stream to a reader. All waits block until data is available or the
+ * deadline passes, so an idle reader does not cost any CPU time. */
+class Transport
+{
+   public:
+    virtual ~Transport() = default;
+
+    /* Wait until at least one byte is available and read as many bytes as
+     * are queued, up to capacity */
+    virtual IoStatus readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline) = 0;
+    virtual IoStatus write(const BYTE* buffer, size_t length, Clock::time_point deadline) = 0;
+    /* Discard everything in the receive and transmit queues */
+    virtual void purge() = 0;
+    /* Query the CTS modem line */
+    virtual IoStatus getCts(bool& cts) = 0;
+    /* Block until CTS differs from the state passed in cts or the deadline
+     * passes. cts holds the state of the line when the function returns. */
+    virtual IoStatus waitCtsChange(bool& cts, Clock::time_point deadline) = 0;
+    /* Change the rate of the line after the queued bytes were sent. Returns
+     * false if the rate is not supported or the transport has no line rate. */
+    virtual bool setBaudRate(unsigned int /* baudRate */) { return false; }
+    /* Rate of the line, 0 if the transport has none */
+    virtual unsigned int baudRate() const { return 0; }
+    /* False if bytes are not paced to the rate, like on a USB device without a UART, so frames need no gaps */
+    virtual bool paced() const { return baudRate() != 0; }
+    /* Close the line and open it again with the current settings, e.g. after
+     * its USB adapter was unplugged. device selects another device, an empty
+     * one the same. Returns false if the device cannot be opened. */
+    virtual bool reopen(const std::string& /* device */) { return false; }
+    virtual LineCounters lineCounters() { return {}; }
+
+    /* Read exactly length bytes */
+    IoStatus read(BYTE* buffer, size_t length, Clock::time_point deadline)
+    {
+        size_t total = 0;
+
+        while (total < length)
+        {
+            size_t received = 0;
+            IoStatus status = readSome(buffer + total, length - total, received, deadline);
+
+            if (status != IoStatus::SUCCESS)
+            {
+                return status;
+            }
+
+            total += received;
+        }
+
+        return IoStatus::SUCCESS;
+    }
+
+    /* Read exactly length bytes of a frame that is sent in one go. The first
+     * byte must arrive before the deadline and every further one within gap
+     * of the previous, so a short timeout does not cut off a long frame. */
+    IoStatus read(BYTE* buffer, size_t length, Clock::time_point deadline, Clock::duration gap)
+    {
+        size_t total = 0;
+
+        while (total < length)
+        {
+            size_t received = 0;
+            IoStatus status = readSome(buffer + total, length - total, received, deadline);
+
+            if (status != IoStatus::SUCCESS)
+            {
+                return status;
+            }
+
+            total += received;
+            deadline = Clock::now() + gap;
+        }
+
+        return IoStatus::SUCCESS;
+    }
+};
@@ -0,0 +1,44 @@
+#include "TurnaroundScheduler.h"
+#include <algorithm>
+#include <thread>
+
+Clock::duration TurnaroundScheduler::characterTime(unsigned int baudRate) const
+{
+    if (baudRate == 0)
+    {
+        return Clock::duration::zero();
+    }
+
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(bitsPerCharacter)) / baudRate;
+}
+
+Clock::duration TurnaroundScheduler::frameTime(size_t length, unsigned int baudRate) const
+{
+    return characterTime(baudRate) * (Clock::rep)length;
+}
+
+Clock::duration TurnaroundScheduler::expectedReply(size_t requestLength, size_t replyLength,
+                                                   unsigned int baudRate) const
+{
+    return frameTime(requestLength + replyLength, baudRate) + turnaround;
+}
+
+void TurnaroundScheduler::sent(size_t length, unsigned int baudRate)
+{
+    /* The port buffers the frame, it is on the line until its last character was shifted out */
+    idleSince = std::max(idleSince, Clock::now()) + frameTime(length, baudRate);
+}
+
+void TurnaroundScheduler::idle() { idleSince = Clock::now(); }
+
+void TurnaroundScheduler::waitForTurn(unsigned int baudRate) const
+{
+    if (baudRate == 0)
+    {
+        return;
+    }
+
+    const Clock::duration gap =
+        std::chrono::duration_cast<Clock::duration>(characterTime(baudRate) * gapCharacters) + turnaround;
+    std::this_thread::sleep_until(idleSince + gap);
+}
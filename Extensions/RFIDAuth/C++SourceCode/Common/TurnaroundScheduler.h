@@ -0,0 +1,39 @@
+#pragma once
+#include "Platform.h"
+
+/* Spaces the frames on a half-duplex serial line by its timing instead of
+ * fixed delays. A character takes bitsPerCharacter bits (start, data, parity
+ * and stop) at the rate of the line. The next frame may be sent once the line
+ * was idle for gapCharacters characters plus the turnaround of the device,
+ * the time it needs after a reply before it listens again. waitForTurn()
+ * sleeps until then, so the wait costs no CPU time and is as short as the
+ * line allows. A rate of 0 is a line without pacing, which is never waited
+ * for. Not thread safe, the drivers call it with the session locked. */
+class TurnaroundScheduler
+{
+   public:
+    TurnaroundScheduler(unsigned int bitsPerCharacter, double gapCharacters,
+                        Clock::duration turnaround = Clock::duration::zero())
+        : bitsPerCharacter(bitsPerCharacter), gapCharacters(gapCharacters), turnaround(turnaround)
+    {
+    }
+
+    Clock::duration characterTime(unsigned int baudRate) const;
+    /* Time length bytes occupy the line */
+    Clock::duration frameTime(size_t length, unsigned int baudRate) const;
+    /* Shortest time from writing a request of requestLength bytes to the last byte of a reply of replyLength bytes */
+    Clock::duration expectedReply(size_t requestLength, size_t replyLength, unsigned int baudRate) const;
+
+    /* A frame of length bytes was handed to the port now, it leaves the line once it was transmitted */
+    void sent(size_t length, unsigned int baudRate);
+    /* The line is idle from now on, the last byte of a reply arrived or the wait for it ended */
+    void idle();
+    /* Sleep until the line was idle long enough for the next frame */
+    void waitForTurn(unsigned int baudRate) const;
+
+   private:
+    const unsigned int bitsPerCharacter;
+    const double gapCharacters;
+    const Clock::duration turnaround;
+    Clock::time_point idleSince{};
+};
@@ -1,313 +1,1016 @@
 #include "EKS.h"
+#include "EKSLink.h"
+#include "FrameCodec.h"
+#include <algorithm>
+#include <cstring>
 
-static void receiveBytes(const DWORD& numberOfBytes, BYTE* buffer)
+static EKSSession* getSession(HANDLE pCom) { return (EKSSession*)pCom; }
+
+/* Exchanges are estimated per phase and command, since a reader acknowledges at once but needs time to execute */
+static DWORD exchangeOf(ExchangePhase phase, BYTE command) { return (DWORD)phase << 8 | command; }
+
+/* Most bytes dropped before a command. A line that keeps sending leaves the rest to the link, which fails the attempt. */
+static constexpr size_t maxDrainBytes = 1024;
+
+static void sendBytes(EKSSession& session, const DWORD& numberOfBytes, const BYTE* buffer)
 {
-    DWORD _;
-    ULONGLONG start = GetTickCount64();
-    /* Wait until numberOfBytes bytes can be read or the connection times out */
-    do
+    if (session.port->write(buffer, numberOfBytes, Clock::now() + timeout) == IoStatus::SUCCESS)
     {
-        ClearCommError(hCom, &dwErr, &comStat);
+        session.capture.record(FrameDirection::SENT, buffer, numberOfBytes);
+        return;
+    }
+
+    throw EKSError(ResponseCode::ERR_IO, "Could not write to HANDLE");
+}
 
-        if (GetTickCount64() > start + timeout)
+/* One attempt of a command, driven by the bytes as they arrive. The first
+ * byte after each write is timed by the estimated reply time of its exchange,
+ * the following bytes of a frame by the character delay. */
+static ResponseCode attemptCommand(EKSSession& session, EKSLink& link, const BYTE command)
+{
+    BYTE chunk[256];
+    size_t received = 0;
+    /* The bytes received in the current state, the capture holds them as one frame */
+    BYTE frame[FrameCapture::MaxFrameBytes];
+    size_t frameLength = 0;
+    Clock::time_point waitStart;
+    Clock::time_point lastByte{};
+
+    auto recordFrame = [&]
+    {
+        if (frameLength > 0)
         {
-            throw EKSError(ResponseCode::ERR_CONNECTION, "Timeout while waiting for data");
+            session.capture.record(FrameDirection::RECEIVED, frame, frameLength);
+            frameLength = 0;
         }
-    } while (comStat.cbInQue < numberOfBytes);
+    };
 
-    /* Read bytes from com port into buffer */
-    if (ReadFile(hCom, buffer, numberOfBytes, &_, NULL))
+    auto answer = [&]
     {
-        return;
+        if (link.outputLength() > 0)
+        {
+            sendBytes(session, (DWORD)link.outputLength(), link.output());
+            link.written();
+            waitStart = Clock::now();
+        }
+    };
+
+    try
+    {
+        link.start();
+
+        /* Whatever is left of an earlier exchange is dropped. A purge would drop the closing DLE of the last command
+         * as well while it is still queued for sending, so only the received bytes are read and dropped. The
+         * repetition of a NAKed response is kept. */
+        if (link.state() == EKSLink::State::CONNECT)
+        {
+            size_t drained = 0;
+
+            while (drained < maxDrainBytes &&
+                   session.port->readSome(chunk, sizeof(chunk), received, Clock::now()) == IoStatus::SUCCESS)
+            {
+                drained += received;
+            }
+        }
+
+        waitStart = Clock::now();
+        answer();
+
+        while (link.pending())
+        {
+            const DWORD exchange = exchangeOf(link.phase(), command);
+            const Clock::time_point deadline = link.inFrame() ? lastByte + EKSLink::CharacterDelay
+                                                              : waitStart + session.rtt.timeout(exchange, timeout);
+            const IoStatus status = session.port->readSome(chunk, sizeof(chunk), received, deadline);
+
+            if (status == IoStatus::TIMEOUT)
+            {
+                if (!link.inFrame())
+                {
+                    session.rtt.timedOut(exchange);
+                }
+
+                recordFrame();
+                link.expire();
+                answer();
+                continue;
+            }
+
+            if (status != IoStatus::SUCCESS)
+            {
+                recordFrame();
+                return ResponseCode::ERR_IO;
+            }
+
+            lastByte = Clock::now();
+
+            for (size_t i = 0; i < received && link.pending(); i++)
+            {
+                const EKSLink::State state = link.state();
+                const bool inFrame = link.inFrame();
+                const DWORD awaited = exchangeOf(link.phase(), command);
+
+                if (frameLength < sizeof(frame))
+                {
+                    frame[frameLength++] = chunk[i];
+                }
+
+                link.receive(chunk[i]);
+
+                /* The byte the exchange waited for arrived */
+                if (link.state() != state || link.inFrame() != inFrame)
+                {
+                    if (!inFrame)
+                    {
+                        session.rtt.sample(awaited, lastByte - waitStart);
+                    }
+
+                    waitStart = lastByte;
+                }
+
+                if (link.state() != state)
+                {
+                    recordFrame();
+                }
+
+                /* An answer goes out before the next byte is looked at */
+                answer();
+            }
+        }
+    }
+    catch (const EKSError& err)
+    {
+        recordFrame();
+        return err.responseCode;
+    }
+    catch (const std::exception&)
+    {
+        return ResponseCode::ERR_UNKNOWN;
     }
 
-    throw EKSError(ResponseCode::ERR_IO, "Could not read from HANDLE");
+    switch (link.state())
+    {
+        case EKSLink::State::DONE:
+            return ResponseCode::SUCCESS;
+        case EKSLink::State::CORRUPTED:
+            return ResponseCode::ERR_COMMUNICATION;
+        default:
+            return ResponseCode::ERR_CONNECTION;
+    }
 }
 
-static void sendBytes(const DWORD& numberOfBytes, const BYTE* buffer)
+/* Send a command and receive its response. A corrupted or missing response
+ * is repeated as the retry policy of the session allows, reads and writes
+ * of the key memory can both be repeated without harm. A NAKed command is
+ * sent again, a NAKed response is repeated by the reader. */
+static ResponseCode executeCommand(EKSSession& session, const BYTE command, const BYTE* cmd, const DWORD& cmdLength,
+                                   BYTE* buffer, const DWORD& bufferSize)
 {
-    DWORD _;
+    ResponseCode res = ResponseCode::ERR_UNKNOWN;
+    const Clock::time_point start = Clock::now();
+    EKSLink link(cmd, cmdLength, buffer, bufferSize);
 
-    /* Purge the write buffer and send bytes */
-    if (PurgeComm(hCom, PURGE_TXCLEAR | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_RXABORT) &&
-        WriteFile(hCom, buffer, numberOfBytes, &_, NULL))
+    auto attempt = [&]
     {
-        return;
+        res = attemptCommand(session, link, command);
+
+        switch (res)
+        {
+            case ResponseCode::ERR_COMMUNICATION:
+                session.stats.corrupted(command);
+                return Attempt::CORRUPTED;
+            case ResponseCode::ERR_CONNECTION:
+                session.stats.timedOut(command);
+                return Attempt::TIMED_OUT;
+            default:
+                return Attempt::DONE;
+        }
+    };
+
+    /* An error code of the reader is a valid response, only a lost line is a failure */
+    const Attempt result = session.retrier.run(session.retryPolicy, attempt);
+    session.stats.completed(command, Clock::now() - start, result == Attempt::DONE && res != ResponseCode::ERR_IO);
+    return res == ResponseCode::ERR_IO ? ResponseCode::ERR_CONNECTION : res;
+}
+
+/* Get COM port info */
+void EKSAPI GetSysComm(BYTE* buffer) { buffer[0] = (BYTE)SerialPort::enumerate(buffer + 1, 255); }
+
+/* Find the readers connected to the system */
+DWORD EKSAPI DiscoverReaders(DWORD knownPort, DWORD knownType, DiscoveredReader* readers, DWORD capacity, DWORD* count)
+{
+    if (readers == nullptr || count == nullptr)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
     }
 
-    throw EKSError(ResponseCode::ERR_IO, "Could not write to HANDLE");
+    *count = (DWORD)ReaderDiscovery::discover(knownPort, (ReaderType)knownType, readers, capacity);
+    return (DWORD)ResponseCode::SUCCESS;
 }
 
-static void addToCmdBuffer(BYTE* cmdBuffer, DWORD& len, BYTE& bcc, const BYTE& b)
+/* Open a COM port for communication. The EKS has no command to change its
+ * rate, so baud_rate must match the rate configured on the device. */
+HANDLE EKSAPI OpenComm(unsigned char port, unsigned int baud_rate)
 {
-    /* The DLE byte needs to be sent twice */
-    if (b == DLE)
+    std::unique_ptr<SerialPort> serialPort(new SerialPort());
+
+    if (!serialPort->open(SerialPort::deviceName(port), baud_rate, Parity::EVEN))
     {
-        cmdBuffer[len] = DLE;
-        len++;
+        return nullptr;
     }
 
-    cmdBuffer[len] = b;
-    len++;
-    bcc ^= b;
+    EKSSession* session = new EKSSession();
+    session->port = std::move(serialPort);
+    return session;
 }
 
-static void buildMessageBuffer(const BYTE* inBuffer, BYTE* outBuffer, DWORD& outBufferLength)
+/* Close a COM port */
+void EKSAPI CloseComm(HANDLE pCom)
 {
-    const DWORD supposedLength = *inBuffer;
-    DWORD actualLength = 0x00;
-    BYTE bcc = 0x00;
+    StopKeyMonitor(pCom);
 
-    for (UINT i = 0; i < supposedLength; i++)
+    if (pCom)
     {
-        addToCmdBuffer(outBuffer, actualLength, bcc, inBuffer[i]);
+        /* Pending asynchronous commands are dropped */
+        EKSSession* session = getSession(pCom);
+        std::lock_guard<std::mutex> lock(session->monitorMutex);
+        session->async.reset();
+
+        /* A monitor thread that was left inside its callback may still hold the watcher */
+        if (session->watcher)
+        {
+            session->watcher->stop();
+            session->watcher.reset();
+        }
     }
 
-    outBuffer[actualLength++] = DLE;
-    bcc ^= DLE;
-    outBuffer[actualLength++] = ETX;
-    bcc ^= ETX;
-    outBuffer[actualLength++] = bcc;
-    outBufferLength = actualLength;
+    delete getSession(pCom);
 }
 
-static void readResponseBufferIntoBuffer(const BYTE* responseBuffer, const DWORD& supposedResponseLength,
-                                         BYTE* outBuffer)
+/* Query CTS pin of the serial connection to determine wether a key is inserted */
+DWORD EKSAPI GetKeyStatus(HANDLE pCom)
 {
-    /* Read response and interpret double DLE correctly */
-    DWORD dleCounter = 0;
-    DWORD dataCounter = 0;
+    bool cts = false;
 
-    for (const BYTE* b = responseBuffer; b < responseBuffer + supposedResponseLength + dleCounter; b++)
+    if (!pCom)
     {
-        if (*b == DLE)
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    {
+        /* The key monitor may reopen the port at the same time */
+        std::lock_guard<std::mutex> lock(getSession(pCom)->mutex);
+
+        if (getSession(pCom)->port->getCts(cts) != IoStatus::SUCCESS)
         {
-            dleCounter++;
-            b++;
+            return (DWORD)ResponseCode::ERR_CONNECTION;
         }
+    }
 
-        outBuffer[dataCounter++] = *b;
+    // When a key is inside the reader, the CTS signal is high
+    if (cts)
+    {
+        getSession(pCom)->cache.keyPresent();
+        return (DWORD)ResponseCode::SUCCESS;
     }
+
+    getSession(pCom)->cache.keyRemoved();
+    return (DWORD)ResponseCode::ERR_NO_KEY_DETECTED;
+}
+
+/* Read the serial number of the key */
+DWORD EKSAPI GetSerialNumber(HANDLE pCom, BYTE* buffer)
+{
+    return ReadKeyData(pCom, SERIAL_NUMBER_OFFSET, SERIAL_NUMBER_LENGTH, buffer);
 }
 
-static ResponseCode executeCommand(const BYTE* cmd, const DWORD& cmdLength, BYTE* buffer)
+/* Send one read command. The caller holds the session mutex. */
+static ResponseCode readBlock(EKSSession& session, const BYTE startByte, const BYTE length, BYTE* buffer)
 {
-    try
+    /* The offset and the length are stuffed like any other byte when they equal DLE */
+    const BYTE cmdBuffer[]{CMD_HEADER_SIZE, CMD_SEND, CMD_READ, 0x01, 0x00, startByte, length};
+
+    BYTE messageBuffer[EKSFrame::maxEncodedSize(sizeof(cmdBuffer))];
+    const DWORD messageBufferLength =
+        (DWORD)EKSFrame::encode(cmdBuffer, sizeof(cmdBuffer), messageBuffer, sizeof(messageBuffer));
+
+    BYTE readBuffer[256]{};
+    ResponseCode res =
+        executeCommand(session, CMD_READ, messageBuffer, messageBufferLength, readBuffer, sizeof(readBuffer));
+
+    if (res != ResponseCode::SUCCESS)
     {
-        /* INIT COMMUNICATION */
-        sendBytes(1, &startByte);
+        return res;
+    }
 
-        /* AWAIT DLE */
-        receiveBytes(1, buffer);
+    // Check correct response type
+    if (readBuffer[1] != CMD_RESPONSE)
+    {
+        return ResponseCode::ERR_UNKNOWN;
+    }
 
-        if (buffer[0] != DLE)
+    if (readBuffer[2] == CMD_RES_STATUS)
+    {
+        // Byte number 6 is the status code on failure
+        return (ResponseCode)readBuffer[6];
+    }
+
+    // Check correct response type
+    if (readBuffer[2] != CMD_READ)
+    {
+        return ResponseCode::ERR_UNKNOWN;
+    }
+
+    // The response must carry the requested range, otherwise it belongs to another command
+    if (readBuffer[0] != CMD_HEADER_SIZE + length || readBuffer[5] != startByte || readBuffer[6] != length)
+    {
+        return ResponseCode::ERR_COMMUNICATION;
+    }
+
+    memcpy(buffer, readBuffer + CMD_HEADER_SIZE, length);
+    return ResponseCode::SUCCESS;
+}
+
+/* Read the serial number of the inserted key unless the cache still knows it. The caller holds the session mutex. */
+static ResponseCode identifyKey(EKSSession& session)
+{
+    if (session.cache.identified())
+    {
+        return ResponseCode::SUCCESS;
+    }
+
+    const size_t generation = session.cache.beginIdentify();
+    BYTE serialNumber[SERIAL_NUMBER_LENGTH];
+    ResponseCode res = readBlock(session, SERIAL_NUMBER_OFFSET, SERIAL_NUMBER_LENGTH, serialNumber);
+
+    if (res == ResponseCode::SUCCESS)
+    {
+        session.cache.identify(serialNumber, generation);
+    }
+
+    return res;
+}
+
+/* Serve a read from the key cache if possible. The caller holds the session mutex. */
+static ResponseCode readCached(EKSSession& session, const BYTE startByte, const BYTE length, BYTE* buffer)
+{
+    if (!session.cache.enabled())
+    {
+        return readBlock(session, startByte, length, buffer);
+    }
+
+    ResponseCode res = identifyKey(session);
+
+    if (res != ResponseCode::SUCCESS)
+    {
+        return res;
+    }
+
+    if (session.cache.lookup(startByte, length, buffer))
+    {
+        return ResponseCode::SUCCESS;
+    }
+
+    res = readBlock(session, startByte, length, buffer);
+
+    if (res == ResponseCode::SUCCESS)
+    {
+        session.cache.store(startByte, length, buffer);
+    }
+
+    return res;
+}
+
+/* Read data from the key */
+DWORD EKSAPI ReadKeyData(HANDLE pCom, const BYTE startByte, const BYTE length, BYTE* buffer)
+{
+    ResponseCode res = (ResponseCode)GetKeyStatus(pCom);
+
+    if (res != ResponseCode::SUCCESS)
+    {
+        return (DWORD)res;
+    }
+
+    if (length == 0 || length > MAX_READ_LENGTH || startByte + length > KEY_ADDRESS_SPACE)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    EKSSession& session = *getSession(pCom);
+    std::lock_guard<std::mutex> lock(session.mutex);
+    return (DWORD)readCached(session, startByte, length, buffer);
+}
+
+/* Read a range of the key memory of any length */
+DWORD EKSAPI ReadKeyImage(HANDLE pCom, const BYTE startByte, const DWORD length, BYTE* buffer)
+{
+    ResponseCode res = (ResponseCode)GetKeyStatus(pCom);
+
+    if (res != ResponseCode::SUCCESS)
+    {
+        return (DWORD)res;
+    }
+
+    if (length == 0 || startByte >= KEY_ADDRESS_SPACE || length > KEY_ADDRESS_SPACE - startByte)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    /* The mutex is held for all commands, so the key monitor cannot get in between */
+    EKSSession& session = *getSession(pCom);
+    std::lock_guard<std::mutex> lock(session.mutex);
+
+    for (DWORD offset = 0; offset < length; offset += MAX_READ_LENGTH)
+    {
+        const BYTE blockLength = (BYTE)std::min<DWORD>(MAX_READ_LENGTH, length - offset);
+        res = readCached(session, (BYTE)(startByte + offset), blockLength, buffer + offset);
+
+        if (res != ResponseCode::SUCCESS)
         {
-            return ResponseCode::ERR_COMMUNICATION;
+            return (DWORD)res;
         }
+    }
 
-        /* SEND COMMAND */
-        sendBytes(cmdLength, cmd);
+    return (DWORD)ResponseCode::SUCCESS;
+}
 
-        /* AWAIT DLE */
-        receiveBytes(1, buffer);
+/* Send one write command. The caller holds the session mutex. */
+static ResponseCode writeBlock(EKSSession& session, const BYTE startByte, const BYTE length, const BYTE* buffer)
+{
+    const BYTE header[]{(BYTE)(CMD_HEADER_SIZE + length), CMD_SEND, CMD_WRITE, 0x01, 0x00, startByte, length};
+    BYTE cmdBuffer[sizeof(header) + WRITE_BLOCK_SIZE];
+    memcpy(cmdBuffer, header, sizeof(header));
+    memcpy(cmdBuffer + sizeof(header), buffer, length);
+
+    BYTE messageBuffer[EKSFrame::maxEncodedSize(sizeof(cmdBuffer))];
+    const DWORD messageBufferLength =
+        (DWORD)EKSFrame::encode(cmdBuffer, sizeof(header) + length, messageBuffer, sizeof(messageBuffer));
+
+    BYTE readBuffer[256]{};
+    ResponseCode res =
+        executeCommand(session, CMD_WRITE, messageBuffer, messageBufferLength, readBuffer, sizeof(readBuffer));
+
+    if (res != ResponseCode::SUCCESS)
+    {
+        return res;
+    }
+
+    // The reader confirms a write with a status response, byte number 6 is the status code
+    if (readBuffer[1] != CMD_RESPONSE || readBuffer[2] != CMD_RES_STATUS)
+    {
+        return ResponseCode::ERR_UNKNOWN;
+    }
+
+    return (ResponseCode)readBuffer[6];
+}
 
-        if (buffer[0] != DLE)
+/* Write data to the key */
+DWORD EKSAPI WriteKeyData(HANDLE pCom, const BYTE startByte, const BYTE length, const BYTE* buffer, const BOOL verify)
+{
+    ResponseCode res = (ResponseCode)GetKeyStatus(pCom);
+
+    if (res != ResponseCode::SUCCESS)
+    {
+        return (DWORD)res;
+    }
+
+    if (length == 0 || startByte + length > KEY_ADDRESS_SPACE)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    /* The mutex is held for all commands, so the key monitor cannot get in between */
+    EKSSession& session = *getSession(pCom);
+    std::lock_guard<std::mutex> lock(session.mutex);
+
+    /* The cached content is kept up to date, so the written key has to be known */
+    if (session.cache.enabled())
+    {
+        res = identifyKey(session);
+
+        if (res != ResponseCode::SUCCESS)
         {
-            return ResponseCode::ERR_COMMUNICATION;
+            return (DWORD)res;
         }
+    }
 
-        /* AWAIT STX TO RECIEVE RESPONSE */
-        receiveBytes(1, buffer);
+    for (DWORD offset = 0; offset < length;)
+    {
+        /* The first block may start in the middle of a block of the key memory */
+        const DWORD address = startByte + offset;
+        const BYTE blockLength =
+            (BYTE)std::min<DWORD>(WRITE_BLOCK_SIZE - address % WRITE_BLOCK_SIZE, length - offset);
+        res = writeBlock(session, (BYTE)address, blockLength, buffer + offset);
 
-        if (buffer[0] != STX)
+        if (res != ResponseCode::SUCCESS)
         {
-            return ResponseCode::ERR_COMMUNICATION;
+            /* The block may or may not have been written */
+            session.cache.invalidate((BYTE)address, blockLength);
+            return (DWORD)res;
         }
 
-        /* SEND RESPONSE REQUEST */
-        sendBytes(1, &accByte);
+        session.cache.store((BYTE)address, blockLength, buffer + offset);
 
-        /* READ LENGTH OF RESPONSE */
-        receiveBytes(1, buffer);
-        DWORD bodyLen = (DWORD)buffer[0];
+        offset += blockLength;
+    }
 
-        /* RECIEVE RESPONSE BODY ONE AT A TIME AND SKIP DOUBLE DLEs*/
-        BYTE _ = 0;
+    if (!verify)
+    {
+        return (DWORD)ResponseCode::SUCCESS;
+    }
+
+    /* Read back only the written range, with as few commands as possible */
+    BYTE readBuffer[MAX_READ_LENGTH];
 
-        for (UINT i = 1; i < bodyLen; i++)
+    for (DWORD offset = 0; offset < length; offset += MAX_READ_LENGTH)
+    {
+        const BYTE blockLength = (BYTE)std::min<DWORD>(MAX_READ_LENGTH, length - offset);
+        res = readBlock(session, (BYTE)(startByte + offset), blockLength, readBuffer);
+
+        if (res != ResponseCode::SUCCESS)
         {
-            receiveBytes(1, buffer + i);
+            return (DWORD)res;
+        }
 
-            if (buffer[i] == DLE)
-            {
-                receiveBytes(1, &_);
-            }
+        if (memcmp(readBuffer, buffer + offset, blockLength))
+        {
+            return (DWORD)ResponseCode::ERR_VERIFY;
         }
+    }
 
-        /* RECIEVE MESSAGE TAIL */
-        receiveBytes(3, buffer + bodyLen);
+    return (DWORD)ResponseCode::SUCCESS;
+}
 
-        /* SEND DLE TO END COMMUNICATION */
-        sendBytes(1, &accByte);
-        return ResponseCode::SUCCESS;
+/* Set up the key cache of the handle */
+DWORD EKSAPI ConfigureKeyCache(HANDLE pCom, const BYTE* ranges, DWORD rangeCount, DWORD ttl)
+{
+    if (!pCom)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
     }
-    catch (const EKSError& err)
+
+    if (rangeCount && !ranges)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    EKSSession& session = *getSession(pCom);
+    std::lock_guard<std::mutex> lock(session.mutex);
+
+    if (!session.cache.configure(ranges, rangeCount, std::chrono::milliseconds(ttl)))
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    return (DWORD)ResponseCode::SUCCESS;
+}
+
+/* Set up the retry policy of the handle */
+DWORD EKSAPI SetRetryPolicy(HANDLE pCom, DWORD resends, DWORD retries, DWORD backoff, DWORD maxBackoff)
+{
+    if (!pCom)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    if (maxBackoff < backoff)
     {
-        if (err.responseCode == ResponseCode::ERR_CONNECTION || err.responseCode == ResponseCode::ERR_IO)
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    EKSSession& session = *getSession(pCom);
+    std::lock_guard<std::mutex> lock(session.mutex);
+    session.retryPolicy = {resends, retries, std::chrono::milliseconds(backoff), std::chrono::milliseconds(maxBackoff)};
+    return (DWORD)ResponseCode::SUCCESS;
+}
+
+/* Read the number of repeated commands */
+DWORD EKSAPI GetRetryCounters(HANDLE pCom, RetryCounters* counters)
+{
+    if (!pCom || !counters)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    *counters = getSession(pCom)->retrier.counters();
+    return (DWORD)ResponseCode::SUCCESS;
+}
+
+/* Read the estimated reply times */
+DWORD EKSAPI GetRttEstimate(HANDLE pCom, RttEstimate* estimates, DWORD capacity, DWORD* count)
+{
+    if (!pCom || !count)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    *count = (DWORD)getSession(pCom)->rtt.estimates(estimates, capacity);
+    return (DWORD)ResponseCode::SUCCESS;
+}
+
+/* Get the counters of the line, the repetitions and every command */
+DWORD EKSAPI GetStats(HANDLE pCom, SessionStats* stats, CommandStats* commands, DWORD capacity, DWORD* count)
+{
+    if (!pCom || !stats || !count)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    EKSSession* session = getSession(pCom);
+
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        stats->line = session->port->lineCounters();
+    }
+
+    stats->retries = session->retrier.counters();
+    *count = (DWORD)session->stats.commands(commands, capacity);
+    return (DWORD)ResponseCode::SUCCESS;
+}
+
+/* Write the captured frames to a file */
+DWORD EKSAPI DumpFrameCapture(HANDLE pCom, const char* path)
+{
+    if (!pCom)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    if (!path)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
+
+    return (DWORD)(getSession(pCom)->capture.dump(path) ? ResponseCode::SUCCESS : ResponseCode::ERR_IO);
+}
+
+/* Start the CTS watcher of a session unless it is running. The caller holds the monitor mutex. */
+static std::shared_ptr<CtsWatcher> startWatcher(EKSSession& session)
+{
+    if (!session.watcher)
+    {
+        /* The watcher is stopped before the session is deleted */
+        auto onLine = [&session](bool cts)
         {
-            return ResponseCode::ERR_CONNECTION;
-        }
+            if (cts)
+            {
+                session.cache.keyPresent();
+            }
+            else
+            {
+                session.cache.keyRemoved();
+            }
+        };
+
+        session.watcher = std::make_shared<CtsWatcher>(*session.port, onLine);
     }
-    catch (const std::exception)
+
+    return session.watcher;
+}
+
+/* Longest sleep of a key monitor poll while nothing changes. It bounds the time StopKeyMonitor takes. */
+static constexpr std::chrono::milliseconds monitorWait(100);
+
+/* A lost reader is searched on the other ports after every this many failed attempts to reopen its port */
+static constexpr unsigned int searchInterval = 4;
+
+/* State of a key monitor thread, shared by its poll and reconnect functions */
+struct KeyMonitor
+{
+    std::shared_ptr<CtsWatcher> watcher;
+    size_t seen;
+    bool settled;
+    bool restartWatcher;  // The watcher was stopped while the port is reopened
+};
+
+/* Open the port of a lost reader again, or the port it is found on now. The caller holds the session mutex. */
+static bool reopenPort(EKSSession& session, unsigned int attempt)
+{
+    if (session.port->reopen(std::string()))
     {
-        return ResponseCode::ERR_UNKNOWN;
+        return true;
     }
 
-    return ResponseCode::ERR_UNKNOWN;
+    if (attempt % searchInterval != 0)
+    {
+        return false;
+    }
+
+    const DWORD port = ReaderDiscovery::locate(ReaderType::EKS, 0);
+    return port != 0 && session.port->reopen(SerialPort::deviceName(port));
 }
 
-/* Get COM port info */
-void EKSAPI GetSysComm(BYTE* buffer)
+/* Watch the reader on a background thread */
+DWORD EKSAPI StartKeyMonitor(HANDLE pCom, CardEventCallback callback, DWORD pollInterval)
 {
-    HKEY hKEY;
-    LPCTSTR data_Set = L"HARDWARE\\DEVICEMAP\\SERIALCOMM\\";
-    long ret = (RegOpenKeyEx(HKEY_LOCAL_MACHINE, data_Set, 0, KEY_READ, &hKEY));
+    if (!pCom)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    EKSSession* session = getSession(pCom);
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+    std::shared_ptr<CtsWatcher> watcher = startWatcher(*session);
+    auto monitor = std::make_shared<KeyMonitor>(KeyMonitor{watcher, watcher->changes(), false, false});
+
+    auto poll = [pCom, monitor](BYTE* uid, DWORD& uidLength, bool cardPresent)
+    {
+        // Once the state of the key is known, sleep until CTS changes instead of querying it every interval
+        if (monitor->settled)
+        {
+            monitor->seen = monitor->watcher->waitForChange(monitor->seen, Clock::now() + monitorWait);
+        }
+
+        monitor->settled = false;
+        DWORD res = GetKeyStatus(pCom);
+
+        if (res == (DWORD)ResponseCode::ERR_NO_KEY_DETECTED)
+        {
+            monitor->settled = true;
+            return PollResult::NO_CARD;
+        }
+
+        if (res != (DWORD)ResponseCode::SUCCESS)
+        {
+            return PollResult::CONNECTION_LOST;
+        }
+
+        // As long as CTS stays high, the same key is inside the reader
+        if (cardPresent)
+        {
+            monitor->settled = true;
+            return PollResult::CARD_PRESENT;
+        }
+
+        res = GetSerialNumber(pCom, uid);
+
+        if (res == (DWORD)ResponseCode::SUCCESS)
+        {
+            uidLength = SERIAL_NUMBER_LENGTH;
+            monitor->settled = true;
+            return PollResult::CARD_PRESENT;
+        }
+
+        if (res == (DWORD)ResponseCode::ERR_CONNECTION)
+        {
+            return PollResult::CONNECTION_LOST;
+        }
 
-    if (ret == ERROR_SUCCESS)
+        // The key was removed while reading or the read failed. Try again on the next poll.
+        return PollResult::NO_CARD;
+    };
+
+    auto reconnect = [session, monitor](unsigned int attempt)
     {
-        DWORD dwIndex = 0, lpcchValueName = 256, lpcbData = 256;
-        WCHAR lpValueName[255]{}, lpData[255]{};
+        // StopKeyMonitor holds the monitor mutex while it waits for this thread, the attempt is skipped then
+        std::unique_lock<std::mutex> guard(session->monitorMutex, std::try_to_lock);
 
-        buffer[0] = 0x00;
+        if (!guard.owns_lock())
+        {
+            return false;
+        }
 
-        for (; ret == ERROR_SUCCESS; dwIndex++)
+        // No watcher may wait on the port while it is reopened. One that StopKeyWatcher stopped stays stopped.
+        if (session->watcher)
         {
-            ret = RegEnumValue(hKEY, dwIndex, (LPWSTR)&lpValueName, &lpcchValueName, NULL, NULL, (LPBYTE)&lpData,
-                               &lpcbData);
+            session->watcher->stop();
+            session->watcher.reset();
+            monitor->restartWatcher = true;
+        }
 
-            if (ret == ERROR_SUCCESS)
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+
+            if (!reopenPort(*session, attempt))
             {
-                buffer[0] += 1;
-                *(buffer + buffer[0]) = _wtoi(lpData + 3);
+                return false;
             }
+        }
 
-            lpcchValueName = lpcbData = 256;
+        if (monitor->restartWatcher)
+        {
+            monitor->watcher = startWatcher(*session);
+            monitor->seen = monitor->watcher->changes();
+            monitor->restartWatcher = false;
         }
-    }
-    RegCloseKey(hKEY);
+
+        monitor->settled = false;
+        return true;
+    };
+
+    session->monitor.reset();
+    session->monitor = std::make_unique<CardMonitor>(poll, callback, std::chrono::milliseconds(pollInterval),
+                                                     reconnect, callback ? nullptr : &session->events);
+    return (DWORD)ResponseCode::SUCCESS;
 }
 
-/* Open a COM port for communication */
-HANDLE EKSAPI OpenComm(unsigned char port, unsigned int baud_rate)
+/* Stop watching the reader */
+void EKSAPI StopKeyMonitor(HANDLE pCom)
 {
-    DCB dcb{};
-    HANDLE hCom;
-    WCHAR sCommPort[1024];
+    if (!pCom)
+    {
+        return;
+    }
 
-    wsprintf(sCommPort, L"COM%d", port);
+    EKSSession* session = getSession(pCom);
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+    session->monitor.reset();
+}
 
-    hCom = CreateFileW(sCommPort, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+/* Take the events of a key monitor without callback */
+DWORD EKSAPI DrainKeyEvents(HANDLE pCom, QueuedCardEvent* events, DWORD capacity, DWORD* count, DWORD* dropped)
+{
+    if (!pCom)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
 
-    if (hCom == INVALID_HANDLE_VALUE)
+    if (!events || !count || !dropped)
     {
-        return nullptr;
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
     }
 
-    dcb.DCBlength = sizeof(dcb);
+    /* No lock is taken, the monitor may be polling meanwhile */
+    *count = (DWORD)getSession(pCom)->events.drain(events, capacity, *dropped);
+    return (DWORD)ResponseCode::SUCCESS;
+}
 
-    if (!GetCommState(hCom, &dcb))
+/* Queue the key events of the reader on a background thread */
+DWORD EKSAPI StartKeyWatcher(HANDLE pCom)
+{
+    if (!pCom)
     {
-        return nullptr;
+        return (DWORD)ResponseCode::ERR_CONNECTION;
     }
 
-    dcb.BaudRate = 9600;
-    dcb.ByteSize = 8;
-    dcb.StopBits = ONESTOPBIT;
-    dcb.Parity = EVENPARITY;
+    EKSSession* session = getSession(pCom);
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+    startWatcher(*session);
+    return (DWORD)ResponseCode::SUCCESS;
+}
 
-    if (!SetCommState(hCom, &dcb))
+/* Stop queueing key events. A running key monitor falls back to polling. */
+void EKSAPI StopKeyWatcher(HANDLE pCom)
+{
+    if (!pCom)
     {
-        return nullptr;
+        return;
     }
 
-    return hCom;
+    EKSSession* session = getSession(pCom);
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (session->watcher)
+    {
+        session->watcher->stop();
+        session->watcher.reset();
+    }
 }
 
-/* Close a COM port */
-void EKSAPI CloseComm(HANDLE pCom)
+/* Take the queued key events */
+DWORD EKSAPI GetKeyEvents(HANDLE pCom, LineEvent* events, DWORD capacity, DWORD timeout, DWORD* count)
 {
-    PurgeComm(pCom, PURGE_RXCLEAR);
-    CloseHandle(pCom);
+    if (!pCom || !count)
+    {
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    std::shared_ptr<CtsWatcher> watcher;
+
+    {
+        EKSSession* session = getSession(pCom);
+        std::lock_guard<std::mutex> lock(session->monitorMutex);
+        watcher = session->watcher;
+    }
+
+    /* The watcher is kept alive by this call, so closing the handle meanwhile only ends the wait */
+    if (!watcher)
+    {
+        *count = 0;
+        return (DWORD)ResponseCode::ERR_CONNECTION;
+    }
+
+    *count = (DWORD)watcher->take(events, capacity, Clock::now() + std::chrono::milliseconds(timeout));
+    return (DWORD)ResponseCode::SUCCESS;
 }
 
-/* Query CTS pin of the serial connection to determine wether a key is inserted */
-DWORD EKSAPI GetKeyStatus(HANDLE pCom)
+static DWORD submitAsync(HANDLE pCom, AsyncQueue::Job job, CompletionCallback callback, DWORD* token)
 {
-    DWORD dwModemStatus;
-
-    if (!GetCommModemStatus(pCom, &dwModemStatus))
+    if (!pCom || !token)
     {
         return (DWORD)ResponseCode::ERR_CONNECTION;
     }
 
-    // When a key is inside the reader, the CTS signal is high
-    if (dwModemStatus & MS_CTS_ON)
+    EKSSession* session = getSession(pCom);
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (!session->async)
     {
-        return (DWORD)ResponseCode::SUCCESS;
+        session->async = std::make_unique<AsyncQueue>();
     }
 
-    return (DWORD)ResponseCode::ERR_NO_KEY_DETECTED;
+    *token = session->async->submit(std::move(job), callback);
+    return (DWORD)ResponseCode::SUCCESS;
 }
 
-/* Read the serial number of the key */
-DWORD EKSAPI GetSerialNumber(HANDLE pCom, BYTE* buffer) { return ReadKeyData(pCom, 116, 8, buffer); }
+/* Read the serial number of the key on the worker thread */
+DWORD EKSAPI GetSerialNumberAsync(HANDLE pCom, CompletionCallback callback, DWORD* token)
+{
+    return ReadKeyDataAsync(pCom, SERIAL_NUMBER_OFFSET, SERIAL_NUMBER_LENGTH, callback, token);
+}
 
-/* Read data from the key */
-DWORD EKSAPI ReadKeyData(HANDLE pCom, const BYTE startByte, const BYTE length, BYTE* buffer)
+/* Read data from the key on the worker thread */
+DWORD EKSAPI ReadKeyDataAsync(HANDLE pCom, const BYTE startByte, const BYTE length, CompletionCallback callback,
+                              DWORD* token)
 {
-    ResponseCode res = (ResponseCode)GetKeyStatus(pCom);
+    auto job = [pCom, startByte, length](std::vector<BYTE>& data)
+    {
+        data.resize(length);
+        DWORD res = ReadKeyData(pCom, startByte, length, data.data());
 
-    if (res != ResponseCode::SUCCESS)
+        if (res != (DWORD)ResponseCode::SUCCESS)
+        {
+            data.clear();
+        }
+
+        return res;
+    };
+
+    return submitAsync(pCom, job, callback, token);
+}
+
+/* Read a range of the key memory on the worker thread */
+DWORD EKSAPI ReadKeyImageAsync(HANDLE pCom, const BYTE startByte, const DWORD length, CompletionCallback callback,
+                               DWORD* token)
+{
+    auto job = [pCom, startByte, length](std::vector<BYTE>& data)
     {
-        return (DWORD)res;
-    }
+        // ReadKeyImage rejects longer ranges before writing to the buffer
+        data.resize(std::min<DWORD>(length, KEY_ADDRESS_SPACE));
+        DWORD res = ReadKeyImage(pCom, startByte, length, data.data());
 
-    const BYTE cmdBuffer[]{0x07, CMD_SEND, CMD_READ, 0x01, 0x00, startByte, length};
+        if (res != (DWORD)ResponseCode::SUCCESS)
+        {
+            data.clear();
+        }
 
-    BYTE messageBuffer[256]{};
-    DWORD messageBufferLength = 0;
-    buildMessageBuffer(cmdBuffer, messageBuffer, messageBufferLength);
+        return res;
+    };
 
-    hCom = pCom;
-    BYTE readBuffer[256]{};
+    return submitAsync(pCom, job, callback, token);
+}
 
-    res = executeCommand(messageBuffer, messageBufferLength, readBuffer);
+/* Write data to the key on the worker thread */
+DWORD EKSAPI WriteKeyDataAsync(HANDLE pCom, const BYTE startByte, const BYTE length, const BYTE* buffer,
+                               const BOOL verify, CompletionCallback callback, DWORD* token)
+{
+    if (!buffer)
+    {
+        return (DWORD)ResponseCode::ERR_INVALID_PARAMETER;
+    }
 
-    if (res != ResponseCode::SUCCESS)
+    // The buffer of the caller may be gone when the job runs
+    std::vector<BYTE> data(buffer, buffer + length);
+
+    auto job = [pCom, startByte, length, data, verify](std::vector<BYTE>&)
+    { return WriteKeyData(pCom, startByte, length, data.data(), verify); };
+
+    return submitAsync(pCom, job, callback, token);
+}
+
+/* Collect the result of an asynchronous command that was queued without callback */
+DWORD EKSAPI GetAsyncResult(HANDLE pCom, DWORD token, BYTE* buffer)
+{
+    if (!pCom)
     {
-        return (DWORD)res;
+        return (DWORD)ResponseCode::ERR_CONNECTION;
     }
 
-    DWORD responseLength = readBuffer[0] + 3;
+    EKSSession* session = getSession(pCom);
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
 
-    // Check correct response type
-    if (readBuffer[1] != CMD_RESPONSE)
+    if (!session->async)
     {
-        return (DWORD)ResponseCode::ERR_UNKNOWN;
+        return (DWORD)ResponseCode::ERR_UNKNOWN_TOKEN;
     }
 
-    if (readBuffer[2] == CMD_RES_STATUS)
+    DWORD res = 0;
+    std::vector<BYTE> data;
+
+    switch (session->async->fetch(token, res, data))
     {
-        // Byte number 6 is the status code on failure
-        return (DWORD)readBuffer[6];
+        case AsyncStatus::PENDING:
+            return (DWORD)ResponseCode::PENDING;
+        case AsyncStatus::UNKNOWN_TOKEN:
+            return (DWORD)ResponseCode::ERR_UNKNOWN_TOKEN;
+        default:
+            break;
     }
 
-    // Check correct response type
-    if (readBuffer[2] != CMD_READ)
+    if (!data.empty())
     {
-        return (DWORD)ResponseCode::ERR_UNKNOWN;
+        memcpy(buffer, data.data(), data.size());
     }
 
-    memcpy(buffer, readBuffer + 7, length);
-    return (DWORD)ResponseCode::SUCCESS;
+    return res;
 }
@@ -1,10 +1,24 @@
 #pragma once
-#include <Windows.h>
+#include "Platform.h"
+#include "AsyncQueue.h"
+#include "CardEventQueue.h"
+#include "CardMonitor.h"
+#include "CtsWatcher.h"
+#include "FrameCapture.h"
+#include "KeyCache.h"
+#include "ReaderDiscovery.h"
+#include "RetryPolicy.h"
+#include "RttEstimator.h"
+#include "SerialPort.h"
+#include "StatsCollector.h"
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 
 #define EKSAPI __declspec(dllexport) __stdcall
 
-constexpr ULONGLONG timeout = 2000;
+/* Upper bound of every reply timeout, which is estimated from the measured round trip times */
+constexpr std::chrono::milliseconds timeout(2000);
 
 constexpr BYTE STX = 0x02;
 constexpr BYTE ETX = 0x03;
@@ -17,11 +31,49 @@ constexpr BYTE CMD_WRITE = 0x50;
 constexpr BYTE CMD_READ = 0x4C;
 constexpr BYTE CMD_RES_STATUS = 0x46;
 
-static BYTE accByte = DLE;
-static BYTE startByte = STX;
-static HANDLE hCom = INVALID_HANDLE_VALUE;
-static DWORD dwErr = 0;
-static COMSTAT comStat;
+/* Read and write commands address the key memory with one byte. A read
+ * response repeats the 7 byte command header in front of the data and its
+ * length byte counts both, so one command reads at most 248 bytes. */
+constexpr DWORD KEY_ADDRESS_SPACE = 0x100;
+constexpr BYTE CMD_HEADER_SIZE = 7;
+constexpr BYTE MAX_READ_LENGTH = 0xFF - CMD_HEADER_SIZE;
+
+/* A write command must not cross the boundary of a block of the key memory */
+constexpr BYTE WRITE_BLOCK_SIZE = 16;
+
+constexpr BYTE SERIAL_NUMBER_OFFSET = 116;
+constexpr BYTE SERIAL_NUMBER_LENGTH = 8;
+
+/* State of one opened reader. The HANDLE returned by OpenComm points to it,
+ * so readers on different ports can be used from different threads. */
+struct EKSSession
+{
+    std::unique_ptr<Transport> port;
+    std::mutex mutex;  // Serializes the commands of the JS thread and the key monitor
+    std::mutex monitorMutex;
+    std::unique_ptr<CardMonitor> monitor;
+    std::shared_ptr<CtsWatcher> watcher;  // Shared with the key monitor, which sleeps until CTS changes
+    std::unique_ptr<AsyncQueue> async;  // Created on the first asynchronous command
+    KeyCache cache{SERIAL_NUMBER_OFFSET};
+    RttEstimator rtt;
+    RetryPolicy retryPolicy = DefaultRetryPolicy;
+    Retrier retrier;
+    StatsCollector stats;
+    FrameCapture capture;  // The last frames of sendBytes and the frames received by attemptCommand
+    CardEventQueue events;  // Of a key monitor without callback
+};
+
+/* The phases of a command whose reply times are estimated. The exchange of an
+ * RttEstimate holds the phase in its second byte and the command, CMD_READ or
+ * CMD_WRITE, in its first byte. */
+enum class ExchangePhase : BYTE
+{
+    CONNECT = 1,         // STX answered with DLE
+    COMMAND = 2,         // command answered with DLE
+    RESPONSE_START = 3,  // STX of the response after the command was executed
+    RESPONSE = 4         // first bytes of the response frame
+};
+
 enum class ResponseCode : BYTE
 {
     SUCCESS = 0x00,
@@ -34,7 +86,11 @@ enum class ResponseCode : BYTE
     ERR_WRITE_PROTECTED = 0x50,
     ERR_IO = 0xF1,
     ERR_COMMUNICATION = 0xF2,
-    ERR_CONNECTION = 0xF3
+    ERR_CONNECTION = 0xF3,
+    PENDING = 0xF4,  // the asynchronous command did not complete yet
+    ERR_UNKNOWN_TOKEN = 0xF5,
+    ERR_INVALID_PARAMETER = 0xF6,
+    ERR_VERIFY = 0xF7  // the data read back after a write differs
 };
 
 class EKSError : std::exception
@@ -53,11 +109,65 @@ class EKSError : std::exception
 };
 
 extern "C" VOID EKSAPI GetSysComm(BYTE* buffer);
+// Probe knownPort for a reader of knownType, a ReaderType, and if none answers there all serial ports at the same time
+// for EKS, iDTRONIC and Baltech readers. Copies up to capacity readers into readers and their number into count.
+extern "C" DWORD EKSAPI DiscoverReaders(DWORD knownPort, DWORD knownType, DiscoveredReader* readers, DWORD capacity,
+                                        DWORD* count);
 extern "C" HANDLE EKSAPI OpenComm(unsigned char port, unsigned int baud_rate = 9600);
 extern "C" VOID EKSAPI CloseComm(HANDLE pCom);
 extern "C" DWORD EKSAPI GetKeyStatus(HANDLE pCom);
 extern "C" DWORD EKSAPI GetSerialNumber(HANDLE pCom, BYTE* buffer);
-// Dont read at byte 16 or 16 bytes. The protocol is weird when sending 0x10 and i couldn't figure it out :(
+// Read 1 to MAX_READ_LENGTH bytes with a single command
 extern "C" DWORD EKSAPI ReadKeyData(HANDLE pCom, const BYTE startByte, const BYTE length, BYTE* buffer);
-// Not implemented
-extern "C" DWORD EKSAPI WriteKeyData(HANDLE pCom, const BYTE startByte, const BYTE length, const BYTE* buffer);
\ No newline at end of file
+// Read any range of the key memory. The range is split into commands of MAX_READ_LENGTH bytes, which are sent back to
+// back without releasing the reader.
+extern "C" DWORD EKSAPI ReadKeyImage(HANDLE pCom, const BYTE startByte, const DWORD length, BYTE* buffer);
+// Write any range of the key memory. The range is split at the block boundaries and the blocks are sent back to back
+// without releasing the reader. With verify, the written range is read back afterwards.
+extern "C" DWORD EKSAPI WriteKeyData(HANDLE pCom, const BYTE startByte, const BYTE length, const BYTE* buffer,
+                                     const BOOL verify = FALSE);
+// Serve reads of the given ranges of recently seen keys from memory. ranges holds rangeCount pairs of start byte and
+// length. A key that is inserted again is identified by its serial number only. Entries expire after ttl milliseconds,
+// a ttl of 0 disables the cache.
+extern "C" DWORD EKSAPI ConfigureKeyCache(HANDLE pCom, const BYTE* ranges, DWORD rangeCount, DWORD ttl);
+// Number of immediate resends after a corrupted response or a NAK and of retries after a timeout, with a backoff of
+// backoff ms doubled for every retry up to maxBackoff ms
+extern "C" DWORD EKSAPI SetRetryPolicy(HANDLE pCom, DWORD resends, DWORD retries, DWORD backoff, DWORD maxBackoff);
+extern "C" DWORD EKSAPI GetRetryCounters(HANDLE pCom, RetryCounters* counters);
+// Copy up to capacity estimates of the reply times into estimates, see RttEstimator. count receives their number.
+extern "C" DWORD EKSAPI GetRttEstimate(HANDLE pCom, RttEstimate* estimates, DWORD capacity, DWORD* count);
+// Copy the line and retry counters into stats and the counters and latency histograms of up to capacity commands into
+// commands, see StatsCollector. count receives the number of commands, which are CMD_READ and CMD_WRITE.
+extern "C" DWORD EKSAPI GetStats(HANDLE pCom, SessionStats* stats, CommandStats* commands, DWORD capacity,
+                                 DWORD* count);
+// Write the last frames sent and received to a pcap file at path, see FrameCapture. Returns ERR_IO if the file cannot be
+// written.
+extern "C" DWORD EKSAPI DumpFrameCapture(HANDLE pCom, const char* path);
+// Start a thread that watches the reader and calls callback whenever a key is inserted or removed. A lost reader is
+// reported with CONNECTION_LOST, then its port is reopened, or the port it shows up on, until CONNECTION_RESTORED.
+// Without callback, the events are queued for DrainKeyEvents instead.
+extern "C" DWORD EKSAPI StartKeyMonitor(HANDLE pCom, CardEventCallback callback, DWORD pollInterval);
+extern "C" VOID EKSAPI StopKeyMonitor(HANDLE pCom);
+// Move up to capacity queued key monitor events into events, oldest first, and their number into count. dropped
+// receives the number of events lost since the last call because the queue was full, see CardEventQueue. Only one
+// thread at a time may drain a handle.
+extern "C" DWORD EKSAPI DrainKeyEvents(HANDLE pCom, QueuedCardEvent* events, DWORD capacity, DWORD* count,
+                                       DWORD* dropped);
+// Block on CTS changes on a background thread and queue every insert and remove of a key with its time. The key monitor
+// starts the watcher as well.
+extern "C" DWORD EKSAPI StartKeyWatcher(HANDLE pCom);
+extern "C" VOID EKSAPI StopKeyWatcher(HANDLE pCom);
+// Wait up to timeout milliseconds until a key event is queued and move up to capacity events into events. count
+// receives the number of events, 0 after the timeout. Returns ERR_CONNECTION if the watcher is not running.
+extern "C" DWORD EKSAPI GetKeyEvents(HANDLE pCom, LineEvent* events, DWORD capacity, DWORD timeout, DWORD* count);
+// Queue the command on the worker thread of the handle and return right away. callback receives the return code and the
+// buffer of the synchronous function. Without callback, the result is collected with GetAsyncResult.
+extern "C" DWORD EKSAPI GetSerialNumberAsync(HANDLE pCom, CompletionCallback callback, DWORD* token);
+extern "C" DWORD EKSAPI ReadKeyDataAsync(HANDLE pCom, const BYTE startByte, const BYTE length, CompletionCallback callback,
+                                         DWORD* token);
+extern "C" DWORD EKSAPI ReadKeyImageAsync(HANDLE pCom, const BYTE startByte, const DWORD length,
+                                          CompletionCallback callback, DWORD* token);
+extern "C" DWORD EKSAPI WriteKeyDataAsync(HANDLE pCom, const BYTE startByte, const BYTE length, const BYTE* buffer,
+                                          const BOOL verify, CompletionCallback callback, DWORD* token);
+// Returns PENDING until the command completed. Each result can be collected once.
+extern "C" DWORD EKSAPI GetAsyncResult(HANDLE pCom, DWORD token, BYTE* buffer);
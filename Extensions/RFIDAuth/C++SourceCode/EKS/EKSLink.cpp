@@ -0,0 +1,145 @@
+#include "EKSLink.h"
+
+constexpr std::chrono::milliseconds EKSLink::CharacterDelay;
+
+void EKSLink::start()
+{
+    outLength = 0;
+    frameStarted = false;
+    collisions = 0;
+
+    if (awaitRepeat)
+    {
+        /* A repetition that does not come times out, then the next attempt starts over */
+        awaitRepeat = false;
+        current = State::RESPONSE_START;
+        return;
+    }
+
+    send(STX);
+    current = State::CONNECT;
+}
+
+void EKSLink::receive(BYTE b)
+{
+    switch (current)
+    {
+        case State::CONNECT:
+            if (b == DLE)
+            {
+                out = command;
+                outLength = commandLength;
+                current = State::COMMAND;
+            }
+            else if (b == STX)
+            {
+                send(DLE);
+                beginFrame(State::COLLISION);
+            }
+            else
+            {
+                current = State::CORRUPTED;
+            }
+            break;
+        case State::COMMAND:
+            current = b == DLE ? State::RESPONSE_START : State::CORRUPTED;
+            break;
+        case State::RESPONSE_START:
+            /* Line noise before the response is skipped */
+            if (b == STX)
+            {
+                send(DLE);
+                beginFrame(State::RESPONSE);
+            }
+            break;
+        case State::RESPONSE:
+        case State::COLLISION:
+            receiveFrame(b);
+            break;
+        default:
+            break;
+    }
+}
+
+void EKSLink::expire()
+{
+    /* A frame that stopped in the middle is repeated like a corrupted one */
+    if (frameStarted && pending())
+    {
+        send(NAK);
+        awaitRepeat = current == State::RESPONSE;
+        current = State::CORRUPTED;
+        return;
+    }
+
+    current = State::TIMED_OUT;
+}
+
+ExchangePhase EKSLink::phase() const
+{
+    switch (current)
+    {
+        case State::CONNECT:
+            return ExchangePhase::CONNECT;
+        case State::COMMAND:
+            return ExchangePhase::COMMAND;
+        case State::RESPONSE_START:
+            return ExchangePhase::RESPONSE_START;
+        default:
+            return ExchangePhase::RESPONSE;
+    }
+}
+
+void EKSLink::send(BYTE b)
+{
+    if (outLength == 0)
+    {
+        out = control;
+    }
+
+    control[outLength++] = b;
+}
+
+void EKSLink::beginFrame(State state)
+{
+    decoder = EKSFrameDecoder(response, capacity);
+    frameStarted = false;
+    current = state;
+}
+
+void EKSLink::receiveFrame(BYTE b)
+{
+    frameStarted = true;
+
+    switch (decoder.feed(&b, 1))
+    {
+        case DecodeStatus::INCOMPLETE:
+            return;
+        case DecodeStatus::COMPLETE:
+            send(DLE);
+
+            /* The frame of a collision is dropped and the command is started again, unless the reader keeps
+             * sending its own frames */
+            if (current == State::COLLISION)
+            {
+                if (++collisions >= MaxCollisions)
+                {
+                    current = State::CORRUPTED;
+                    return;
+                }
+
+                send(STX);
+                frameStarted = false;
+                current = State::CONNECT;
+                return;
+            }
+
+            current = State::DONE;
+            return;
+        default:
+            send(NAK);
+            awaitRepeat = current == State::RESPONSE;
+            current = State::CORRUPTED;
+            return;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "EKS.h"
+#include "FrameCodec.h"
+
+/* The link layer of the EKS readers, a variant of 3964R, as a state machine
+ * that never blocks. The driver writes what output() holds, waits until bytes
+ * arrive or the timer of the state passes and hands either on with receive()
+ * or expire(). Every byte is answered as it arrives, so a corrupted response
+ * costs one repetition by the reader instead of the whole command.
+ *
+ * - A command starts with STX, which the reader acknowledges with DLE. The
+ *   framed command follows and is acknowledged with DLE as well. A NAK or any
+ *   other byte in place of a DLE fails the attempt, the next one sends STX.
+ * - The reader announces the response with STX, which is answered with DLE.
+ *   The response is acknowledged with DLE if its BCC matches and with NAK if
+ *   not or if the character delay passed in the middle of it. The attempt
+ *   after a NAK waits for the reader to repeat the response.
+ * - An STX of the reader in place of the DLE for the STX of the driver is a
+ *   collision. The driver has the low priority: it receives and acknowledges
+ *   the frame of the reader, which belongs to none of its commands, and then
+ *   sends its STX again. After MaxCollisions frames the attempt counts as
+ *   corrupted, so a reader that never gives way cannot hold the driver. */
+class EKSLink
+{
+   public:
+    /* Longest time between two bytes of a frame, as for 3964R */
+    static constexpr std::chrono::milliseconds CharacterDelay{220};
+    /* Frames of the reader received in place of the DLE for the STX within one attempt */
+    static constexpr unsigned int MaxCollisions = 2;
+
+    enum class State
+    {
+        CONNECT,         // STX sent, awaiting DLE
+        COMMAND,         // command sent, awaiting DLE
+        RESPONSE_START,  // awaiting the STX of the response
+        RESPONSE,        // receiving the response
+        COLLISION,       // receiving a frame the reader sent in place of the DLE for the STX
+        DONE,            // the response was received and acknowledged
+        CORRUPTED,       // a NAK was sent or received, the attempt can be repeated at once
+        TIMED_OUT
+    };
+
+    /* command is the framed command, response receives the body of the response */
+    EKSLink(const BYTE* command, size_t commandLength, BYTE* response, size_t capacity)
+        : command(command), commandLength(commandLength), response(response), capacity(capacity),
+          decoder(response, capacity)
+    {
+    }
+
+    /* Begin an attempt with the STX of the command or, after a NAKed response, with the wait for its repetition */
+    void start();
+    void receive(BYTE b);
+    /* The timer of the state passed */
+    void expire();
+
+    State state() const { return current; }
+    /* False once the attempt ended */
+    bool pending() const { return current < State::DONE; }
+    /* The exchange whose reply time limits the wait for the next byte, unless a frame is in progress */
+    ExchangePhase phase() const;
+    /* True while a frame is received, its bytes are limited by CharacterDelay */
+    bool inFrame() const { return frameStarted; }
+
+    /* Bytes to be written before the next byte is received, written() consumes them */
+    const BYTE* output() const { return out; }
+    size_t outputLength() const { return outLength; }
+    void written() { outLength = 0; }
+
+   private:
+    const BYTE* command;
+    const size_t commandLength;
+    BYTE* response;
+    const size_t capacity;
+    EKSFrameDecoder decoder;
+    State current = State::TIMED_OUT;
+    bool awaitRepeat = false;
+    bool frameStarted = false;
+    unsigned int collisions = 0;
+    BYTE control[2];
+    const BYTE* out = nullptr;
+    size_t outLength = 0;
+
+    void send(BYTE b);
+    void beginFrame(State state);
+    void receiveFrame(BYTE b);
+};
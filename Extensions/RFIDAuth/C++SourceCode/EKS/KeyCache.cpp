@@ -0,0 +1,129 @@
+#include "KeyCache.h"
+#include <algorithm>
+#include <cstring>
+
+constexpr std::chrono::milliseconds KeyCache::MaxObservationGap;
+
+bool KeyCache::configure(const BYTE* ranges, DWORD rangeCount, std::chrono::milliseconds ttl)
+{
+    std::bitset<AddressSpace> cacheable;
+
+    for (DWORD i = 0; i < rangeCount; i++)
+    {
+        const size_t start = ranges[2 * i];
+        const size_t length = ranges[2 * i + 1];
+
+        if (start + length > AddressSpace)
+        {
+            return false;
+        }
+
+        for (size_t address = start; address < start + length; address++)
+        {
+            cacheable.set(address);
+        }
+    }
+
+    /* Cached bytes outside of the new ranges must not be served any longer */
+    entries.clear();
+    current = nullptr;
+    identifiedAt = (size_t)-1;
+    this->cacheable = cacheable;
+    this->ttl = ttl;
+    return true;
+}
+
+void KeyCache::keyPresent()
+{
+    const Clock::duration now = Clock::now().time_since_epoch();
+    const Clock::duration previous(lastObservation.exchange(now.count()));
+
+    if (now - previous > MaxObservationGap)
+    {
+        removals++;
+    }
+}
+
+void KeyCache::identify(const BYTE* serialNumber, size_t generation)
+{
+    SerialNumber key;
+    memcpy(key.data(), serialNumber, SerialNumberLength);
+    const Clock::time_point now = Clock::now();
+    auto it = entries.find(key);
+
+    if (it != entries.end() && now - it->second.filled > ttl)
+    {
+        entries.erase(it);
+        it = entries.end();
+    }
+
+    if (it == entries.end())
+    {
+        if (entries.size() == MaxEntries)
+        {
+            entries.erase(std::min_element(entries.begin(), entries.end(),
+                                           [](const std::pair<const SerialNumber, Entry>& a,
+                                              const std::pair<const SerialNumber, Entry>& b)
+                                           { return a.second.filled < b.second.filled; }));
+        }
+
+        it = entries.emplace(key, Entry{now, {}, {}}).first;
+    }
+
+    current = &it->second;
+    identifiedAt = generation;
+    store(serialNumberOffset, SerialNumberLength, serialNumber);
+}
+
+bool KeyCache::lookup(BYTE startByte, DWORD length, BYTE* buffer) const
+{
+    if (!current || !identified() || startByte + length > AddressSpace)
+    {
+        return false;
+    }
+
+    for (size_t address = startByte; address < startByte + length; address++)
+    {
+        if (!current->valid.test(address))
+        {
+            return false;
+        }
+    }
+
+    memcpy(buffer, &current->data[startByte], length);
+    return true;
+}
+
+void KeyCache::store(BYTE startByte, DWORD length, const BYTE* data)
+{
+    if (!current || !identified())
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < length && startByte + i < AddressSpace; i++)
+    {
+        const size_t address = startByte + i;
+
+        /* The serial number identifies the entry, so it is always known */
+        if (cacheable.test(address) ||
+            (address >= serialNumberOffset && address < serialNumberOffset + SerialNumberLength))
+        {
+            current->data[address] = data[i];
+            current->valid.set(address);
+        }
+    }
+}
+
+void KeyCache::invalidate(BYTE startByte, DWORD length)
+{
+    if (!current)
+    {
+        return;
+    }
+
+    for (size_t address = startByte; address < startByte + length && address < AddressSpace; address++)
+    {
+        current->valid.reset(address);
+    }
+}
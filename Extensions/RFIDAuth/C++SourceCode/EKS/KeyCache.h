@@ -0,0 +1,70 @@
+#pragma once
+#include "Platform.h"
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <map>
+
+/* Remembers the memory of recently seen keys by their serial number, so a key
+ * that is inserted again only costs the read of its serial number. Only the
+ * configured ranges are cached. Entries older than the TTL are dropped when
+ * their key is inserted again, the least recently filled entry is dropped when
+ * the cache is full.
+ *
+ * The inserted key is known from its serial number as long as CTS is seen
+ * high without a gap of more than MaxObservationGap. A key swapped between two
+ * observations further apart would go unnoticed, so then the serial number is
+ * read again. The key monitor polls often enough to keep the key known.
+ * Everything but keyPresent() and keyRemoved() is called with the session
+ * mutex held. */
+class KeyCache
+{
+   public:
+    static constexpr size_t AddressSpace = 0x100;
+    static constexpr size_t SerialNumberLength = 8;
+    static constexpr size_t MaxEntries = 64;
+    static constexpr std::chrono::milliseconds MaxObservationGap{100};
+
+    using SerialNumber = std::array<BYTE, SerialNumberLength>;
+
+    KeyCache(BYTE serialNumberOffset) : serialNumberOffset(serialNumberOffset) {}
+
+    /* ranges holds rangeCount pairs of start byte and length. A TTL of 0 disables the cache and drops all entries. */
+    bool configure(const BYTE* ranges, DWORD rangeCount, std::chrono::milliseconds ttl);
+    bool enabled() const { return ttl.count() > 0; }
+
+    /* Called whenever CTS was queried. Safe to call without the session mutex. */
+    void keyPresent();
+    void keyRemoved() { removals++; }
+    bool identified() const { return identifiedAt == removals; }
+
+    /* Identify the inserted key by its serial number. generation is the value of
+     * beginIdentify() before the serial number was read, so a key removed in
+     * the meantime is not mistaken for the key that was read. */
+    size_t beginIdentify() const { return removals; }
+    void identify(const BYTE* serialNumber, size_t generation);
+
+    /* Copy a range of the inserted key if all of its bytes are cached */
+    bool lookup(BYTE startByte, DWORD length, BYTE* buffer) const;
+    /* Remember the bytes of a range of the inserted key that lie in the configured ranges */
+    void store(BYTE startByte, DWORD length, const BYTE* data);
+    /* Forget a range whose content on the inserted key is unknown, e.g. after a failed write */
+    void invalidate(BYTE startByte, DWORD length);
+
+   private:
+    struct Entry
+    {
+        Clock::time_point filled;
+        std::array<BYTE, AddressSpace> data;
+        std::bitset<AddressSpace> valid;
+    };
+
+    const BYTE serialNumberOffset;
+    std::bitset<AddressSpace> cacheable;
+    std::chrono::milliseconds ttl{0};
+    std::map<SerialNumber, Entry> entries;
+    Entry* current = nullptr;
+    std::atomic<size_t> removals{0};
+    std::atomic<Clock::rep> lastObservation{0};
+    size_t identifiedAt = (size_t)-1;
+};
@@ -0,0 +1,100 @@
+/* Encode and decode throughput of the frame codecs in Common/FrameCodec.h.
+ *
+ * Build in this directory with:
+ *   g++ -std=c++17 -O2 -I../../Common FrameCodecBenchmark.cpp -o FrameCodecBenchmark */
+#include "FrameCodec.h"
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+static constexpr size_t Iterations = 2000000;
+
+/* Keeps the compiler from dropping the measured work */
+static volatile size_t sink;
+
+static void measure(const char* name, size_t frameSize, const std::function<size_t()>& work)
+{
+    const Clock::time_point start = Clock::now();
+    size_t total = 0;
+
+    for (size_t i = 0; i < Iterations; i++)
+    {
+        total += work();
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    sink = total;
+    printf("%-36s %6zu %10.1f %12.0f %10.1f\n", name, frameSize, seconds * 1e9 / Iterations, Iterations / seconds,
+           Iterations * frameSize / seconds / 1e6);
+}
+
+int main()
+{
+    printf("%-36s %6s %10s %12s %10s\n", "operation", "bytes", "ns/frame", "frames/s", "MB/s");
+
+    /* The EKS read command and a 100 byte read reply in which every 16th byte is a DLE */
+    const BYTE readCommand[]{0x07, 0x54, 0x4C, 0x01, 0x00, 0x74, 0x08};
+    BYTE reply[107]{107, 0x52, 0x4C, 0x01, 0x00, 0x00, 100};
+
+    for (size_t i = 7; i < sizeof(reply); i++)
+    {
+        reply[i] = i % 16 ? (BYTE)i : EKSFrame::DLE;
+    }
+
+    BYTE frame[EKSFrame::maxEncodedSize(sizeof(reply))];
+    BYTE work[sizeof(frame)];
+    size_t bodyLength = 0;
+
+    measure("EKS encode read command", sizeof(readCommand),
+            [&] { return EKSFrame::encode(readCommand, sizeof(readCommand), frame, sizeof(frame)); });
+
+    const size_t replyLength = EKSFrame::encode(reply, sizeof(reply), frame, sizeof(frame));
+    measure("EKS encode 100 byte reply", replyLength,
+            [&] { return EKSFrame::encode(reply, sizeof(reply), frame, sizeof(frame)); });
+
+    /* In-place decoding destroys the frame, so every run decodes a fresh copy. The copy is measured as well. */
+    measure("EKS copy + decode in place", replyLength,
+            [&]
+            {
+                memcpy(work, frame, replyLength);
+                EKSFrame::decode(work, replyLength, bodyLength);
+                return bodyLength;
+            });
+
+    measure("EKS streaming decode, 16 byte chunks", replyLength,
+            [&]
+            {
+                EKSFrameDecoder decoder(work, sizeof(work));
+
+                for (size_t i = 0; i < replyLength; i += 16)
+                {
+                    decoder.feed(&frame[i], replyLength - i < 16 ? replyLength - i : 16);
+                }
+
+                return decoder.size();
+            });
+
+    /* iDTRONIC GET_SNR request and a four block read reply */
+    constexpr IDTRONICCommand getSnr{0x25, 2, 2};
+    const BYTE snrParameters[]{0x26, 0x00};
+    const BYTE readData[64]{};
+    BYTE request[IDTRONICFrame::MaxFrameSize];
+    BYTE readReply[IDTRONICFrame::MaxFrameSize];
+    IDTRONICReply decoded{};
+
+    measure("iDTRONIC encode GET_SNR", IDTRONICFrame::Overhead + 3,
+            [&] { return IDTRONICFrame::encode(0x00, getSnr, snrParameters, 2, request, sizeof(request)); });
+
+    /* A reply has the layout of a request with the status in place of the command */
+    const IDTRONICCommand status{0x00, 0, 0xFE};
+    const size_t readReplyLength = IDTRONICFrame::encode(0x00, status, readData, sizeof(readData), readReply, sizeof(readReply));
+
+    measure("iDTRONIC decode 64 byte reply", readReplyLength,
+            [&]
+            {
+                IDTRONICFrame::decode(readReply, readReplyLength, decoded);
+                return decoded.dataLength;
+            });
+
+    return 0;
+}
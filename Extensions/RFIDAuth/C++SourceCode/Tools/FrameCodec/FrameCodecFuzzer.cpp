@@ -0,0 +1,196 @@
+/* Fuzz target for the frame codecs in Common/FrameCodec.h.
+ *
+ * Build with libFuzzer in this directory:
+ *   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -I../../Common FrameCodecFuzzer.cpp
+ *       -o FrameCodecFuzzer
+ * Without libFuzzer, FUZZ_STANDALONE adds a main that runs random inputs or replays the given files:
+ *   g++ -std=c++17 -g -O1 -fsanitize=address,undefined -DFUZZ_STANDALONE -I../../Common FrameCodecFuzzer.cpp
+ *       -o FrameCodecFuzzer
+ *
+ * Every decoder works on a heap copy of exactly the input size, so the
+ * sanitizer reports any access past it. Encoding a body and decoding the
+ * frame again must return the body. */
+#include "FrameCodec.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define CHECK(condition)                                                 \
+    if (!(condition))                                                    \
+    {                                                                    \
+        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        abort();                                                         \
+    }
+
+static void fuzzEKSDecode(const uint8_t* data, size_t size)
+{
+    std::vector<BYTE> frame(data, data + size);
+    size_t bodyLength = 0;
+    const DecodeStatus status = EKSFrame::decode(frame.data(), frame.size(), bodyLength);
+
+    if (status != DecodeStatus::COMPLETE)
+    {
+        return;
+    }
+
+    CHECK(bodyLength <= size);
+
+    /* The streaming decoder must agree for any chunking */
+    std::vector<BYTE> out(bodyLength);
+    EKSFrameDecoder decoder(out.data(), out.size());
+    DecodeStatus streamStatus = DecodeStatus::INCOMPLETE;
+
+    for (size_t i = 0; i < size && streamStatus == DecodeStatus::INCOMPLETE;)
+    {
+        const size_t chunk = std::min<size_t>(1 + data[i] % 7, size - i);
+        streamStatus = decoder.feed(&data[i], chunk);
+        i += chunk;
+    }
+
+    CHECK(streamStatus == DecodeStatus::COMPLETE);
+    CHECK(decoder.size() == bodyLength);
+    CHECK(bodyLength == 0 || !memcmp(out.data(), frame.data(), bodyLength));
+}
+
+static void fuzzEKSStream(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    /* A small output buffer must end in ERR_OVERFLOW instead of an overrun */
+    std::vector<BYTE> out(data[0] % 16);
+    EKSFrameDecoder decoder(out.data(), out.size());
+    decoder.feed(data + 1, size - 1);
+    CHECK(decoder.size() <= out.size());
+}
+
+static void fuzzEKSRoundTrip(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    /* The capacity is taken from the input, so frames that do not fit are covered as well */
+    std::vector<BYTE> frame(data[0] % 2 ? EKSFrame::maxEncodedSize(size - 1) : data[0]);
+    const size_t length = EKSFrame::encode(data + 1, size - 1, frame.data(), frame.size());
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    CHECK(length <= frame.size());
+    size_t bodyLength = 0;
+    CHECK(EKSFrame::decode(frame.data(), length, bodyLength) == DecodeStatus::COMPLETE);
+    CHECK(bodyLength == size - 1);
+    CHECK(!memcmp(frame.data(), data + 1, bodyLength));
+}
+
+static void fuzzIDTRONICDecode(const uint8_t* data, size_t size)
+{
+    std::vector<BYTE> frame(data, data + size);
+    IDTRONICReply reply{};
+
+    if (IDTRONICFrame::decode(frame.data(), frame.size(), reply) != DecodeStatus::COMPLETE)
+    {
+        return;
+    }
+
+    CHECK(reply.data >= frame.data() && reply.data + reply.dataLength <= frame.data() + frame.size());
+}
+
+static void fuzzIDTRONICRoundTrip(const uint8_t* data, size_t size)
+{
+    if (size < 3)
+    {
+        return;
+    }
+
+    const IDTRONICCommand command{data[1], 0, 0xFE};
+    std::vector<BYTE> frame(data[2]);
+    const size_t length = IDTRONICFrame::encode(data[0], command, data + 3, size - 3, frame.data(), frame.size());
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    CHECK(length == IDTRONICFrame::Overhead + 1 + size - 3 && length <= frame.size());
+
+    /* A request decodes like a reply with the command code as status */
+    IDTRONICReply reply{};
+    CHECK(IDTRONICFrame::decode(frame.data(), length, reply) == DecodeStatus::COMPLETE);
+    CHECK(reply.address == data[0] && reply.status == data[1] && reply.dataLength == size - 3);
+    CHECK(!memcmp(reply.data, data + 3, reply.dataLength));
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    fuzzEKSDecode(data, size);
+    fuzzEKSStream(data, size);
+    fuzzEKSRoundTrip(data, size);
+    fuzzIDTRONICDecode(data, size);
+    fuzzIDTRONICRoundTrip(data, size);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+#include <random>
+
+int main(int argc, char* argv[])
+{
+    /* Replay inputs, e.g. a crash found by libFuzzer */
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            FILE* file = fopen(argv[i], "rb");
+
+            if (!file)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+
+            std::vector<uint8_t> input;
+            int c;
+
+            while ((c = fgetc(file)) != EOF)
+            {
+                input.push_back((uint8_t)c);
+            }
+
+            fclose(file);
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+
+        return 0;
+    }
+
+    /* Random inputs that favor the bytes with a meaning in the frames */
+    const uint8_t special[]{0x02, 0x03, 0x10, 0x15, 0xAA, 0xBB, 0x00, 0xFF};
+    std::mt19937 random(1);
+    std::vector<uint8_t> input;
+
+    for (int run = 0; run < 2000000; run++)
+    {
+        input.resize(random() % 300);
+
+        for (uint8_t& b : input)
+        {
+            b = random() % 2 ? special[random() % sizeof(special)] : (uint8_t)random();
+        }
+
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    printf("2000000 random inputs passed\n");
+    return 0;
+}
+#endif
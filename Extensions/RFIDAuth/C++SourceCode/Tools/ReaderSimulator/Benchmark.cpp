@@ -0,0 +1,227 @@
+/* Latency benchmark of the EKS and iDTRONIC drivers against simulated readers
+ * on Linux pseudo-terminals. The driver sources are compiled unchanged.
+ *
+ * Build in this directory with:
+ *   g++ -std=c++17 -O2 -pthread -I../../Common -I../../EKS -I../../iDTRONIC Benchmark.cpp DiscoveryBenchmark.cpp
+ *       EKSBenchmark.cpp EKSSimulator.cpp IDTRONICBenchmark.cpp IDTRONICSimulator.cpp PtySimulator.cpp
+ *       ReplayTransport.cpp
+ *       ../../Common/AsyncQueue.cpp ../../Common/CardEventQueue.cpp ../../Common/CardMonitor.cpp
+ *       ../../Common/CtsWatcher.cpp ../../Common/FrameCapture.cpp ../../Common/ReaderDiscovery.cpp
+ *       ../../Common/RetryPolicy.cpp ../../Common/RttEstimator.cpp ../../Common/SerialPort.cpp
+ *       ../../Common/StatsCollector.cpp ../../Common/TurnaroundScheduler.cpp
+ *       ../../EKS/EKS.cpp ../../EKS/EKSLink.cpp ../../EKS/KeyCache.cpp ../../iDTRONIC/BusScheduler.cpp
+ *       -o ReaderBenchmark
+ *
+ * Usage: ReaderBenchmark [-n iterations] [-b baud rate] [-d response delay in us] [eks] [idtronic] [discovery]
+ * A baud rate of 0 disables pacing and measures the driver overhead only. The
+ * "replay" lines play a session recorded with the simulator back through
+ * ReplayTransport, which needs no line at all. The exit code is 1 if a command
+ * failed or returned wrong data. */
+#include "Benchmark.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <time.h>
+#include <vector>
+
+static std::mutex eventMutex;
+static std::condition_variable eventQueued;
+static std::deque<DWORD> events;
+
+static double threadCpuMicroseconds()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Nearest-rank percentile of sorted latencies */
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+    rank = rank < 1 ? 1 : (rank > sorted.size() ? sorted.size() : rank);
+    return sorted[rank - 1];
+}
+
+void Benchmark::printHeader() const
+{
+    printf("%-28s %7s %5s %9s %9s %9s %9s %9s %12s\n", "command", "n", "fail", "p50 us", "p90 us", "p99 us", "max us",
+           "cmd/s", "cpu us/cmd");
+}
+
+void Benchmark::error(const char* message)
+{
+    fprintf(stderr, "%s\n", message);
+    failures++;
+}
+
+void __stdcall recordCardEvent(DWORD event, const BYTE* /* uid */, DWORD /* uidLength */, ULONGLONG /* timestamp */)
+{
+    std::lock_guard<std::mutex> lock(eventMutex);
+    events.push_back(event);
+    eventQueued.notify_all();
+}
+
+bool waitForCardEvent(CardEvent event, Clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(eventMutex);
+
+    for (;;)
+    {
+        while (!events.empty())
+        {
+            const DWORD next = events.front();
+            events.pop_front();
+
+            if (next == (DWORD)event)
+            {
+                return true;
+            }
+        }
+
+        if (eventQueued.wait_until(lock, deadline) == std::cv_status::timeout && events.empty())
+        {
+            return false;
+        }
+    }
+}
+
+long countCapturedFrames(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        return -1;
+    }
+
+    DWORD header[6];
+    DWORD packet[4];
+    long frames = -1;
+
+    if (fread(header, sizeof(header), 1, file) == 1 && header[0] == 0xA1B23C4D)
+    {
+        frames = 0;
+
+        while (fread(packet, sizeof(packet), 1, file) == 1 && fseek(file, packet[2], SEEK_CUR) == 0)
+        {
+            frames++;
+        }
+    }
+
+    fclose(file);
+    return frames;
+}
+
+void Benchmark::run(const char* name, const std::function<bool()>& command, size_t iterations)
+{
+    iterations = std::min(iterations, options.iterations);
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    size_t failed = 0;
+
+    /* The simulator runs on its own thread, so the thread CPU time is the time spent in the driver */
+    const double cpuStart = threadCpuMicroseconds();
+    const Clock::time_point start = Clock::now();
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        const Clock::time_point before = Clock::now();
+
+        if (!command())
+        {
+            failed++;
+        }
+
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - before).count());
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const double cpu = threadCpuMicroseconds() - cpuStart;
+    failures += failed;
+
+    if (latencies.empty())
+    {
+        return;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-28s %7zu %5zu %9.1f %9.1f %9.1f %9.1f %9.1f %12.2f\n", name, latencies.size(), failed,
+           percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), latencies.back(),
+           latencies.size() / seconds, cpu / latencies.size());
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    bool eks = false;
+    bool idtronic = false;
+    bool discovery = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "eks"))
+        {
+            eks = true;
+        }
+        else if (!strcmp(argv[i], "idtronic"))
+        {
+            idtronic = true;
+        }
+        else if (!strcmp(argv[i], "discovery"))
+        {
+            discovery = true;
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            options.iterations = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+        {
+            options.timing.baudRate = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+        {
+            options.timing.responseDelay = std::chrono::microseconds(strtoul(argv[++i], nullptr, 10));
+        }
+        else
+        {
+            fprintf(stderr,
+                    "Usage: %s [-n iterations] [-b baud rate] [-d response delay in us] [eks] [idtronic] [discovery]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (!eks && !idtronic && !discovery)
+    {
+        eks = idtronic = discovery = true;
+    }
+
+    printf("%zu iterations, %u baud, %lld us response delay\n", options.iterations, options.timing.baudRate,
+           (long long)options.timing.responseDelay.count());
+
+    Benchmark benchmark(options);
+    benchmark.printHeader();
+
+    if (eks)
+    {
+        runEKSBenchmarks(benchmark);
+    }
+
+    if (idtronic)
+    {
+        runIDTRONICBenchmarks(benchmark);
+    }
+
+    if (discovery)
+    {
+        runDiscoveryBenchmarks(benchmark);
+    }
+
+    return benchmark.passed() ? 0 : 1;
+}
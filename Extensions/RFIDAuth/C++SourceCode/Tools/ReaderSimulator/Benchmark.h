@@ -0,0 +1,49 @@
+#pragma once
+#include "CardMonitor.h"
+#include "PtySimulator.h"
+#include <cstdint>
+#include <functional>
+
+struct BenchmarkOptions
+{
+    size_t iterations = 1000;
+    SimulatorTiming timing;
+};
+
+/* Measures the round-trip latency and CPU time of driver calls */
+class Benchmark
+{
+   public:
+    const BenchmarkOptions options;
+
+    explicit Benchmark(const BenchmarkOptions& options) : options(options) {}
+
+    /* Call command options.iterations times, or iterations times if that is
+     * less, and print one line of results. command returns false if the call
+     * failed or returned wrong data. */
+    void run(const char* name, const std::function<bool()>& command, size_t iterations = SIZE_MAX);
+    /* Print the column headers */
+    void printHeader() const;
+    /* Report a setup error, it counts as a failed command */
+    void error(const char* message);
+    /* True if every command so far returned true */
+    bool passed() const { return failures == 0; }
+
+   private:
+    size_t failures = 0;
+};
+
+/* Callback for the card monitors of the drivers. The callback has no context,
+ * so the events of all monitors go to one queue. */
+void __stdcall recordCardEvent(DWORD event, const BYTE* uid, DWORD uidLength, ULONGLONG timestamp);
+/* Wait until a monitor reported event. The events before it are dropped.
+ * Returns false if it was not reported before the deadline. */
+bool waitForCardEvent(CardEvent event, Clock::time_point deadline);
+/* Number of frames in a capture file written by FrameCapture, -1 if it is no capture */
+long countCapturedFrames(const char* path);
+
+/* Run the EKS and iDTRONIC drivers against their simulators */
+void runEKSBenchmarks(Benchmark& benchmark);
+void runIDTRONICBenchmarks(Benchmark& benchmark);
+/* Discover simulated readers among idle ports */
+void runDiscoveryBenchmarks(Benchmark& benchmark);
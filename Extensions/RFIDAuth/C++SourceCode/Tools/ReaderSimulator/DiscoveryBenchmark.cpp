@@ -0,0 +1,114 @@
+#include "Benchmark.h"
+#include "EKSSimulator.h"
+#include "IDTRONICSimulator.h"
+#include "ReaderDiscovery.h"
+#include <memory>
+#include <vector>
+
+/* A Baltech reader in autoread mode that has a card presented whenever the
+ * host sends something, so it is recognized while the port is probed */
+class AutoreadSimulator : public PtySimulator
+{
+   protected:
+    void serve() override
+    {
+        static const char line[] = "C4B3A104\r";
+        BYTE b;
+
+        while (readByte(b))
+        {
+            send((const BYTE*)line, sizeof(line) - 1);
+        }
+    }
+};
+
+void runDiscoveryBenchmarks(Benchmark& benchmark)
+{
+    /* Discovery always probes at 9600 baud */
+    SimulatorTiming timing = benchmark.options.timing;
+    timing.baudRate = timing.baudRate ? 9600 : 0;
+
+    IDTRONICSimulator idtronic(0x05);
+    EKSSimulator eks;
+    AutoreadSimulator baltech;
+    /* Ports without a reader, the iDTRONIC simulators ignore every request */
+    std::vector<std::unique_ptr<IDTRONICSimulator>> idle;
+
+    for (int i = 0; i < 16; i++)
+    {
+        idle.emplace_back(new IDTRONICSimulator());
+        idle.back()->loseReplies(SIZE_MAX);
+    }
+
+    bool started = idtronic.start(timing) && eks.start(timing) && baltech.start(timing);
+
+    for (auto& simulator : idle)
+    {
+        started = started && simulator->start(timing);
+    }
+
+    if (!started)
+    {
+        benchmark.error("Could not open the pseudo-terminals for the discovery");
+        return;
+    }
+
+    std::vector<std::string> devices{idtronic.devicePath(), eks.devicePath(), baltech.devicePath()};
+
+    for (auto& simulator : idle)
+    {
+        devices.push_back(simulator->devicePath());
+    }
+
+    std::vector<DiscoveredReader> readers;
+    auto resetLines = [&]
+    {
+        idtronic.resetLine();
+        eks.resetLine();
+        baltech.resetLine();
+
+        for (auto& simulator : idle)
+        {
+            simulator->resetLine();
+        }
+    };
+
+    /* All 19 ports are probed at once, so this takes about one probe of an idle port */
+    benchmark.run(
+        "discover 3 readers, 19 ports",
+        [&]
+        {
+            resetLines();
+            ReaderDiscovery::probe(devices, readers);
+
+            for (size_t i = 3; i < readers.size(); i++)
+            {
+                if (readers[i].type != (DWORD)ReaderType::NONE)
+                {
+                    return false;
+                }
+            }
+
+            return readers[0].type == (DWORD)ReaderType::IDTRONIC && readers[0].address == 0x05 &&
+                   readers[1].type == (DWORD)ReaderType::EKS && readers[2].type == (DWORD)ReaderType::BALTECH;
+        },
+        20);
+
+    /* The reader known from the last start answers the first probe */
+    benchmark.run("discover known iDTRONIC port",
+                  [&]
+                  {
+                      DWORD address = 0;
+                      return ReaderDiscovery::probe(idtronic.devicePath(), ReaderType::IDTRONIC, address) ==
+                                 ReaderType::IDTRONIC &&
+                             address == 0x05;
+                  });
+
+    benchmark.run("discover known EKS port",
+                  [&]
+                  {
+                      DWORD address = 0;
+                      eks.resetLine();
+                      return ReaderDiscovery::probe(eks.devicePath(), ReaderType::EKS, address) == ReaderType::EKS;
+                  });
+}
@@ -0,0 +1,311 @@
+#include "Benchmark.h"
+#include "EKS.h"
+#include "EKSSimulator.h"
+#include "ReplayTransport.h"
+#include <cstdio>
+#include <cstring>
+
+/* The commands of a recorded session, serial is the expected serial number and image the expected key memory */
+static bool readKey(HANDLE pCom, const BYTE* serial, const std::vector<BYTE>& image)
+{
+    BYTE buffer[EKSSimulator::KeySize];
+    return GetSerialNumber(pCom, buffer) == (DWORD)ResponseCode::SUCCESS && !memcmp(buffer, serial, 8) &&
+           ReadKeyImage(pCom, 0, sizeof(buffer), buffer) == (DWORD)ResponseCode::SUCCESS &&
+           !memcmp(buffer, image.data(), sizeof(buffer));
+}
+
+/* Record a session with the simulator and replay it without a line */
+static void runEKSReplay(Benchmark& benchmark, EKSSimulator& simulator)
+{
+    const char* path = "/tmp/EKSReplay.pcap";
+    const std::vector<BYTE> image = simulator.keyImage();
+    const BYTE* serial = &image[EKSSimulator::SerialNumberOffset];
+    std::unique_ptr<SimulatorPort> port(new SimulatorPort(simulator));
+    simulator.resetLine();
+
+    if (!port->open(simulator.devicePath(), 9600, Parity::EVEN))
+    {
+        benchmark.error("Could not open the EKS simulator for the recording");
+        return;
+    }
+
+    EKSSession* recorder = new EKSSession();
+    recorder->port = std::move(port);
+    const bool recorded = readKey(recorder, serial, image) && DumpFrameCapture(recorder, path) == (DWORD)ResponseCode::SUCCESS;
+    CloseComm(recorder);
+    ReplayTransport* fast = new ReplayTransport(ReplayPacing::FAST);
+    ReplayTransport* split = new ReplayTransport(ReplayPacing::FAST);
+    ReplayTransport* original = new ReplayTransport(ReplayPacing::ORIGINAL, 11);
+
+    if (!recorded || !fast->load(path) || !split->load(path) || !original->load(path))
+    {
+        benchmark.error("Could not record the EKS session");
+        return;
+    }
+
+    remove(path);
+    split->splitReplies(1);
+
+    auto replay = [&](const char* name, ReplayTransport* transport, size_t iterations)
+    {
+        EKSSession* session = new EKSSession();
+        session->port.reset(transport);
+
+        benchmark.run(
+            name,
+            [&]
+            {
+                transport->rewind();
+                return readKey(session, serial, image) && transport->finished() &&
+                       transport->divergence() == SIZE_MAX;
+            },
+            iterations);
+
+        CloseComm(session);
+    };
+
+    /* Only the driver's parsing and handshake code is measured */
+    replay("EKS replay serial + image", fast, SIZE_MAX);
+    /* Every byte of the responses arrives with its own read */
+    replay("EKS replay split responses", split, SIZE_MAX);
+    replay("EKS replay original timing", original, 10);
+}
+
+void runEKSBenchmarks(Benchmark& benchmark)
+{
+    EKSSimulator simulator;
+    SimulatorTiming timing = benchmark.options.timing;
+    timing.bitsPerByte = 11;  // 8E1
+
+    if (!simulator.start(timing))
+    {
+        benchmark.error("Could not open a pseudo-terminal for the EKS simulator");
+        return;
+    }
+
+    BYTE image[EKSSimulator::KeySize];
+
+    for (size_t i = 0; i < sizeof(image); i++)
+    {
+        image[i] = (BYTE)(i * 7);
+    }
+
+    simulator.insertKey(image);
+
+    /* OpenComm only knows numbered ports, so the session is set up like OpenComm does it */
+    std::unique_ptr<SimulatorPort> port(new SimulatorPort(simulator));
+
+    if (!port->open(simulator.devicePath(), 9600, Parity::EVEN))
+    {
+        benchmark.error("Could not open the EKS simulator");
+        return;
+    }
+
+    EKSSession* session = new EKSSession();
+    session->port = std::move(port);
+    HANDLE pCom = session;
+    BYTE buffer[256];
+
+    benchmark.run("EKS GetKeyStatus", [&] { return GetKeyStatus(pCom) == (DWORD)ResponseCode::SUCCESS; });
+
+    benchmark.run("EKS GetSerialNumber",
+                  [&]
+                  {
+                      return GetSerialNumber(pCom, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, &image[EKSSimulator::SerialNumberOffset], 8);
+                  });
+
+    benchmark.run("EKS ReadKeyData 100 bytes",
+                  [&]
+                  {
+                      return ReadKeyData(pCom, 0, 100, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, image, 100);
+                  });
+
+    /* Offset and length equal DLE, so both are doubled in the request and the length byte of the response is as well */
+    benchmark.run("EKS ReadKeyData at DLE",
+                  [&]
+                  {
+                      return ReadKeyData(pCom, DLE, DLE, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, &image[DLE], DLE);
+                  });
+
+    benchmark.run("EKS ReadKeyImage whole key",
+                  [&]
+                  {
+                      return ReadKeyImage(pCom, 0, sizeof(image), buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, image, sizeof(image));
+                  });
+
+    /* Everything but the serial number is cached. The benchmark queries CTS
+     * often enough for the inserted key to stay known between two reads. */
+    const BYTE cachedRanges[]{0, (BYTE)EKSSimulator::SerialNumberOffset};
+    ConfigureKeyCache(pCom, cachedRanges, 1, 60000);
+    ReadKeyData(pCom, 0, 100, buffer);
+
+    benchmark.run("EKS ReadKeyData 100 cached",
+                  [&]
+                  {
+                      return ReadKeyData(pCom, 0, 100, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, image, 100);
+                  });
+
+    /* A key inserted again costs the read of its serial number only */
+    benchmark.run("EKS reinsert + ReadKeyData",
+                  [&]
+                  {
+                      simulator.removeKey();
+                      GetKeyStatus(pCom);
+                      simulator.insertKey(image);
+                      return ReadKeyData(pCom, 0, 100, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, image, 100);
+                  });
+
+    ConfigureKeyCache(pCom, nullptr, 0, 0);
+
+    /* 64 bytes at offset 8 take five write commands: 8, 16, 16, 16 and 8 bytes */
+    BYTE profile[64];
+
+    for (size_t i = 0; i < sizeof(profile); i++)
+    {
+        profile[i] = (BYTE)(i % 4 ? i : DLE);
+    }
+
+    /* The closing DLE of every command but the last reached the reader before the next command started */
+    benchmark.run("EKS WriteKeyData 64 bytes",
+                  [&]
+                  {
+                      const size_t requests = simulator.requests();
+                      return WriteKeyData(pCom, 8, sizeof(profile), profile) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(&simulator.keyImage()[8], profile, sizeof(profile)) &&
+                             simulator.requests() - requests >= 4;
+                  });
+
+    benchmark.run("EKS WriteKeyData 64 verified",
+                  [&] { return WriteKeyData(pCom, 8, sizeof(profile), profile, TRUE) == (DWORD)ResponseCode::SUCCESS; });
+
+    simulator.setWriteProtected(true);
+
+    benchmark.run("EKS WriteKeyData protected",
+                  [&]
+                  {
+                      return WriteKeyData(pCom, 8, sizeof(profile), profile) ==
+                             (DWORD)ResponseCode::ERR_WRITE_PROTECTED;
+                  });
+
+    /* A lost reply costs the estimated reply time and a backoff instead of the fixed timeout */
+    benchmark.run("EKS lost reply",
+                  [&]
+                  {
+                      simulator.loseReplies(1);
+                      return ReadKeyData(pCom, 0, 100, buffer) == (DWORD)ResponseCode::SUCCESS;
+                  });
+
+    /* A corrupted response is NAKed and repeated by the reader, the command is not sent again */
+    benchmark.run("EKS corrupted response",
+                  [&]
+                  {
+                      simulator.corruptReplies(1);
+                      return ReadKeyData(pCom, 0, 100, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, &simulator.keyImage()[0], 100);
+                  });
+
+    /* The frame of the reader is received and acknowledged before the command is started again */
+    benchmark.run("EKS STX collision",
+                  [&]
+                  {
+                      simulator.collideNextRequest();
+                      return ReadKeyData(pCom, 0, 100, buffer) == (DWORD)ResponseCode::SUCCESS &&
+                             !memcmp(buffer, &simulator.keyImage()[0], 100);
+                  });
+
+    /* The lost and the corrupted reply above are counted with the read command */
+    SessionStats stats{};
+    CommandStats commands[4];
+
+    benchmark.run("EKS GetStats",
+                  [&]
+                  {
+                      DWORD count = 0;
+
+                      if (GetStats(pCom, &stats, commands, 4, &count) != (DWORD)ResponseCode::SUCCESS)
+                      {
+                          return false;
+                      }
+
+                      for (DWORD i = 0; i < count; i++)
+                      {
+                          if (commands[i].command == CMD_READ)
+                          {
+                              return commands[i].timeouts > 0 && commands[i].checksumErrors > 0 &&
+                                     stats.line.bytesSent > 0 && stats.line.bytesReceived > 0;
+                          }
+                      }
+
+                      return false;
+                  });
+
+    /* Recording is on the path of every byte sent and received */
+    std::unique_ptr<FrameCapture> capture(new FrameCapture());
+
+    benchmark.run("FrameCapture record 16 bytes",
+                  [&]
+                  {
+                      capture->record(FrameDirection::SENT, buffer, 16);
+                      return true;
+                  });
+
+    /* Every handshake byte and frame of the commands above, up to the size of the ring */
+    benchmark.run("EKS DumpFrameCapture",
+                  [&]
+                  {
+                      const char* path = "/tmp/EKSCapture.pcap";
+                      const bool dumped = DumpFrameCapture(pCom, path) == (DWORD)ResponseCode::SUCCESS;
+                      const long frames = countCapturedFrames(path);
+                      remove(path);
+                      return dumped && frames > 0 && frames <= (long)FrameCapture::Slots;
+                  });
+
+    runEKSReplay(benchmark, simulator);
+
+    /* Time from a CTS change to the queued event, for both edges */
+    LineEvent events[4];
+    DWORD count = 0;
+    StartKeyWatcher(pCom);
+
+    benchmark.run("EKS remove + insert events",
+                  [&]
+                  {
+                      simulator.removeKey();
+                      bool removed = GetKeyEvents(pCom, events, 4, 1000, &count) == (DWORD)ResponseCode::SUCCESS &&
+                                     count == 1 && events[0].event == (DWORD)CardEvent::REMOVED;
+                      simulator.insertKey(image);
+                      return removed &&
+                             GetKeyEvents(pCom, events, 4, 1000, &count) == (DWORD)ResponseCode::SUCCESS &&
+                             count == 1 && events[0].event == (DWORD)CardEvent::INSERTED;
+                  });
+
+    /* The monitor reopens the port once the adapter is back and starts the watcher again */
+    StartKeyMonitor(pCom, recordCardEvent, 10);
+    waitForCardEvent(CardEvent::INSERTED, Clock::now() + std::chrono::seconds(1));
+
+    benchmark.run(
+        "EKS unplug + reconnect",
+        [&]
+        {
+            simulator.unplug();
+            const bool lost = waitForCardEvent(CardEvent::CONNECTION_LOST, Clock::now() + std::chrono::seconds(5));
+            simulator.plugIn();
+            return lost && waitForCardEvent(CardEvent::CONNECTION_RESTORED, Clock::now() + std::chrono::seconds(1));
+        },
+        10);
+
+    StopKeyMonitor(pCom);
+    StopKeyWatcher(pCom);
+    simulator.removeKey();
+
+    benchmark.run("EKS GetSerialNumber no key",
+                  [&] { return GetSerialNumber(pCom, buffer) == (DWORD)ResponseCode::ERR_NO_KEY_DETECTED; });
+
+    CloseComm(pCom);
+}
@@ -0,0 +1,256 @@
+#include "EKSSimulator.h"
+#include <algorithm>
+
+static constexpr BYTE STX = 0x02;
+static constexpr BYTE ETX = 0x03;
+static constexpr BYTE DLE = 0x10;
+static constexpr BYTE NAK = 0x15;
+
+static constexpr BYTE CMD_SEND = 0x54;
+static constexpr BYTE CMD_RESPONSE = 0x52;
+static constexpr BYTE CMD_WRITE = 0x50;
+static constexpr BYTE CMD_READ = 0x4C;
+static constexpr BYTE CMD_RES_STATUS = 0x46;
+
+static constexpr BYTE STATUS_SUCCESS = 0x00;
+static constexpr BYTE STATUS_NO_KEY_DETECTED = 0x02;
+static constexpr BYTE STATUS_WRITE_BLOCKSIZE = 0x06;
+static constexpr BYTE STATUS_UNKNOWN = 0x40;
+static constexpr BYTE STATUS_WRITE_PROTECTED = 0x50;
+
+/* Repetitions of a NAKed response, as for 3964R */
+static constexpr size_t MaxRepeats = 6;
+
+void EKSSimulator::insertKey(const BYTE* image)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    key.assign(image, image + KeySize);
+    setCts(true);
+}
+
+void EKSSimulator::removeKey()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    key.clear();
+    setCts(false);
+}
+
+std::vector<BYTE> EKSSimulator::keyImage()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return key;
+}
+
+void EKSSimulator::setWriteProtected(bool writeProtected)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->writeProtected = writeProtected;
+}
+
+bool EKSSimulator::expect(BYTE expected)
+{
+    BYTE b;
+    return readByte(b) && b == expected;
+}
+
+bool EKSSimulator::receiveFrame(std::vector<BYTE>& body)
+{
+    BYTE bcc = 0x00;
+    BYTE b;
+
+    for (;;)
+    {
+        if (!readByte(b))
+        {
+            return false;
+        }
+
+        if (b != DLE)
+        {
+            body.push_back(b);
+            bcc ^= b;
+            continue;
+        }
+
+        if (!readByte(b))
+        {
+            return false;
+        }
+
+        if (b == DLE)
+        {
+            body.push_back(DLE);
+            bcc ^= DLE;
+        }
+        else if (b == ETX)
+        {
+            bcc ^= DLE ^ ETX;
+            return readByte(b) && b == bcc;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+void EKSSimulator::sendFrame(const std::vector<BYTE>& body)
+{
+    std::vector<BYTE> frame;
+    BYTE bcc = 0x00;
+
+    for (BYTE b : body)
+    {
+        if (b == DLE)
+        {
+            frame.push_back(DLE);
+        }
+
+        frame.push_back(b);
+        bcc ^= b;
+    }
+
+    frame.push_back(DLE);
+    frame.push_back(ETX);
+    frame.push_back(bcc ^ DLE ^ ETX ^ (takeCorruptedReply() ? 0x01 : 0x00));
+    send(frame.data(), frame.size());
+}
+
+std::vector<BYTE> EKSSimulator::execute(const std::vector<BYTE>& request)
+{
+    BYTE status = STATUS_UNKNOWN;
+
+    if (request.size() < 7 || request[0] != request.size() || request[1] != CMD_SEND)
+    {
+        return {0x07, CMD_RESPONSE, CMD_RES_STATUS, 0x01, 0x00, 0x00, status};
+    }
+
+    const size_t start = request[5];
+    const size_t length = request[6];
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (key.empty())
+    {
+        status = STATUS_NO_KEY_DETECTED;
+    }
+    else if (request[2] == CMD_READ && start + length <= KeySize && 7 + length <= 0xFF)
+    {
+        std::vector<BYTE> response{(BYTE)(7 + length), CMD_RESPONSE, CMD_READ, 0x01, 0x00, (BYTE)start,
+                                   (BYTE)length};
+        response.insert(response.end(), key.begin() + start, key.begin() + start + length);
+        return response;
+    }
+    else if (request[2] == CMD_WRITE && request.size() == 7 + length && start + length <= KeySize)
+    {
+        if (writeProtected)
+        {
+            status = STATUS_WRITE_PROTECTED;
+        }
+        else if (length == 0 || start / WriteBlockSize != (start + length - 1) / WriteBlockSize)
+        {
+            status = STATUS_WRITE_BLOCKSIZE;
+        }
+        else
+        {
+            std::copy(request.begin() + 7, request.end(), key.begin() + start);
+            status = STATUS_SUCCESS;
+        }
+    }
+
+    return {0x07, CMD_RESPONSE, CMD_RES_STATUS, 0x01, 0x00, 0x00, status};
+}
+
+void EKSSimulator::serve()
+{
+    BYTE b;
+    bool pending = false;
+
+    while (pending || readByte(b))
+    {
+        pending = false;
+
+        /* Everything but a request to send is line noise */
+        if (b != STX || takeLostReply())
+        {
+            continue;
+        }
+
+        awaitResponseTime();
+
+        /* The driver yields: it acknowledges the frame of the reader and sends its STX again */
+        if (collision.exchange(false))
+        {
+            send(&STX, 1);
+
+            if (expect(DLE))
+            {
+                sendFrame({0x07, CMD_RESPONSE, CMD_RES_STATUS, 0x01, 0x00, 0x00, STATUS_UNKNOWN});
+                expect(DLE);
+            }
+
+            continue;
+        }
+
+        send(&DLE, 1);
+
+        std::vector<BYTE> request;
+
+        if (!receiveFrame(request))
+        {
+            send(&NAK, 1);
+            continue;
+        }
+
+        /* Acknowledge the request and ask to send the response */
+        awaitResponseTime();
+        const BYTE handover[]{DLE, STX};
+        send(handover, sizeof(handover));
+
+        if (!expect(DLE))
+        {
+            continue;
+        }
+
+        const std::vector<BYTE> response = execute(request);
+        sendFrame(response);
+        bool repeated = true;
+
+        /* A NAKed response is announced with STX and sent again */
+        for (size_t repeats = 0; repeated; repeats++)
+        {
+            if (!readByte(b))
+            {
+                return;
+            }
+
+            if (b != NAK || repeats == MaxRepeats)
+            {
+                break;
+            }
+
+            send(&STX, 1);
+            repeated = expect(DLE);
+
+            if (repeated)
+            {
+                sendFrame(response);
+            }
+        }
+
+        /* The driver did not accept the repetition */
+        if (!repeated)
+        {
+            continue;
+        }
+
+        /* Without the closing DLE, the byte may be the STX of the next request */
+        if (b == DLE)
+        {
+            requestCount++;
+        }
+        else
+        {
+            pending = true;
+        }
+    }
+}
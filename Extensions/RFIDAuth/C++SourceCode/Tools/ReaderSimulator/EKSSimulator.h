@@ -0,0 +1,44 @@
+#pragma once
+#include "PtySimulator.h"
+#include <mutex>
+#include <vector>
+
+/* Simulates an EKS reader. Every exchange is STX/DLE handshaked in both
+ * directions and framed with DLE ETX BCC, DLEs in a frame are doubled. A NAK
+ * for a response makes the reader repeat it. CTS is high while a key is
+ * inserted. */
+class EKSSimulator : public PtySimulator
+{
+   public:
+    /* Size of the memory of a simulated key. The serial number is stored at SerialNumberOffset. */
+    static constexpr size_t KeySize = 128;
+    static constexpr size_t SerialNumberOffset = 116;
+    /* A write must not cross the boundary of a block */
+    static constexpr size_t WriteBlockSize = 16;
+
+    /* Insert a key with KeySize bytes of memory */
+    void insertKey(const BYTE* image);
+    void removeKey();
+    /* The memory of the inserted key, including all writes */
+    std::vector<BYTE> keyImage();
+    void setWriteProtected(bool writeProtected);
+    /* Number of requests answered so far whose response was acknowledged */
+    size_t requests() const { return requestCount; }
+    /* Answer the STX of the next request with an STX and a frame of the reader, as if both started to send at once */
+    void collideNextRequest() { collision = true; }
+
+   protected:
+    void serve() override;
+
+   private:
+    std::mutex mutex;
+    std::vector<BYTE> key;
+    bool writeProtected = false;
+    std::atomic<size_t> requestCount{0};
+    std::atomic<bool> collision{false};
+
+    bool expect(BYTE expected);
+    bool receiveFrame(std::vector<BYTE>& body);
+    void sendFrame(const std::vector<BYTE>& body);
+    std::vector<BYTE> execute(const std::vector<BYTE>& request);
+};
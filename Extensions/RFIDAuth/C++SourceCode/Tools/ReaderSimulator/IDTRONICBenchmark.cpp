@@ -0,0 +1,440 @@
+#include "Benchmark.h"
+#include "IDTRONICSimulator.h"
+#include "ReplayTransport.h"
+
+/* RFIDSession is private to the driver, so the driver is compiled into this file */
+#include "RFID.cpp"
+
+/* The commands of a recorded session, Expected holds the 64 bytes of blocks 4 to 7 */
+static bool ReadCard(HANDLE commHandle, const BYTE* Uid, size_t UidLength, const unsigned char* Expected)
+{
+    unsigned char key[6]{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    unsigned char Buffer[MaxBufferSize];
+    return API_MF_GET_SNR(commHandle, 0x00, 0x26, 0x00, Buffer) == 0 && !memcmp(&Buffer[2], Uid, UidLength) &&
+           API_MF_Read(commHandle, 0x00, 0x00, 4, 4, key, Buffer) == 0 && !memcmp(&Buffer[1], Expected, 64);
+}
+
+/* Drain the queued card events until event arrives. The events before it are dropped. */
+static bool DrainUntil(HANDLE commHandle, CardEvent event, Clock::time_point deadline, QueuedCardEvent& found)
+{
+    QueuedCardEvent Events[16];
+    int Count = 0;
+    int Dropped = 0;
+
+    while (Clock::now() < deadline)
+    {
+        if (API_DrainCardEvents(commHandle, Events, 16, &Count, &Dropped) != 0 || Dropped != 0)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < Count; i++)
+        {
+            if (Events[i].event == (DWORD)event)
+            {
+                found = Events[i];
+                return true;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return false;
+}
+
+/* The ring between a monitor thread and the drain of the JS thread */
+static void runCardEventQueue(Benchmark& benchmark)
+{
+    const BYTE uid[]{0x04, 0xA1, 0xB3, 0xC4};
+    std::unique_ptr<CardEventQueue> queue(new CardEventQueue());
+    QueuedCardEvent events[CardEventQueue::Capacity];
+    DWORD lost = 0;
+
+    benchmark.run("CardEventQueue push + drain",
+                  [&]
+                  {
+                      queue->push(CardEvent::INSERTED, uid, sizeof(uid), 1);
+                      return queue->drain(events, CardEventQueue::Capacity, lost) == 1 && lost == 0;
+                  });
+
+    /* A burst of swaps while the consumer drains, every event arrives in order or is counted as dropped */
+    benchmark.run(
+        "CardEventQueue burst 2 thr",
+        [&]
+        {
+            const ULONGLONG burst = 10000;
+            std::atomic<bool> done{false};
+            std::thread producer(
+                [&]
+                {
+                    for (ULONGLONG i = 1; i <= burst; i++)
+                    {
+                        queue->push(i % 2 ? CardEvent::INSERTED : CardEvent::REMOVED, uid, sizeof(uid), i);
+                    }
+
+                    done = true;
+                });
+
+            ULONGLONG received = 0;
+            ULONGLONG dropped = 0;
+            ULONGLONG last = 0;
+            bool ordered = true;
+
+            for (bool finished = false; !finished;)
+            {
+                finished = done;
+                const size_t count = queue->drain(events, CardEventQueue::Capacity, lost);
+                dropped += lost;
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    ordered = ordered && events[i].timestamp > last &&
+                              events[i].event == (DWORD)(events[i].timestamp % 2 ? CardEvent::INSERTED
+                                                                                  : CardEvent::REMOVED);
+                    last = events[i].timestamp;
+                }
+
+                received += count;
+            }
+
+            producer.join();
+            return ordered && received + dropped == burst && last <= burst;
+        },
+        100);
+}
+
+/* Record a session with the simulator and replay it without a line */
+static void runIDTRONICReplay(Benchmark& benchmark, IDTRONICSimulator& simulator, const BYTE* uid, size_t uidLength,
+                              unsigned int baudRate)
+{
+    const char* path = "/tmp/iDTRONICReplay.pcap";
+    const std::vector<BYTE> card = simulator.cardImage();
+    const unsigned char* blocks = &card[4 * BlockSize];
+    std::unique_ptr<SerialPort> port(new SimulatorPort(simulator));
+
+    if (!port->open(simulator.devicePath(), baudRate, Parity::NONE))
+    {
+        benchmark.error("Could not open the iDTRONIC simulator for the recording");
+        return;
+    }
+
+    RFIDSession* recorder = new RFIDSession();
+    recorder->port = std::move(port);
+    const bool recorded = ReadCard(recorder, uid, uidLength, blocks) && API_DumpFrameCapture(recorder, path) == 0;
+    API_CloseComm(recorder);
+    ReplayTransport* fast = new ReplayTransport(ReplayPacing::FAST);
+    ReplayTransport* original = new ReplayTransport(ReplayPacing::ORIGINAL);
+
+    if (!recorded || !fast->load(path) || !original->load(path))
+    {
+        benchmark.error("Could not record the iDTRONIC session");
+        return;
+    }
+
+    remove(path);
+    original->setBaudRate(baudRate);
+
+    auto replay = [&](const char* name, ReplayTransport* transport, size_t iterations)
+    {
+        RFIDSession* session = new RFIDSession();
+        session->port.reset(transport);
+
+        benchmark.run(
+            name,
+            [&]
+            {
+                transport->rewind();
+                return ReadCard(session, uid, uidLength, blocks) && transport->finished() &&
+                       transport->divergence() == SIZE_MAX;
+            },
+            iterations);
+
+        API_CloseComm(session);
+    };
+
+    /* Only the driver's framing and checksum code is measured */
+    replay("iDTRONIC replay SNR + read", fast, SIZE_MAX);
+    replay("iDTRONIC replay orig. timing", original, 10);
+}
+
+void runIDTRONICBenchmarks(Benchmark& benchmark)
+{
+    IDTRONICSimulator simulator;
+
+    if (!simulator.start(benchmark.options.timing))
+    {
+        benchmark.error("Could not open a pseudo-terminal for the iDTRONIC simulator");
+        return;
+    }
+
+    const BYTE uid[]{0x04, 0xA1, 0xB3, 0xC4};
+    simulator.insertCard(uid, sizeof(uid));
+
+    /* API_OpenComm only knows numbered ports, so the session is set up like API_OpenComm does it */
+    std::unique_ptr<SerialPort> port(new SimulatorPort(simulator));
+    const unsigned int baudRate = benchmark.options.timing.baudRate ? benchmark.options.timing.baudRate : 9600;
+
+    if (!port->open(simulator.devicePath(), baudRate, Parity::NONE))
+    {
+        benchmark.error("Could not open the iDTRONIC simulator");
+        return;
+    }
+
+    RFIDSession* session = new RFIDSession();
+    session->port = std::move(port);
+    HANDLE commHandle = session;
+
+    unsigned char key[6]{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    unsigned char data[4 * 16];
+    unsigned char Buffer[MaxBufferSize];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (unsigned char)(i ^ 0x5A);
+    }
+
+    benchmark.run("iDTRONIC MF_GET_SNR",
+                  [&]
+                  {
+                      return API_MF_GET_SNR(commHandle, 0x00, 0x26, 0x00, Buffer) == 0 &&
+                             Buffer[0] == sizeof(uid) + 1 && !memcmp(&Buffer[2], uid, sizeof(uid));
+                  });
+
+    /* A health check, spaced from the previous reply by the turnaround of the line only */
+    char version[MaxBufferSize]{};
+
+    benchmark.run("iDTRONIC GetVersionNum",
+                  [&]
+                  {
+                      return API_GetVersionNum(commHandle, 0x00, version) == 0 &&
+                             !strncmp(version, "IDTRONIC-SIM", 12);
+                  });
+
+    benchmark.run("iDTRONIC MF_Write 4 blocks",
+                  [&] { return API_MF_Write(commHandle, 0x00, 0x00, 4, 4, key, data, Buffer) == 0; });
+
+    benchmark.run("iDTRONIC MF_Read 1 block",
+                  [&]
+                  {
+                      return API_MF_Read(commHandle, 0x00, 0x00, 4, 1, key, Buffer) == 0 && Buffer[0] == 16 &&
+                             !memcmp(&Buffer[1], data, 16);
+                  });
+
+    benchmark.run("iDTRONIC MF_Read 4 blocks",
+                  [&]
+                  {
+                      return API_MF_Read(commHandle, 0x00, 0x00, 4, 4, key, Buffer) == 0 &&
+                             Buffer[0] == sizeof(data) && !memcmp(&Buffer[1], data, sizeof(data));
+                  });
+
+    /* A badge of three single blocks read command by command and as one profile, whose blocks share a command */
+    benchmark.run("iDTRONIC SNR + 3 x MF_Read",
+                  [&]
+                  {
+                      bool read = API_MF_GET_SNR(commHandle, 0x00, 0x26, 0x00, Buffer) == 0;
+
+                      for (int block = 4; block < 7 && read; block++)
+                      {
+                          read = API_MF_Read(commHandle, 0x00, 0x00, block, 1, key, Buffer) == 0 &&
+                                 !memcmp(&Buffer[1], &data[(block - 4) * 16], 16);
+                      }
+
+                      return read;
+                  });
+
+    const ProfileRange badge[]{{0x00, 4, 1, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}},
+                               {0x00, 5, 1, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}},
+                               {0x00, 6, 1, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}}};
+    CardProfile profile{};
+
+    benchmark.run("iDTRONIC ReadProfile 3 blk",
+                  [&]
+                  {
+                      return API_MF_ReadProfile(commHandle, 0x00, badge, 3, &profile, Buffer) == 0 &&
+                             profile.Commands == 2 && profile.UidLength == sizeof(uid) &&
+                             !memcmp(profile.Uid, uid, sizeof(uid)) && profile.DataTime >= profile.UidTime &&
+                             !memcmp(Buffer, data, 48);
+                  });
+
+    /* A whole Mifare 4K card: 32 sectors of 4 blocks and 8 sectors of 16 blocks */
+    simulator.insertCard(uid, sizeof(uid), IDTRONICSimulator::Card4KSize);
+    std::vector<unsigned char> image(IDTRONICSimulator::Card4KSize);
+    std::vector<unsigned char> dump(image.size());
+
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        image[i] = (unsigned char)(i * 13);
+    }
+
+    /* Sector trailers are not written by a range, so the image is compared without them */
+    auto sameData = [&]
+    {
+        for (int block = 0; block < 256; block++)
+        {
+            const bool trailer = block < 128 ? block % 4 == 3 : block % 16 == 15;
+
+            if (!trailer && memcmp(&dump[block * 16], &image[block * 16], 16))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    for (int sector = 0; sector < 40; sector++)
+    {
+        const int first = sector < 32 ? sector * 4 : 128 + (sector - 32) * 16;
+        const int count = sector < 32 ? 3 : 15;
+        API_MF_WriteRange(commHandle, 0x00, 0x00, first, count, key, &image[first * 16], Buffer);
+    }
+
+    benchmark.run("iDTRONIC MF_ReadRange 4K card",
+                  [&]
+                  { return API_MF_ReadRange(commHandle, 0x00, 0x00, 0, 256, key, dump.data()) == 0 && sameData(); });
+
+    benchmark.run("iDTRONIC MF_WriteRange 15 blk",
+                  [&] { return API_MF_WriteRange(commHandle, 0x00, 0x00, 128, 15, key, &image[128 * 16], Buffer) == 0; });
+
+    /* A corrupted reply is requested again at once */
+    benchmark.run("iDTRONIC corrupted reply",
+                  [&]
+                  {
+                      simulator.corruptReplies(1);
+                      return API_MF_Read(commHandle, 0x00, 0x00, 128, 4, key, Buffer) == 0 &&
+                             !memcmp(&Buffer[1], &image[128 * 16], 64);
+                  });
+
+    /* A lost reply costs the estimated reply time and a backoff instead of the fixed timeout */
+    benchmark.run("iDTRONIC lost reply",
+                  [&]
+                  {
+                      simulator.loseReplies(1);
+                      return API_MF_GET_SNR(commHandle, 0x00, 0x26, 0x00, Buffer) == 0;
+                  });
+
+    /* The corrupted and the lost reply above are counted with their commands */
+    SessionStats stats{};
+    CommandStats commands[16];
+
+    benchmark.run("iDTRONIC GetStats",
+                  [&]
+                  {
+                      int count = 0;
+                      DWORD timeouts = 0;
+                      DWORD checksumErrors = 0;
+
+                      if (API_GetStats(commHandle, &stats, commands, 16, &count) != 0)
+                      {
+                          return false;
+                      }
+
+                      for (int i = 0; i < count; i++)
+                      {
+                          timeouts += commands[i].timeouts;
+                          checksumErrors += commands[i].checksumErrors;
+                      }
+
+                      return count > 0 && timeouts > 0 && checksumErrors > 0 && stats.line.bytesSent > 0 &&
+                             stats.line.bytesReceived > 0;
+                  });
+
+    benchmark.run("iDTRONIC DumpFrameCapture",
+                  [&]
+                  {
+                      const char* path = "/tmp/iDTRONICCapture.pcap";
+                      const bool dumped = API_DumpFrameCapture(commHandle, path) == 0;
+                      const long frames = countCapturedFrames(path);
+                      remove(path);
+                      return dumped && frames > 0 && frames <= (long)FrameCapture::Slots;
+                  });
+
+    runIDTRONICReplay(benchmark, simulator, uid, sizeof(uid), baudRate);
+
+    /* The line is stable up to 57600 baud, so 115200 is tried and dropped again */
+    const unsigned int stableRate = std::max(baudRate, 57600u);
+    simulator.setMaxStableBaudRate(stableRate);
+    int negotiated = 0;
+
+    benchmark.run("iDTRONIC negotiate baud",
+                  [&]
+                  {
+                      return API_NegotiateBaudrate(commHandle, 0x00, 115200, &negotiated) == 0 &&
+                             negotiated == (int)stableRate && simulator.readerBaudRate() == stableRate;
+                  });
+
+    /* The line gets worse after the negotiation, the driver steps down on its own */
+    if (stableRate == 57600)
+    {
+        benchmark.run("iDTRONIC baud step-down",
+                      [&]
+                      {
+                          simulator.setMaxStableBaudRate(57600);
+
+                          if (API_NegotiateBaudrate(commHandle, 0x00, 115200, &negotiated) != 0)
+                          {
+                              return false;
+                          }
+
+                          simulator.setMaxStableBaudRate(38400);
+                          int Status = -1;
+
+                          for (int i = 0; i < 10 && Status != 0; i++)
+                          {
+                              Status = API_MF_GET_SNR(commHandle, 0x00, 0x26, 0x00, Buffer);
+                          }
+
+                          return Status == 0 && simulator.readerBaudRate() == 38400;
+                      });
+    }
+
+    runCardEventQueue(benchmark);
+
+    /* A monitor without callback queues the events, a swap of cards is a remove and an insert */
+    const BYTE otherUid[]{0x04, 0x5E, 0x6F, 0x70};
+    QueuedCardEvent event{};
+    API_StartCardMonitor(commHandle, 0x00, NULL, 0);
+    DrainUntil(commHandle, CardEvent::INSERTED, Clock::now() + std::chrono::seconds(1), event);
+
+    benchmark.run("iDTRONIC queued card swap",
+                  [&]
+                  {
+                      const bool first = event.uidLength == sizeof(uid) && !memcmp(event.uid, uid, sizeof(uid));
+                      const BYTE* next = first ? otherUid : uid;
+                      simulator.removeCard();
+                      const bool removed =
+                          DrainUntil(commHandle, CardEvent::REMOVED, Clock::now() + std::chrono::seconds(1), event);
+                      simulator.insertCard(next, sizeof(uid));
+                      return removed &&
+                             DrainUntil(commHandle, CardEvent::INSERTED, Clock::now() + std::chrono::seconds(1),
+                                        event) &&
+                             event.uidLength == sizeof(uid) && !memcmp(event.uid, next, sizeof(uid));
+                  });
+
+    API_StopCardMonitor(commHandle);
+    simulator.insertCard(uid, sizeof(uid));
+
+    /* The monitor reopens the port once the adapter is back, the card is read again but did not change */
+    API_StartCardMonitor(commHandle, 0x00, recordCardEvent, 20);
+    waitForCardEvent(CardEvent::INSERTED, Clock::now() + std::chrono::seconds(1));
+
+    benchmark.run(
+        "iDTRONIC unplug + reconnect",
+        [&]
+        {
+            simulator.unplug();
+            const bool lost = waitForCardEvent(CardEvent::CONNECTION_LOST, Clock::now() + std::chrono::seconds(5));
+            simulator.plugIn();
+            return lost && waitForCardEvent(CardEvent::CONNECTION_RESTORED, Clock::now() + std::chrono::seconds(1));
+        },
+        10);
+
+    API_StopCardMonitor(commHandle);
+    simulator.removeCard();
+
+    benchmark.run("iDTRONIC MF_GET_SNR no card",
+                  [&] { return API_MF_GET_SNR(commHandle, 0x00, 0x26, 0x00, Buffer) == 1; });
+
+    API_CloseComm(commHandle);
+}
@@ -0,0 +1,227 @@
+#include "IDTRONICSimulator.h"
+#include <cstring>
+
+static constexpr BYTE STX = 0xAA;
+static constexpr BYTE ETX = 0xBB;
+
+static constexpr BYTE CMD_MF_Read = 0x20;
+static constexpr BYTE CMD_MF_Write = 0x21;
+static constexpr BYTE CMD_MF_GET_SNR = 0x25;
+static constexpr BYTE CMD_SetBaudrate = 0x81;
+static constexpr BYTE CMD_GetSerialNum = 0x83;
+static constexpr BYTE CMD_GetVersionNum = 0x86;
+
+static constexpr BYTE STATUS_OK = 0x00;
+static constexpr BYTE STATUS_FAILED = 0x01;  // also "no card" for card commands
+
+/* Block size with a key (Mifare Classic) and page size without (Mifare Ultralight) */
+static constexpr size_t BlockSize = 16;
+static constexpr size_t PageSize = 4;
+static constexpr size_t KeySize = 6;
+
+/* Rates selected by the parameter of CMD_SetBaudrate */
+static constexpr unsigned int BaudRates[]{9600, 19200, 38400, 57600, 115200};
+
+void IDTRONICSimulator::insertCard(const BYTE* uid, size_t uidLength, size_t memorySize)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->uid.assign(uid, uid + uidLength);
+    memory.assign(memorySize, 0x00);
+}
+
+/* Sectors have 4 blocks, from block 128 on 16 blocks */
+static size_t sectorOf(size_t block) { return block < 128 ? block / 4 : 32 + (block - 128) / 16; }
+
+void IDTRONICSimulator::removeCard()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uid.clear();
+    memory.clear();
+}
+
+std::vector<BYTE> IDTRONICSimulator::cardImage()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return memory;
+}
+
+bool IDTRONICSimulator::receiveFrame(std::vector<BYTE>& frame)
+{
+    BYTE b;
+
+    do
+    {
+        if (!readByte(b))
+        {
+            return false;
+        }
+    } while (b != STX);
+
+    BYTE checkSum = 0x00;
+
+    /* Address and length */
+    for (int i = 0; i < 2; i++)
+    {
+        if (!readByte(b))
+        {
+            return false;
+        }
+
+        frame.push_back(b);
+        checkSum ^= b;
+    }
+
+    for (size_t i = 0; i < frame[1]; i++)
+    {
+        if (!readByte(b))
+        {
+            return false;
+        }
+
+        frame.push_back(b);
+        checkSum ^= b;
+    }
+
+    BYTE etx;
+    return readByte(b) && readByte(etx) && b == checkSum && etx == ETX && frame.size() >= 3;
+}
+
+void IDTRONICSimulator::sendFrame(BYTE frameAddress, BYTE status, const std::vector<BYTE>& data)
+{
+    std::vector<BYTE> frame{STX, frameAddress, (BYTE)(data.size() + 1), status};
+    frame.insert(frame.end(), data.begin(), data.end());
+
+    BYTE checkSum = 0x00;
+
+    for (size_t i = 1; i < frame.size(); i++)
+    {
+        checkSum ^= frame[i];
+    }
+
+    frame.push_back(checkSum ^ (takeCorruptedReply() || lineUnstable() ? 0x01 : 0x00));
+    frame.push_back(ETX);
+    send(frame.data(), frame.size());
+}
+
+BYTE IDTRONICSimulator::execute(BYTE command, const std::vector<BYTE>& parameters, std::vector<BYTE>& data)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    switch (command)
+    {
+        case CMD_MF_GET_SNR:
+            if (uid.empty())
+            {
+                break;
+            }
+
+            data.push_back(0x00);  // single card
+            data.insert(data.end(), uid.begin(), uid.end());
+            return STATUS_OK;
+
+        case CMD_MF_Read:
+        case CMD_MF_Write:
+        {
+            if (uid.empty() || parameters.size() < 3)
+            {
+                break;
+            }
+
+            /* mode, number of blocks, first block and an optional key */
+            const size_t count = parameters[1];
+            const bool keyed = command == CMD_MF_Read ? parameters.size() == 3 + KeySize
+                                                      : parameters.size() == 3 + KeySize + count * BlockSize;
+            const size_t unit = keyed ? BlockSize : PageSize;
+            const size_t offset = parameters[2] * unit;
+            /* Without key, a write carries a single page */
+            const size_t length = keyed || command == CMD_MF_Read ? count * unit : PageSize;
+
+            if (count == 0 || offset + length > memory.size() || length >= 0xFF)
+            {
+                break;
+            }
+
+            /* A key authenticates one sector */
+            if (keyed && sectorOf(parameters[2]) != sectorOf(parameters[2] + count - 1))
+            {
+                break;
+            }
+
+            if (command == CMD_MF_Read)
+            {
+                data.assign(memory.begin() + offset, memory.begin() + offset + length);
+                return STATUS_OK;
+            }
+
+            const size_t dataStart = keyed ? 3 + KeySize : 3;
+
+            if (parameters.size() < dataStart + length)
+            {
+                break;
+            }
+
+            memcpy(&memory[offset], &parameters[dataStart], length);
+            return STATUS_OK;
+        }
+
+        case CMD_SetBaudrate:
+            if (parameters.size() != 1 || parameters[0] >= sizeof(BaudRates) / sizeof(BaudRates[0]))
+            {
+                break;
+            }
+
+            nextBaudRate = BaudRates[parameters[0]];
+            data.assign(1, parameters[0]);
+            return STATUS_OK;
+
+        case CMD_GetSerialNum:
+            data.assign({0x53, 0x49, 0x4D, 0x00, 0x00, 0x00, 0x00, address});
+            return STATUS_OK;
+
+        case CMD_GetVersionNum:
+        {
+            const char version[] = "IDTRONIC-SIM 1.0";
+            data.assign(version, version + sizeof(version) - 1);
+            return STATUS_OK;
+        }
+    }
+
+    data.assign(1, 0x00);
+    return STATUS_FAILED;
+}
+
+void IDTRONICSimulator::serve()
+{
+    for (;;)
+    {
+        std::vector<BYTE> frame;
+
+        if (!receiveFrame(frame))
+        {
+            if (frame.empty())
+            {
+                return;  // stopped
+            }
+
+            continue;  // a corrupted request is not answered
+        }
+
+        if ((frame[0] != address && frame[0] != 0x00) || !hostBaudMatches() || takeLostReply())
+        {
+            continue;
+        }
+
+        std::vector<BYTE> data;
+        BYTE status = execute(frame[2], std::vector<BYTE>(frame.begin() + 3, frame.end()), data);
+
+        awaitResponseTime();
+        sendFrame(address, status, data);
+        requestCount++;
+
+        if (nextBaudRate != 0)
+        {
+            setReaderBaudRate(nextBaudRate);
+            nextBaudRate = 0;
+        }
+    }
+}
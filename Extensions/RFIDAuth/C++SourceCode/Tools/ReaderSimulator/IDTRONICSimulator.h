@@ -0,0 +1,43 @@
+#pragma once
+#include "PtySimulator.h"
+#include <mutex>
+#include <vector>
+
+/* Simulates an iDTRONIC Mifare reader. Requests are framed as
+ * 0xAA address length command data... checksum 0xBB and answered with a
+ * status byte instead of the command. Requests to other addresses are ignored
+ * like on a shared RS-485 line, address 0 is answered by every reader with
+ * its own address. Requests sent at another rate than the reader's are not
+ * understood. */
+class IDTRONICSimulator : public PtySimulator
+{
+   public:
+    /* Memory of a Mifare Classic 1K and 4K card */
+    static constexpr size_t CardSize = 64 * 16;
+    static constexpr size_t Card4KSize = 256 * 16;
+
+    explicit IDTRONICSimulator(BYTE address = 0x00) : address(address) {}
+
+    /* Insert a card with a 4 to 10 byte UID and empty memory. Keyed commands must stay within one sector. */
+    void insertCard(const BYTE* uid, size_t uidLength, size_t memorySize = CardSize);
+    void removeCard();
+    /* Memory of the inserted card */
+    std::vector<BYTE> cardImage();
+    /* Number of requests answered so far */
+    size_t requests() const { return requestCount; }
+
+   protected:
+    void serve() override;
+
+   private:
+    const BYTE address;
+    std::mutex mutex;
+    std::vector<BYTE> uid;
+    std::vector<BYTE> memory;
+    std::atomic<size_t> requestCount{0};
+    unsigned int nextBaudRate = 0;  // Taken over after the reply to CMD_SetBaudrate was sent
+
+    bool receiveFrame(std::vector<BYTE>& frame);
+    void sendFrame(BYTE frameAddress, BYTE status, const std::vector<BYTE>& data);
+    BYTE execute(BYTE command, const std::vector<BYTE>& parameters, std::vector<BYTE>& data);
+};
@@ -0,0 +1,202 @@
+#include "PtySimulator.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+PtySimulator::~PtySimulator() { stop(); }
+
+bool PtySimulator::start(const SimulatorTiming& timing)
+{
+    stop();
+    this->timing = timing;
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || !ptsname(master))
+    {
+        stop();
+        return false;
+    }
+
+    path = ptsname(master);
+    slave = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    termios tio{};
+
+    if (slave < 0 || tcgetattr(slave, &tio) != 0)
+    {
+        stop();
+        return false;
+    }
+
+    /* The line discipline must pass every byte unchanged, also before the driver configured the port */
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    initialLine = tio;
+
+    readerBaud = timing.baudRate ? timing.baudRate : 9600;
+    stopping = false;
+    lineFree = Clock::now();
+    thread = std::thread([this] { serve(); });
+    return true;
+}
+
+void PtySimulator::stop()
+{
+    stopping = true;
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+    if (slave >= 0)
+    {
+        ::close(slave);
+        slave = -1;
+    }
+
+    if (master >= 0)
+    {
+        ::close(master);
+        master = -1;
+    }
+}
+
+Clock::duration PtySimulator::byteTime() const
+{
+    if (timing.baudRate == 0)
+    {
+        return Clock::duration::zero();
+    }
+
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(1000000000ull * timing.bitsPerByte /
+                                                                                readerBaud));
+}
+
+bool PtySimulator::hostBaudMatches() const
+{
+    static const struct
+    {
+        unsigned int baudRate;
+        speed_t speed;
+    } speeds[]{{1200, B1200},   {2400, B2400},   {4800, B4800},     {9600, B9600},    {19200, B19200},
+               {38400, B38400}, {57600, B57600}, {115200, B115200}, {230400, B230400}};
+    termios tio{};
+
+    /* The slave side shares its settings with the port the driver opened */
+    if (tcgetattr(slave, &tio) != 0)
+    {
+        return false;
+    }
+
+    for (const auto& entry : speeds)
+    {
+        if (entry.baudRate == readerBaud)
+        {
+            return cfgetospeed(&tio) == entry.speed;
+        }
+    }
+
+    return false;
+}
+
+void PtySimulator::resetLine() { tcsetattr(slave, TCSANOW, &initialLine); }
+
+void PtySimulator::plugIn()
+{
+    resetLine();
+    pluggedIn = true;
+}
+
+bool PtySimulator::readByte(BYTE& b)
+{
+    while (!stopping)
+    {
+        pollfd pfd{master, POLLIN, 0};
+
+        /* Wake up regularly to notice stop() */
+        if (poll(&pfd, 1, 50) <= 0 || !(pfd.revents & POLLIN))
+        {
+            continue;
+        }
+
+        if (::read(master, &b, 1) != 1)
+        {
+            continue;
+        }
+
+        /* The byte arrived at once, but on a real line it would still be in transit */
+        const Clock::time_point now = Clock::now();
+        lineFree = (lineFree > now ? lineFree : now) + byteTime();
+        return true;
+    }
+
+    return false;
+}
+
+bool PtySimulator::take(std::atomic<size_t>& counter)
+{
+    size_t count = counter;
+
+    while (count > 0 && !counter.compare_exchange_weak(count, count - 1))
+    {
+    }
+
+    return count > 0;
+}
+
+void PtySimulator::awaitResponseTime() { std::this_thread::sleep_until(lineFree + timing.responseDelay); }
+
+void PtySimulator::send(const BYTE* buffer, size_t length)
+{
+    const Clock::duration perByte = byteTime();
+
+    if (perByte == Clock::duration::zero())
+    {
+        while (length > 0)
+        {
+            ssize_t written = ::write(master, buffer, length);
+
+            if (written <= 0)
+            {
+                return;
+            }
+
+            buffer += written;
+            length -= (size_t)written;
+        }
+
+        return;
+    }
+
+    /* Every byte is delivered when its last bit would have arrived */
+    Clock::time_point next = Clock::now();
+
+    for (size_t i = 0; i < length; i++)
+    {
+        next += perByte;
+        std::this_thread::sleep_until(next);
+
+        if (::write(master, &buffer[i], 1) != 1)
+        {
+            return;
+        }
+    }
+
+    lineFree = next;
+}
+
+void PtySimulator::setCts(bool cts)
+{
+    std::lock_guard<std::mutex> lock(ctsMutex);
+    ctsLine = cts;
+    ctsChanged.notify_all();
+}
+
+bool PtySimulator::waitCtsChange(bool last, Clock::time_point deadline) const
+{
+    std::unique_lock<std::mutex> lock(ctsMutex);
+    ctsChanged.wait_until(lock, deadline, [this, last] { return ctsLine != last; });
+    return ctsLine;
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include "Platform.h"
+#include "SerialPort.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <termios.h>
+#include <thread>
+
+/* Line parameters of a simulated reader */
+struct SimulatorTiming
+{
+    /* Time between the last byte of a request and the first byte of the reply */
+    std::chrono::microseconds responseDelay{0};
+    /* Bytes are paced as on a real line with this baud rate, 0 disables pacing.
+     * A reader that changes its rate is paced with the new one. */
+    unsigned int baudRate = 9600;
+    /* Start, data, parity and stop bits of one byte */
+    unsigned int bitsPerByte = 10;
+};
+
+/* A reader on the master side of a Linux pseudo-terminal. The drivers open
+ * the slave side like a serial port. Pseudo-terminals have no modem lines, so
+ * CTS is simulated and read through SimulatorPort. */
+class PtySimulator
+{
+   public:
+    PtySimulator() = default;
+    PtySimulator(const PtySimulator&) = delete;
+    PtySimulator& operator=(const PtySimulator&) = delete;
+    virtual ~PtySimulator();
+
+    /* Open the pseudo-terminal and answer requests on a background thread */
+    bool start(const SimulatorTiming& timing);
+    void stop();
+
+    /* Path of the slave side, e.g. /dev/pts/3 */
+    const std::string& devicePath() const { return path; }
+    bool cts() const { return ctsLine; }
+    /* Block until CTS differs from last or the deadline passes. Returns the state of CTS. */
+    bool waitCtsChange(bool last, Clock::time_point deadline) const;
+    /* Do not answer the next count requests, like a reader without power */
+    void loseReplies(size_t count) { lostReplies = count; }
+    /* Send the next count replies with a wrong checksum, like a noisy line */
+    void corruptReplies(size_t count) { corruptedReplies = count; }
+    /* Rate the reader currently uses, it starts with the rate of the timing or 9600 */
+    unsigned int readerBaudRate() const { return readerBaud; }
+    /* Corrupt every reply while the reader is faster than baudRate, like a long
+     * or noisy cable. 0 makes every rate stable. */
+    void setMaxStableBaudRate(unsigned int baudRate) { maxStableBaud = baudRate; }
+    /* Return the line settings to those of a new pseudo-terminal. A
+     * pseudo-terminal keeps no parity bit and refuses to enable parity unless
+     * the rate changes as well, so a port that is opened again with even
+     * parity at the same rate needs this in between. */
+    void resetLine();
+    /* Pull the USB adapter: every access of a SimulatorPort fails and it
+     * cannot be reopened until plugIn(), which starts with a new line */
+    void unplug() { pluggedIn = false; }
+    void plugIn();
+    bool isPluggedIn() const { return pluggedIn; }
+    /* False if the bytes are not paced to a baud rate */
+    bool paced() const { return timing.baudRate != 0; }
+
+   protected:
+    /* Handle requests until readByte() returns false */
+    virtual void serve() = 0;
+
+    /* Block until the host sent a byte. Returns false when the simulator stops. */
+    bool readByte(BYTE& b);
+    /* Send bytes paced to the baud rate */
+    void send(const BYTE* buffer, size_t length);
+    /* Wait until the request left the line plus the configured response delay */
+    void awaitResponseTime();
+    void setCts(bool cts);
+    /* True if the request just received is not to be answered or the reply about to be sent is to be corrupted */
+    bool takeLostReply() { return take(lostReplies); }
+    bool takeCorruptedReply() { return take(corruptedReplies); }
+    void setReaderBaudRate(unsigned int baudRate) { readerBaud = baudRate; }
+    /* True if the host set the port to the rate of the reader, requests sent at another rate are garbage */
+    bool hostBaudMatches() const;
+    /* True if the reader is faster than the line allows */
+    bool lineUnstable() const { return maxStableBaud != 0 && readerBaud > maxStableBaud; }
+
+   private:
+    int master = -1;
+    int slave = -1;  // Kept open so the master does not hang up while the driver has the port closed
+    std::string path;
+    SimulatorTiming timing;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> ctsLine{false};
+    std::atomic<size_t> lostReplies{0};
+    std::atomic<size_t> corruptedReplies{0};
+    std::atomic<unsigned int> readerBaud{9600};
+    std::atomic<unsigned int> maxStableBaud{0};
+    std::atomic<bool> pluggedIn{true};
+    mutable std::mutex ctsMutex;
+    mutable std::condition_variable ctsChanged;
+    Clock::time_point lineFree;
+    termios initialLine{};
+
+    Clock::duration byteTime() const;
+    static bool take(std::atomic<size_t>& counter);
+};
+
+/* Serial port on the slave side of a simulator that reads CTS from the simulator
+ * and fails like a real port while the simulator is unplugged */
+class SimulatorPort : public SerialPort
+{
+    const PtySimulator& simulator;
+
+   public:
+    explicit SimulatorPort(const PtySimulator& simulator) : simulator(simulator) {}
+
+    IoStatus readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline) override
+    {
+        if (!simulator.isPluggedIn())
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        return SerialPort::readSome(buffer, capacity, received, deadline);
+    }
+
+    IoStatus write(const BYTE* buffer, size_t length, Clock::time_point deadline) override
+    {
+        if (!simulator.isPluggedIn())
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        return SerialPort::write(buffer, length, deadline);
+    }
+
+    bool paced() const override { return simulator.paced(); }
+
+    bool reopen(const std::string& device) override
+    {
+        if (!simulator.isPluggedIn())
+        {
+            close();
+            return false;
+        }
+
+        return SerialPort::reopen(device);
+    }
+
+    IoStatus getCts(bool& cts) override
+    {
+        if (!isOpen() || !simulator.isPluggedIn())
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        cts = simulator.cts();
+        return IoStatus::SUCCESS;
+    }
+
+    IoStatus waitCtsChange(bool& cts, Clock::time_point deadline) override
+    {
+        if (!isOpen() || !simulator.isPluggedIn())
+        {
+            return IoStatus::IO_ERROR;
+        }
+
+        const bool last = cts;
+        cts = simulator.waitCtsChange(last, deadline);
+        return cts != last ? IoStatus::SUCCESS : IoStatus::TIMEOUT;
+    }
+};
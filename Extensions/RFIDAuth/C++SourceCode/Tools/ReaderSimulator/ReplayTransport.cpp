@@ -0,0 +1,260 @@
+#include "ReplayTransport.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+/* Magic numbers of pcap files with nanosecond and microsecond timestamps in the byte order of the host */
+static constexpr DWORD pcapNanoseconds = 0xA1B23C4D;
+static constexpr DWORD pcapMicroseconds = 0xA1B2C3D4;
+
+void ReplayTransport::add(FrameDirection direction, Clock::duration time, const BYTE* frame, size_t length)
+{
+    if (direction == FrameDirection::SENT)
+    {
+        transmit.insert(transmit.end(), frame, frame + length);
+        lastTransmit = time;
+        anyTransmit = true;
+        return;
+    }
+
+    /* Frames received before the first transmit frame arrive at once */
+    const Clock::duration delay = anyTransmit ? std::max<Clock::duration>(time - lastTransmit, {}) : Clock::duration{};
+    replies.push_back(Reply{transmit.size(), delay, std::vector<BYTE>(frame, frame + length)});
+}
+
+bool ReplayTransport::load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    DWORD header[6];
+
+    if (!file.read((char*)header, sizeof(header)) || (header[0] != pcapNanoseconds && header[0] != pcapMicroseconds))
+    {
+        return false;
+    }
+
+    const long long fraction = header[0] == pcapNanoseconds ? 1 : 1000;
+    DWORD packet[4];
+    std::vector<BYTE> data;
+
+    while (file.read((char*)packet, sizeof(packet)))
+    {
+        const DWORD captured = packet[2];
+        const DWORD length = packet[3];
+        data.resize(captured);
+
+        /* Every packet is the direction followed by the whole frame */
+        if (captured == 0 || captured != length || !file.read((char*)data.data(), captured) || data[0] > 1)
+        {
+            return false;
+        }
+
+        const std::chrono::nanoseconds time(packet[0] * 1000000000LL + packet[1] * fraction);
+        add((FrameDirection)data[0], std::chrono::duration_cast<Clock::duration>(time), &data[1], captured - 1);
+    }
+
+    return file.eof();
+}
+
+void ReplayTransport::splitReplies(size_t size)
+{
+    std::vector<Reply> split;
+
+    for (const Reply& reply : replies)
+    {
+        for (size_t i = 0; i < reply.bytes.size(); i += size)
+        {
+            const auto begin = reply.bytes.begin() + i;
+            split.push_back(Reply{reply.after, reply.delay,
+                                  std::vector<BYTE>(begin, begin + std::min(size, reply.bytes.size() - i))});
+        }
+    }
+
+    replies = std::move(split);
+    rewind();
+}
+
+void ReplayTransport::rewind()
+{
+    transmitted = 0;
+    next = 0;
+    offset = 0;
+    diverged = SIZE_MAX;
+    writeTimes.clear();
+    writeTimes.emplace_back(0, Clock::now());
+}
+
+Clock::time_point ReplayTransport::sentBefore(const Reply& reply) const
+{
+    if (reply.after > transmitted)
+    {
+        return Clock::time_point::max();
+    }
+
+    /* The write that completed the transmit bytes before the reply */
+    auto reached = std::lower_bound(writeTimes.begin(), writeTimes.end(), reply.after,
+                                    [](const std::pair<size_t, Clock::time_point>& entry, size_t after)
+                                    { return entry.first < after; });
+    return reached->second;
+}
+
+size_t ReplayTransport::arrived(Clock::time_point now, Clock::time_point& until) const
+{
+    const Reply& reply = replies[next];
+    const Clock::time_point sent = sentBefore(reply);
+    until = Clock::time_point::max();
+
+    if (sent == Clock::time_point::max())
+    {
+        return 0;
+    }
+
+    if (pacing == ReplayPacing::FAST)
+    {
+        return reply.bytes.size();
+    }
+
+    /* The trace holds the time a frame was complete, the bytes before its last one are spread back from it at the
+     * rate of the line, but not before the request was sent */
+    const Clock::duration byteTime =
+        std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(bitsPerByte)) / (rate ? rate : 9600);
+    const Clock::time_point first =
+        std::max(sent + reply.delay - byteTime * (Clock::rep)(reply.bytes.size() - 1), sent);
+
+    if (now < first)
+    {
+        until = first;
+        return 0;
+    }
+
+    const size_t count = std::min<size_t>(reply.bytes.size(), 1 + (size_t)((now - first) / byteTime));
+
+    if (count < reply.bytes.size())
+    {
+        until = first + byteTime * (Clock::rep)count;
+    }
+
+    return count;
+}
+
+IoStatus ReplayTransport::readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline)
+{
+    received = 0;
+
+    if (diverged != SIZE_MAX)
+    {
+        return IoStatus::IO_ERROR;
+    }
+
+    while (next < replies.size())
+    {
+        Clock::time_point until;
+        const size_t count = arrived(Clock::now(), until);
+
+        if (count > offset)
+        {
+            const std::vector<BYTE>& bytes = replies[next].bytes;
+            received = std::min(capacity, count - offset);
+            memcpy(buffer, &bytes[offset], received);
+            offset += received;
+            counters.bytesReceived += received;
+
+            if (offset == bytes.size())
+            {
+                next++;
+                offset = 0;
+            }
+
+            return IoStatus::SUCCESS;
+        }
+
+        if (until >= deadline)
+        {
+            break;
+        }
+
+        std::this_thread::sleep_until(until);
+    }
+
+    /* The reply is late or missing in the trace, a fast replay does not wait for it */
+    if (pacing == ReplayPacing::ORIGINAL)
+    {
+        std::this_thread::sleep_until(deadline);
+    }
+
+    return IoStatus::TIMEOUT;
+}
+
+IoStatus ReplayTransport::write(const BYTE* buffer, size_t length, Clock::time_point /* deadline */)
+{
+    if (diverged != SIZE_MAX)
+    {
+        return IoStatus::IO_ERROR;
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (transmitted + i == transmit.size() || transmit[transmitted + i] != buffer[i])
+        {
+            diverged = transmitted + i;
+            return IoStatus::IO_ERROR;
+        }
+    }
+
+    transmitted += length;
+    counters.bytesSent += length;
+    writeTimes.emplace_back(transmitted, Clock::now());
+    return IoStatus::SUCCESS;
+}
+
+void ReplayTransport::purge()
+{
+    /* Bytes that arrived already are dropped like the receive queue of a port */
+    const Clock::time_point now = Clock::now();
+
+    while (next < replies.size())
+    {
+        Clock::time_point until;
+        const size_t count = arrived(now, until);
+
+        if (count < replies[next].bytes.size())
+        {
+            offset = std::max(offset, count);
+            break;
+        }
+
+        next++;
+        offset = 0;
+    }
+}
+
+IoStatus ReplayTransport::getCts(bool& cts)
+{
+    cts = ctsLine;
+    return IoStatus::SUCCESS;
+}
+
+IoStatus ReplayTransport::waitCtsChange(bool& cts, Clock::time_point deadline)
+{
+    const bool last = cts;
+
+    while (ctsLine == last && Clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    cts = ctsLine;
+    return cts != last ? IoStatus::SUCCESS : IoStatus::TIMEOUT;
+}
+
+bool ReplayTransport::setBaudRate(unsigned int baudRate)
+{
+    rate = baudRate;
+    return true;
+}
+
+bool ReplayTransport::reopen(const std::string& /* device */)
+{
+    /* The trace goes on where it was, the reader on the line is the same */
+    return diverged == SIZE_MAX;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "Platform.h"
+#include "FrameCapture.h"
+#include "Transport.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+/* How a ReplayTransport paces the received frames */
+enum class ReplayPacing
+{
+    /* Each frame is complete as long after the preceding transmit frame as in the trace, its bytes arrive one by one
+     * at the rate of the line before */
+    ORIGINAL,
+    FAST  // each frame arrives at once as soon as the transmit frames before it were written
+};
+
+/* Plays a recorded trace back to a driver instead of a serial line, so a
+ * field failure can be reproduced and the protocol code measured without a
+ * reader. The transmit frames of the trace form one byte stream that the
+ * driver must write exactly, the first byte that differs is kept as the
+ * divergence and fails every further write. A received frame arrives once
+ * the transmit bytes before it in the trace were written and is returned by
+ * as many readSome calls as it takes, but never together with the next
+ * frame, so a reply that was split across reads on the line is split the
+ * same way. A reply that is missing in the trace times out.
+ *
+ * CTS is not part of a trace, it keeps the state of setCts(). Not thread
+ * safe apart from the CTS functions, the drivers serialize the rest. */
+class ReplayTransport : public Transport
+{
+   public:
+    /* bitsPerByte is the number of start, data, parity and stop bits of a byte at the original pacing */
+    explicit ReplayTransport(ReplayPacing pacing = ReplayPacing::FAST, unsigned int bitsPerByte = 10)
+        : pacing(pacing), bitsPerByte(bitsPerByte)
+    {
+        rewind();
+    }
+
+    /* Append a frame to the trace. time is the time of the frame since any fixed point, it only matters relative to
+     * the other frames. */
+    void add(FrameDirection direction, Clock::duration time, const BYTE* frame, size_t length);
+    /* Append the frames of a capture written by FrameCapture::dump. Returns false if the file is no capture or a frame
+     * was truncated. */
+    bool load(const std::string& path);
+    /* Split every received frame into frames of at most size bytes, like a reply that is read piece by piece. Meant
+     * for the fast pacing, at the original one the pieces are complete at the same time. */
+    void splitReplies(size_t size);
+    /* Start the trace over, e.g. to replay it once more */
+    void rewind();
+
+    /* True once every frame of the trace was written or read */
+    bool finished() const { return transmitted == transmit.size() && next == replies.size(); }
+    /* Offset in the transmit stream of the first byte the driver wrote differently, SIZE_MAX while all matched */
+    size_t divergence() const { return diverged; }
+    void setCts(bool cts) { ctsLine = cts; }
+
+    IoStatus readSome(BYTE* buffer, size_t capacity, size_t& received, Clock::time_point deadline) override;
+    IoStatus write(const BYTE* buffer, size_t length, Clock::time_point deadline) override;
+    void purge() override;
+    IoStatus getCts(bool& cts) override;
+    IoStatus waitCtsChange(bool& cts, Clock::time_point deadline) override;
+    bool setBaudRate(unsigned int baudRate) override;
+    unsigned int baudRate() const override { return rate; }
+    bool paced() const override { return pacing == ReplayPacing::ORIGINAL; }
+    bool reopen(const std::string& device) override;
+    LineCounters lineCounters() override { return counters; }
+
+   private:
+    struct Reply
+    {
+        size_t after;            // transmit bytes that precede the frame in the trace
+        Clock::duration delay;   // time from the last of them to the frame
+        std::vector<BYTE> bytes;
+    };
+
+    /* Replay time at which the transmit bytes before reply were written, Clock::time_point::max() until then */
+    Clock::time_point sentBefore(const Reply& reply) const;
+    /* Number of bytes of the reply to be read next that arrived by now. At the original pacing until is set to the
+     * time the next byte arrives. */
+    size_t arrived(Clock::time_point now, Clock::time_point& until) const;
+
+    const ReplayPacing pacing;
+    const unsigned int bitsPerByte;
+    std::vector<BYTE> transmit;
+    std::vector<Reply> replies;
+    Clock::duration lastTransmit{};  // Trace time of the last transmit frame added
+    bool anyTransmit = false;
+
+    size_t transmitted = 0;
+    size_t next = 0;    // Reply to be read next
+    size_t offset = 0;  // Bytes of it that were read
+    size_t diverged = SIZE_MAX;
+    /* Replay time at which the transmit stream reached the end of each transmit frame */
+    std::vector<std::pair<size_t, Clock::time_point>> writeTimes;
+    unsigned int rate = 9600;
+    LineCounters counters{};
+    std::atomic<bool> ctsLine{true};
+};
@@ -0,0 +1,218 @@
+#include "BusScheduler.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+struct BusNode
+{
+    BYTE address;
+    bool online = true;
+    bool cardPresent = false;
+    BYTE uid[MaxUidLength]{};
+    DWORD uidLength = 0;
+    BYTE consecutiveTimeouts = 0;
+    unsigned int probeInterval = 1;  // Cycles between two probes while offline
+    unsigned int skip = 0;           // Cycles left until the next probe
+    std::chrono::milliseconds timeout;
+};
+
+struct BusEvent
+{
+    CardEvent event;
+    BYTE uid[MaxUidLength];
+    DWORD uidLength;
+};
+
+struct BusScheduler::State
+{
+    std::vector<BusNode> nodes;
+    PollFunction poll;
+    BusEventCallback callback;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    bool polling = false;
+    bool inCallback = false;
+};
+
+BusScheduler::BusScheduler(const BYTE* addresses, size_t count, std::chrono::milliseconds nodeTimeout,
+                           PollFunction poll, BusEventCallback callback)
+    : state(std::make_shared<State>())
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        BusNode node;
+        node.address = addresses[i];
+        node.timeout = nodeTimeout;
+        state->nodes.push_back(node);
+    }
+
+    state->poll = std::move(poll);
+    state->callback = callback;
+    thread = std::thread(run, state);
+}
+
+BusScheduler::~BusScheduler() { stop(); }
+
+void BusScheduler::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+
+    bool detach;
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->stopping = true;
+        state->cv.notify_all();
+        state->cv.wait(lock, [this] { return !state->polling; });
+        detach = state->inCallback;
+    }
+
+    if (detach)
+    {
+        thread.detach();
+    }
+    else
+    {
+        thread.join();
+    }
+}
+
+size_t BusScheduler::getStatus(BusNodeStatus* status, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    size_t count = std::min(capacity, state->nodes.size());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const BusNode& node = state->nodes[i];
+        status[i].address = node.address;
+        status[i].online = node.online;
+        status[i].cardPresent = node.cardPresent;
+        status[i].consecutiveTimeouts = node.consecutiveTimeouts;
+    }
+
+    return count;
+}
+
+void BusScheduler::run(std::shared_ptr<State> state)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    size_t next = 0;
+    size_t skipped = 0;
+
+    while (!state->stopping && !state->nodes.empty())
+    {
+        BusNode& node = state->nodes[next];
+        next = (next + 1) % state->nodes.size();
+
+        if (!node.online && node.skip > 0)
+        {
+            node.skip--;
+
+            // Don't spin while every reader on the bus is offline
+            if (++skipped >= state->nodes.size())
+            {
+                skipped = 0;
+                state->cv.wait_for(lock, node.timeout, [&state] { return state->stopping; });
+            }
+
+            continue;
+        }
+
+        skipped = 0;
+        const int address = node.address;
+        const bool cardPresent = node.cardPresent;
+        const std::chrono::milliseconds timeout = node.timeout;
+        BYTE uid[MaxUidLength]{};
+        DWORD uidLength = 0;
+
+        state->polling = true;
+        lock.unlock();
+
+        PollResult result = state->poll(address, uid, uidLength, cardPresent, timeout);
+        ULONGLONG timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+
+        lock.lock();
+        state->polling = false;
+        state->cv.notify_all();
+
+        if (state->stopping)
+        {
+            break;
+        }
+
+        BusEvent events[2];
+        int eventCount = 0;
+
+        if (result == PollResult::CONNECTION_LOST)
+        {
+            if (node.consecutiveTimeouts < 0xFF)
+            {
+                node.consecutiveTimeouts++;
+            }
+
+            if (node.online && node.consecutiveTimeouts >= MaxConsecutiveTimeouts)
+            {
+                node.online = false;
+                node.cardPresent = false;
+                node.probeInterval = 1;
+                node.skip = node.probeInterval;
+                events[eventCount++] = {CardEvent::CONNECTION_LOST, {}, 0};
+            }
+            else if (!node.online)
+            {
+                const unsigned int probeInterval = node.probeInterval * 2;
+                node.probeInterval = probeInterval < MaxProbeInterval ? probeInterval : MaxProbeInterval;
+                node.skip = node.probeInterval;
+            }
+        }
+        else
+        {
+            node.consecutiveTimeouts = 0;
+
+            if (!node.online)
+            {
+                node.online = true;
+                events[eventCount++] = {CardEvent::CONNECTION_RESTORED, {}, 0};
+            }
+
+            if (result == PollResult::CARD_PRESENT && uidLength &&
+                (!node.cardPresent || uidLength != node.uidLength || memcmp(uid, node.uid, uidLength) != 0))
+            {
+                node.cardPresent = true;
+                node.uidLength = uidLength;
+                memcpy(node.uid, uid, uidLength);
+                events[eventCount] = {CardEvent::INSERTED, {}, uidLength};
+                memcpy(events[eventCount++].uid, uid, uidLength);
+            }
+            else if (result == PollResult::NO_CARD && node.cardPresent)
+            {
+                node.cardPresent = false;
+                events[eventCount] = {CardEvent::REMOVED, {}, node.uidLength};
+                memcpy(events[eventCount++].uid, node.uid, node.uidLength);
+            }
+        }
+
+        if (eventCount)
+        {
+            state->inCallback = true;
+            lock.unlock();
+
+            for (int i = 0; i < eventCount; i++)
+            {
+                state->callback(address, (DWORD)events[i].event, events[i].uid, events[i].uidLength, timestamp);
+            }
+
+            lock.lock();
+            state->inCallback = false;
+        }
+    }
+}
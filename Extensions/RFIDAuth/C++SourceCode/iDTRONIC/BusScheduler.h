@@ -0,0 +1,57 @@
+#pragma once
+#include "Platform.h"
+#include "CardMonitor.h"
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/* Invoked on the scheduler thread for the reader at address. The timestamp is in milliseconds since the Unix epoch. */
+typedef void(__stdcall* BusEventCallback)(int address, DWORD event, const BYTE* uid, DWORD uidLength,
+                                          ULONGLONG timestamp);
+
+/* Snapshot of one reader on the bus as returned by API_GetBusStatus */
+struct BusNodeStatus
+{
+    BYTE address;
+    BYTE online;
+    BYTE cardPresent;
+    BYTE consecutiveTimeouts;
+};
+
+/* Polls several readers that share one RS-485 line in round-robin order.
+ * Every reader has its own reply timeout and presence state. A reader that
+ * stops answering is marked offline and only probed again after an
+ * exponentially growing number of cycles, so dead addresses barely add to
+ * the cycle time of the readers that are alive. */
+class BusScheduler
+{
+   public:
+    /* Query the reader at address once and wait at most timeout for the reply */
+    using PollFunction = std::function<PollResult(int address, BYTE* uid, DWORD& uidLength, bool cardPresent,
+                                                  std::chrono::milliseconds timeout)>;
+
+    /* A reader is offline after this many timeouts in a row */
+    static constexpr BYTE MaxConsecutiveTimeouts = 2;
+    /* An offline reader is probed at least every MaxProbeInterval cycles */
+    static constexpr unsigned int MaxProbeInterval = 32;
+
+    BusScheduler(const BYTE* addresses, size_t count, std::chrono::milliseconds nodeTimeout, PollFunction poll,
+                 BusEventCallback callback);
+    BusScheduler(const BusScheduler&) = delete;
+    BusScheduler& operator=(const BusScheduler&) = delete;
+    ~BusScheduler();
+
+    /* Same semantics as CardMonitor::stop() */
+    void stop();
+    /* Write the state of at most capacity readers into status. Returns the number of readers. */
+    size_t getStatus(BusNodeStatus* status, size_t capacity);
+
+   private:
+    struct State;
+
+    std::shared_ptr<State> state;
+    std::thread thread;
+
+    static void run(std::shared_ptr<State> state);
+};
@@ -1,12 +1,21 @@
 ﻿// RFID.cpp : Defines the initialization routines for the DLL.
 //
 
-#include "windows.h"
-#include "atlbase.h"
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
+#include <bitset>
 #include <time.h>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "RFID.h"
+#include "BusScheduler.h"
+#include "FrameCapture.h"
+#include "FrameCodec.h"
+#include "RetryPolicy.h"
+#include "RttEstimator.h"
+#include "SerialPort.h"
 
 #define OK 0
 #define FAIL -1
@@ -15,182 +24,473 @@
 
 #define MaxPage 12
 #define MaxAddress 255    // API max address define
-#define MaxTime 1         // Retry to send out data times when not reply
-#define WaitReceive 2000  // After transmit waiting receiver first data
+#define WaitReceive 2000  // Upper bound of waiting for the reply, the actual timeout is estimated from the reply times
 #define WaitAuthen 400    // After transmit waiting receiver first data
 #define MaxBufferSize 1024
+#define BlockSize 16      // Mifare Classic block
+#define MaxReadBlocks 15  // A reply carries at most 254 bytes of data
+#define ProbeCount 3      // Replies in a row that make a baud rate usable
+#define ProbeTimeout 100  // Upper bound of waiting for a probe reply
+#define MaxWindowErrors 4  // Corrupted replies within the last 32 exchanges that make a negotiated rate unstable
+#define SearchInterval 4   // Failed attempts to reopen the port of a lost reader before it is searched on other ports
+#define GapCharacters 2    // Idle characters between a reply and the next command, while the reader turns the line around
 
 /***************************************************** Command define content *********************************************************/
 
-// Define Mifare Application Command
-#define CMD_MF_Read 0x20
-#define CMD_MF_Write 0x21
-#define CMD_MF_InitVal 0x22
-#define CMD_MF_Dec 0x23
-#define CMD_MF_Inc 0x24
-#define CMD_MF_GET_SNR 0x25
+// Define Mifare Application Command: code, minimum and maximum number of parameter bytes
+static constexpr IDTRONICCommand CMD_MF_Read{0x20, 3, 9};
+static constexpr IDTRONICCommand CMD_MF_Write{0x21, 7, 9 + MaxPage * 16};
+static constexpr IDTRONICCommand CMD_MF_InitVal{0x22, 12, 12};
+static constexpr IDTRONICCommand CMD_MF_Dec{0x23, 12, 12};
+static constexpr IDTRONICCommand CMD_MF_Inc{0x24, 12, 12};
+static constexpr IDTRONICCommand CMD_MF_GET_SNR{0x25, 2, 2};
 
 // Define System Commands
-#define CMD_SetAddress 0x80       // Set reader address
-#define CMD_SetBaudrate 0x81      // Set reader baudrate
-#define CMD_SetSerialNum 0x82     // Set reader serial number
-#define CMD_GetSerialNum 0x83     // Get reader serial number
-#define CMD_Write_User_Info 0x84  // Set User Information
-#define CMD_Read_User_Info 0x85   // Get User Information
-#define CMD_GetVersionNum 0x86    // Get reader version number
+static constexpr IDTRONICCommand CMD_SetAddress{0x80, 1, 1};           // Set reader address
+static constexpr IDTRONICCommand CMD_SetBaudrate{0x81, 1, 1};          // Set reader baudrate
+static constexpr IDTRONICCommand CMD_SetSerialNum{0x82, 8, 8};         // Set reader serial number
+static constexpr IDTRONICCommand CMD_GetSerialNum{0x83, 0, 0};         // Get reader serial number
+static constexpr IDTRONICCommand CMD_Write_User_Info{0x84, 0, 0xFE};   // Set User Information
+static constexpr IDTRONICCommand CMD_Read_User_Info{0x85, 0, 0xFE};    // Get User Information
+static constexpr IDTRONICCommand CMD_GetVersionNum{0x86, 0, 0};        // Get reader version number
 
-/******************************************************* End Command Define ***********************************************************/
+// Baud rates of the reader, indexed by the parameter of CMD_SetBaudrate
+static const unsigned int BaudRates[]{9600, 19200, 38400, 57600, 115200};
 
-static void CheckControlCode(unsigned char Value);
-static int StartTransmit(int DeviceAddress);
-static void TransmitData(void);
-static int GetRecData(int Tick);
-static int CheckAddress(void);
+/******************************************************* End Command Define ***********************************************************/
 
-/******************************************************** Global Variable *************************************************************/
+/******************************************************** Session Object *************************************************************/
 
-static HANDLE hComm = INVALID_HANDLE_VALUE;
-static unsigned char inBuffer[1024];
-static unsigned char outBuffer[1024];
-static unsigned char CheckSum;
-static DWORD nBytesWrite;
-static int TimeCount;
+// Everything needed to talk to one opened reader. The HANDLE returned by API_OpenComm points to it,
+// so readers on different ports can be used from different threads at the same time.
+struct RFIDSession
+{
+    std::unique_ptr<Transport> port;
+    unsigned char inBuffer[IDTRONICFrame::MaxFrameSize];
+    unsigned char outBuffer[IDTRONICFrame::MaxFrameSize];
+    std::mutex mutex;  // Serializes the API calls of the JS thread and the card monitor
+    std::mutex monitorMutex;
+    std::unique_ptr<CardMonitor> monitor;
+    std::unique_ptr<BusScheduler> bus;
+    std::unique_ptr<AsyncQueue> async;  // Created on the first asynchronous call
+    RttEstimator rtt;  // Reply times per address, command and number of blocks
+    RetryPolicy retryPolicy = DefaultRetryPolicy;  // Of the commands that can be repeated without harm
+    Retrier retrier;
+    StatsCollector stats;  // Latencies and errors per command code
+    TurnaroundScheduler turnaround{10, GapCharacters};  // 8 data bits, no parity
+    FrameCapture capture;  // The last frames of outBuffer and inBuffer
+    CardEventQueue events;  // Of a card monitor without callback
+    int baudIndex = -1;         // Negotiated entry of BaudRates, -1 while the rate was not negotiated
+    int baudAddress = 0;        // Reader the rate was negotiated with
+    uint32_t errorHistory = 0;  // One bit per exchange at the negotiated rate, set if the reply was corrupted
+    bool negotiating = false;   // Errors are expected while rates are probed
+    bool stepDown = false;      // The negotiated rate became unstable, the next command switches one rate down first
+};
+
+static RFIDSession* GetSession(HANDLE commHandle);
+static int GetRecData(RFIDSession* session, DWORD Exchange, size_t RequestLength, int Tick, IDTRONICReply& Reply);
+static int Transceive(RFIDSession* session, int DeviceAddress, const IDTRONICCommand& Command,
+                      const unsigned char* Parameters, size_t ParameterLength, int Tick, const RetryPolicy& Policy,
+                      IDTRONICReply& Reply, bool AnyAddress = false, unsigned char Blocks = 0);
+static unsigned char FirstDataByte(const IDTRONICReply& Reply);
+static int CopyReply(const IDTRONICReply& Reply, unsigned char* Buffer);
+static int MF_GET_SNR(RFIDSession* session, int DeviceAddress, unsigned char mode, unsigned char cmd,
+                      unsigned char* Buffer, int Tick, const RetryPolicy& Policy);
+static int MF_Read(RFIDSession* session, int DeviceAddress, unsigned char mode, unsigned char blk_add,
+                   unsigned char num_blk, const unsigned char* key, IDTRONICReply& Reply);
+static int MF_Write(RFIDSession* session, int DeviceAddress, unsigned char mode, unsigned char blk_add,
+                    unsigned char num_blk, const unsigned char* key, const unsigned char* senddata,
+                    IDTRONICReply& Reply);
+static int NextSector(int Block);
+static bool IsSectorTrailer(int Block);
+static ULONGLONG Timestamp();
+static PollResult ToPollResult(int Status, unsigned char* Buffer, BYTE* uid, DWORD& uidLength, bool cardPresent);
+static int SubmitAsync(HANDLE commHandle, AsyncQueue::Job job, CompletionCallback callback, DWORD* Token);
+static int BaudIndexOf(unsigned int Baudrate);
+static bool Probe(RFIDSession* session, int DeviceAddress);
+static bool SwitchBaudrate(RFIDSession* session, int DeviceAddress, int Index);
+static bool RestoreBaudrate(RFIDSession* session, int DeviceAddress, int Index);
+static int FindBaudrate(RFIDSession* session, int DeviceAddress);
+static void StepDownBaudrate(RFIDSession* session);
+static bool Reconnect(RFIDSession* session, int DeviceAddress, unsigned int Attempt);
 
 /***************************************************** Global Function *****************************************************************/
 
-static void CheckControlCode(unsigned char Value)
+static RFIDSession* GetSession(HANDLE commHandle)
 {
-    outBuffer[nBytesWrite] = Value;
-    CheckSum ^= Value;
-    nBytesWrite++;
+    if (commHandle == INVALID_HANDLE_VALUE)
+    {
+        return (NULL);
+    }
+
+    return ((RFIDSession*)commHandle);
 }
 
-static int StartTransmit(int DeviceAddress)
+static int GetRecData(RFIDSession* session, DWORD Exchange, size_t RequestLength, int Tick, IDTRONICReply& Reply)
 {
-    if (hComm != INVALID_HANDLE_VALUE)
+    unsigned char* inBuffer = session->inBuffer;
+    // Never shorter than the request and the reply header take on the line
+    const Clock::duration Timeout = std::max(
+        session->rtt.timeout(Exchange, std::chrono::milliseconds(Tick)),
+        session->turnaround.expectedReply(RequestLength, IDTRONICFrame::HeaderSize, session->port->baudRate()));
+    const Clock::time_point Sent = Clock::now();
+
+    // Block until the frame header (STX, address, length) arrived or the estimated reply time passed
+    if (session->port->read(inBuffer, IDTRONICFrame::HeaderSize, Sent + Timeout, Timeout) != IoStatus::SUCCESS)
     {
-        outBuffer[0] = STX;
-        nBytesWrite = 1;
-        CheckSum = 0x00;
-        CheckControlCode(DeviceAddress & 0xff);
-        return (0);
+        session->rtt.timedOut(Exchange);
+        return (4);
     }
 
-    return (-1);
-}
+    session->rtt.sample(Exchange, Clock::now() - Sent);
 
-void TransmitData(void)
-{
-    CheckControlCode(CheckSum);
-    outBuffer[nBytesWrite] = ETX;
-    ++nBytesWrite;
+    // Status, data, checksum and ETX follow the header without a pause
+    const size_t length = IDTRONICFrame::remaining(inBuffer);
+
+    if (session->port->read(&inBuffer[IDTRONICFrame::HeaderSize], length, Clock::now() + Timeout, Timeout) !=
+        IoStatus::SUCCESS)
+    {
+        // Only the header is known to have arrived
+        session->capture.record(FrameDirection::RECEIVED, inBuffer, IDTRONICFrame::HeaderSize);
+        return (4);
+    }
 
-    fflush(stdout);
+    session->capture.record(FrameDirection::RECEIVED, inBuffer, IDTRONICFrame::HeaderSize + length);
+
+    if (IDTRONICFrame::decode(inBuffer, IDTRONICFrame::HeaderSize + length, Reply) == DecodeStatus::COMPLETE)
+    {
+        return (0);
+    }
 
-    PurgeComm(hComm, PURGE_TXCLEAR | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_RXABORT);
-    WriteFile(hComm, outBuffer, nBytesWrite, &nBytesWrite, NULL);
+    return (1);
 }
 
-int GetRecData(int Tick)
+// Send a command to the reader at DeviceAddress and wait for the reply. Tick is the upper bound of the wait in ms, the
+// wait itself is estimated from the earlier replies to the same command with the same number of Blocks. A corrupted or
+// missing reply is repeated as Policy allows. Reply points into session->inBuffer afterwards. Unless AnyAddress is set,
+// a reply from another address is a sequence error.
+static int Transceive(RFIDSession* session, int DeviceAddress, const IDTRONICCommand& Command,
+                      const unsigned char* Parameters, size_t ParameterLength, int Tick, const RetryPolicy& Policy,
+                      IDTRONICReply& Reply, bool AnyAddress, unsigned char Blocks)
 {
-    DWORD Start, StartCnt, CurrentCnt;
-    DWORD length;
-    DWORD nBytesRead;
-    DWORD dwErrorMask;
-    COMSTAT Comstate;
+    if (session->stepDown)
+    {
+        StepDownBaudrate(session);
+    }
+
+    const size_t length = IDTRONICFrame::encode(DeviceAddress & 0xff, Command, Parameters, ParameterLength,
+                                                session->outBuffer, sizeof(session->outBuffer));
+    const DWORD Exchange = (DWORD)(DeviceAddress & 0xff) << 16 | (DWORD)Blocks << 8 | Command.code;
+
+    if (length == 0)
+	{
+		return (10);
+	}
 
-    CurrentCnt = StartCnt = GetTickCount64();  // Get current time tick count (ms)
+    const Clock::time_point Start = Clock::now();
 
-    // Check reply time out
-    while (CurrentCnt < (StartCnt + Tick))
+    auto Send = [&]
     {
-        ClearCommError(hComm, &dwErrorMask, &Comstate);  // Get Comstate status
+        const unsigned int Baudrate = session->port->paced() ? session->port->baudRate() : 0;
+        session->turnaround.waitForTurn(Baudrate);
+        session->port->purge();
 
-        if (Comstate.cbInQue >= 3)
+        // A port that cannot be written to, e.g. an unplugged adapter, gets no reply to wait for
+        if (session->port->write(session->outBuffer, length, Clock::now() + std::chrono::milliseconds(WaitReceive)) !=
+            IoStatus::SUCCESS)
         {
-            CurrentCnt = StartCnt + Tick;
+            return Attempt::FAILED;
         }
-        else
+
+        session->capture.record(FrameDirection::SENT, session->outBuffer, length);
+        session->turnaround.sent(length, Baudrate);
+
+        const int Status = GetRecData(session, Exchange, length, Tick, Reply);
+        session->turnaround.idle();
+
+        // Watch the error rate of a negotiated rate, the negotiation itself expects errors
+        if (session->baudIndex > 0 && !session->negotiating)
         {
-            // if received buffer have data then set CurrentCnt to break while loop
-            CurrentCnt = GetTickCount64();
+            session->errorHistory = session->errorHistory << 1 | (Status == 1 ? 1 : 0);
+            session->stepDown = std::bitset<32>(session->errorHistory).count() > MaxWindowErrors;
         }
 
-        if (CurrentCnt < StartCnt)
+        switch (Status)
         {
-            // if GetTickCount over then initial StartCnt
-            StartCnt = CurrentCnt;
+            case 0:  // check sum success
+                return Attempt::DONE;
+            case 1:  // check sum error, the reader is alive and gets the command again at once
+                session->stats.corrupted(Command.code);
+                return Attempt::CORRUPTED;
+            default:  // time out reply
+                session->stats.timedOut(Command.code);
+                return Attempt::TIMED_OUT;
         }
+    };
+
+    const Attempt Result = session->retrier.run(Policy, Send);
+
+    // The latency of a command that never went out says nothing about the reader
+    if (Result != Attempt::FAILED)
+    {
+        session->stats.completed(Command.code, Clock::now() - Start, Result == Attempt::DONE);
     }
 
-    // ClearCommError(hComm, &dwErrorMask, &Comstate); //Get Comstate status
-    if (Comstate.cbInQue >= 3)
+    switch (Result)
     {
-        ReadFile(hComm, inBuffer, 0x03, &nBytesRead, NULL);
-        length = inBuffer[2] + 2;
+        case Attempt::DONE:
+            if (!AnyAddress && Reply.address != session->outBuffer[1])
+			{
+                return (5);
+			}
 
-        Start = CurrentCnt = StartCnt = GetTickCount64();
-        while (CurrentCnt < (StartCnt + Tick))
-        {                                                    // check reply time out
-            ClearCommError(hComm, &dwErrorMask, &Comstate);  // Get Comstate status
+            return (0);
+        case Attempt::CORRUPTED:
+            return (7);
+        default:
+            return (4);
+    }
+}
 
-            if (Comstate.cbInQue == length)
-            {
-                CurrentCnt = StartCnt + Tick;
+// The first data byte of a reply is the error code when the status is not OK
+static unsigned char FirstDataByte(const IDTRONICReply& Reply) { return Reply.dataLength > 0 ? Reply.data[0] : 0x00; }
 
-                for (int i = 0; i * MaxBufferSize < (int)length; i++)
-                {
-                    if (Comstate.cbInQue >= MaxBufferSize)
-					{
-                        ReadFile(hComm, &inBuffer[3 + i * MaxBufferSize], MaxBufferSize, &nBytesRead, NULL);
-					}
-                    else
-					{
-                        ReadFile(hComm, &inBuffer[3 + i * MaxBufferSize], Comstate.cbInQue, &nBytesRead, NULL);
-					}
+// Buffer[0] is the length of the reply data that follows, or the error code when the status is not OK
+static int CopyReply(const IDTRONICReply& Reply, unsigned char* Buffer)
+{
+    if (Reply.status == OK)
+    {
+        Buffer[0] = (unsigned char)Reply.dataLength;
+        memcpy(&Buffer[1], Reply.data, Reply.dataLength);
+    }
+    else
+    {
+        Buffer[0] = FirstDataByte(Reply);
+    }
 
-                    ClearCommError(hComm, &dwErrorMask, &Comstate);
-                }
+    return (Reply.status);
+}
 
-                for (int i = 1; i < (int)length + 2; i++)
-				{
-					inBuffer[0] ^= inBuffer[i];
-				}
+static int MF_GET_SNR(RFIDSession* session, int DeviceAddress, unsigned char mode, unsigned char cmd,
+                      unsigned char* Buffer, int Tick, const RetryPolicy& Policy)
+{
+    const unsigned char Parameters[]{mode, cmd};
+    IDTRONICReply Reply{};
+    int Status =
+        Transceive(session, DeviceAddress, CMD_MF_GET_SNR, Parameters, sizeof(Parameters), Tick, Policy, Reply);
 
-                inBuffer[0] ^= STX;
+    if (Status != 0)
+	{
+		return (Status);
+	}
 
-                if (inBuffer[0] == 0)
-				{
-                    return (0);
-				}
+    return CopyReply(Reply, Buffer);
+}
 
-                return (1);
-            }
-            else
-            {  // if received buffer have data then set CurrentCnt to break while loop
-                CurrentCnt = GetTickCount64();
-            }
+static int MF_Read(RFIDSession* session, int DeviceAddress, unsigned char mode, unsigned char blk_add,
+                   unsigned char num_blk, const unsigned char* key, IDTRONICReply& Reply)
+{
+    unsigned char Parameters[3 + 6]{mode, num_blk, blk_add};
+    size_t ParameterLength = 3;
 
-            if (CurrentCnt < StartCnt)
-			{
-				StartCnt = CurrentCnt;
-			}
-        }  // End of while
-    }      // End of if
+    if (key != NULL)
+    {
+        memcpy(&Parameters[3], key, 6);
+        ParameterLength += 6;
+    }
 
-    return (4);
+    return Transceive(session, DeviceAddress, CMD_MF_Read, Parameters, ParameterLength,
+                      WaitReceive + (num_blk >> 4) * WaitReceive + 30, session->retryPolicy, Reply, false, num_blk);
 }
 
-int CheckAddress(void)
+static int MF_Write(RFIDSession* session, int DeviceAddress, unsigned char mode, unsigned char blk_add,
+                    unsigned char num_blk, const unsigned char* key, const unsigned char* senddata,
+                    IDTRONICReply& Reply)
 {
-    unsigned char address = 1;
+    // A write with key sends num_blk blocks of 16 bytes, a write without key a single page of 4 bytes
+    unsigned char Parameters[3 + 6 + MaxPage * BlockSize]{mode, num_blk, blk_add};
+    size_t ParameterLength = 3;
 
-    if (inBuffer[1] != outBuffer[address])
-	{
-        return (1);
-	}
+    if (key != NULL)
+    {
+        memcpy(&Parameters[ParameterLength], key, 6);
+        ParameterLength += 6;
+        memcpy(&Parameters[ParameterLength], senddata, num_blk * BlockSize);
+        ParameterLength += num_blk * BlockSize;
+    }
+    else
+    {
+        memcpy(&Parameters[ParameterLength], senddata, 4);
+        ParameterLength += 4;
+    }
 
-    return (0);
+    return Transceive(session, DeviceAddress, CMD_MF_Write, Parameters, ParameterLength,
+                      WaitReceive + num_blk * WaitReceive, session->retryPolicy, Reply, false, num_blk);
+}
+
+// First block after the sector of Block. A Mifare 4K card has 32 sectors of 4 blocks followed by 8 sectors of 16
+// blocks, a 1K card only the small sectors.
+static int NextSector(int Block) { return Block < 128 ? (Block | 3) + 1 : (Block | 15) + 1; }
+
+// The last block of a sector holds its keys and access bits
+static bool IsSectorTrailer(int Block) { return NextSector(Block) == Block + 1; }
+
+// Microseconds since 1970
+static ULONGLONG Timestamp()
+{
+    return (ULONGLONG)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Entry of BaudRates for Baudrate, -1 if the reader does not support it
+static int BaudIndexOf(unsigned int Baudrate)
+{
+    const unsigned int* Found = std::find(std::begin(BaudRates), std::end(BaudRates), Baudrate);
+    return Found != std::end(BaudRates) ? (int)(Found - BaudRates) : -1;
+}
+
+// True if the reader at DeviceAddress answers ProbeCount requests in a row without error at the current rate
+static bool Probe(RFIDSession* session, int DeviceAddress)
+{
+    for (int i = 0; i < ProbeCount; i++)
+    {
+        IDTRONICReply Reply{};
+
+        if (Transceive(session, DeviceAddress, CMD_GetSerialNum, NULL, 0, ProbeTimeout, NoRetryPolicy, Reply, true) !=
+                0 ||
+            Reply.status != OK)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Switch the reader and the port to BaudRates[Index] and probe the new rate. The reader still answers at the old rate,
+// so the port follows only after the reply.
+static bool SwitchBaudrate(RFIDSession* session, int DeviceAddress, int Index)
+{
+    const unsigned char Code = (unsigned char)Index;
+    IDTRONICReply Reply{};
+    int Status =
+        Transceive(session, DeviceAddress, CMD_SetBaudrate, &Code, 1, WaitReceive + 10, NoRetryPolicy, Reply, true);
+
+    if (Status != 0 || Reply.status != OK || !session->port->setBaudRate(BaudRates[Index]))
+    {
+        return false;
+    }
+
+    session->rtt.reset();
+    return Probe(session, DeviceAddress);
+}
+
+// Go back to BaudRates[Index] after a failed switch. The reader may have switched although its reply was lost, then it
+// is found at the new rate, else the switch back is just repeated by the reader.
+static bool RestoreBaudrate(RFIDSession* session, int DeviceAddress, int Index)
+{
+    if (SwitchBaudrate(session, DeviceAddress, Index))
+    {
+        return true;
+    }
+
+    session->rtt.reset();
+    return session->port->setBaudRate(BaudRates[Index]) && Probe(session, DeviceAddress);
+}
+
+// Search the rate of the reader from the highest down. Returns the entry of BaudRates or -1 if the reader does not
+// answer at any.
+static int FindBaudrate(RFIDSession* session, int DeviceAddress)
+{
+    for (int Index = (int)(sizeof(BaudRates) / sizeof(BaudRates[0])) - 1; Index >= 0; Index--)
+    {
+        session->rtt.reset();
+
+        if (session->port->setBaudRate(BaudRates[Index]) && Probe(session, DeviceAddress))
+        {
+            return Index;
+        }
+    }
+
+    return -1;
+}
+
+// Too many corrupted replies at the negotiated rate, continue one rate lower
+static void StepDownBaudrate(RFIDSession* session)
+{
+    session->stepDown = false;
+    session->errorHistory = 0;
+    session->negotiating = true;
+
+    const int Lower = session->baudIndex - 1;
+    session->baudIndex =
+        RestoreBaudrate(session, session->baudAddress, Lower) ? Lower : FindBaudrate(session, session->baudAddress);
+    session->negotiating = false;
+}
+
+// Open the port of a lost reader again, or the port it is found on now, and probe the reader. It may have lost power
+// along with the adapter and start over at another rate, which is searched then.
+static bool Reconnect(RFIDSession* session, int DeviceAddress, unsigned int Attempt)
+{
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    if (!session->port->reopen(std::string()))
+    {
+        const DWORD Port = Attempt % SearchInterval == 0 ? ReaderDiscovery::locate(ReaderType::IDTRONIC, DeviceAddress)
+                                                         : 0;
+
+        if (Port == 0 || !session->port->reopen(SerialPort::deviceName(Port)))
+        {
+            return false;
+        }
+    }
+
+    session->rtt.reset();
+    session->stepDown = false;
+    session->errorHistory = 0;
+    session->negotiating = true;
+
+    int Index = BaudIndexOf(session->port->baudRate());
+
+    if (Index < 0 || !Probe(session, DeviceAddress))
+    {
+        Index = FindBaudrate(session, DeviceAddress);
+    }
+
+    session->negotiating = false;
+
+    if (Index < 0)
+    {
+        return false;
+    }
+
+    if (session->baudIndex >= 0)
+    {
+        session->baudIndex = Index;
+    }
+
+    return true;
+}
+
+// Map the result of MF_GET_SNR to the state of a card monitor or bus scheduler
+static PollResult ToPollResult(int Status, unsigned char* Buffer, BYTE* uid, DWORD& uidLength, bool cardPresent)
+{
+    switch (Status)
+    {
+        case 0:  // Buffer[1] is the card type, the UID follows
+            uidLength = Buffer[0] > 1 ? Buffer[0] - 1 : 0;
+            uidLength = uidLength < MaxUidLength ? uidLength : MaxUidLength;
+            memcpy(uid, &Buffer[2], uidLength);
+            return PollResult::CARD_PRESENT;
+        case 1:  // no card
+            return PollResult::NO_CARD;
+        case 3:
+        case 4:  // time out reply
+            return PollResult::CONNECTION_LOST;
+        default:  // keep the last state on a corrupted reply
+            return cardPresent ? PollResult::CARD_PRESENT : PollResult::NO_CARD;
+    }
 }
 
 /*
@@ -207,39 +507,16 @@ int CheckAddress(void)
   *  4 time out reply
   *  5 check sequence error
   *  7 check sum error
+  * 10 invalid parameter
+  * 11 asynchronous call still pending
+  * 12 unknown asynchronous call
 */
 
 /**************************************************** API System Function *************************************************************/
 
 int RFID_API API_GetSysComm(unsigned char* Buffer)
 {
-    HKEY hKEY;
-    LPCTSTR data_Set = L"HARDWARE\\DEVICEMAP\\SERIALCOMM\\";
-    long ret = (::RegOpenKeyEx(HKEY_LOCAL_MACHINE, data_Set, 0, KEY_READ, &hKEY));
-
-    if (ret == ERROR_SUCCESS)
-    {
-        DWORD dwIndex = 0, lpcchValueName = 256, lpcbData = 256;
-        WCHAR lpValueName[255], lpData[255];
-
-        Buffer[0] = 0x00;
-
-        for (; ret == ERROR_SUCCESS; dwIndex++)
-        {
-            ret = RegEnumValue(hKEY, dwIndex, (LPWSTR)&lpValueName, &lpcchValueName, NULL, NULL, (LPBYTE)&lpData,
-                               &lpcbData);
-
-            if (ret == ERROR_SUCCESS)
-            {
-                Buffer[0] += 1;
-                *(Buffer + Buffer[0]) = _wtoi(lpData + 3);
-            }
-
-            lpcchValueName = lpcbData = 256;
-        }
-    }
-
-    ::RegCloseKey(hKEY);
+    Buffer[0] = (unsigned char)SerialPort::enumerate(Buffer + 1, 255);
 
     if (*Buffer == 0x00)
 	{
@@ -249,59 +526,59 @@ int RFID_API API_GetSysComm(unsigned char* Buffer)
     return 0;
 }
 
-extern "C" HANDLE RFID_API API_OpenComm(int nCom, int nBaudrate)
+extern "C" int RFID_API API_DiscoverReaders(int KnownPort, int KnownType, DiscoveredReader* Readers, int Capacity,
+                                            int* Count)
 {
-    TCHAR szPort[15];
-    HANDLE ret;
-    COMMTIMEOUTS TimeOut;
-    DCB dcb;
-    char* setcom;
-    setcom = new char[20];
+    if (KnownPort < 0 || KnownType < 0 || Readers == NULL || Capacity < 0 || Count == NULL)
+    {
+        return (10);
+    }
 
-    wsprintf(szPort, L"\\\\.\\COM%d", nCom);
+    *Count = (int)ReaderDiscovery::discover(KnownPort, (ReaderType)KnownType, Readers, Capacity);
+    return (0);
+}
 
-    try
-    {
-        ret = CreateFile(szPort, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+extern "C" HANDLE RFID_API API_OpenComm(int nCom, int nBaudrate)
+{
+    std::unique_ptr<SerialPort> port(new SerialPort());
 
-        if (ret != INVALID_HANDLE_VALUE)
-        {
-            SetupComm(ret, 1024, 255);  // hComm,RX_buffer,TX_buffer  //old: 512,255
-            GetCommState(ret, &dcb);    // Get DCB state
-
-            sprintf_s(setcom, 20, "%d, n, 8, 1", nBaudrate);
-            int len = MultiByteToWideChar(CP_ACP, 0, setcom, -1, NULL, 0);
-            LPWSTR dest = new WCHAR[len];
-            MultiByteToWideChar(CP_ACP, 0, setcom, -1, dest, len);
-            BuildCommDCB(dest, &dcb);
-            SetCommState(ret, &dcb);
-            GetCommState(ret, &dcb);
-            GetCommTimeouts(ret, &TimeOut);
-            TimeOut.ReadIntervalTimeout = 1000;
-            SetCommTimeouts(ret, &TimeOut);
-            SetCommMask(ret, EV_TXEMPTY);
-            PurgeComm(ret, PURGE_TXCLEAR);
-        }  // end of if(hComm)
-        else
-        {
-            ret = 0;
-        }
-    }  // end try
-    catch (...)
+    if (!port->open(SerialPort::deviceName(nCom), nBaudrate, Parity::NONE))
     {
-        ret = 0;
+        return (0);
     }
 
-    delete[] setcom;
-    return (ret);
+    RFIDSession* session = new RFIDSession();
+    session->port = std::move(port);
+    return (session);
 }
 
 extern "C" BOOL RFID_API API_CloseComm(HANDLE commHandle)
 {
-    if (commHandle != INVALID_HANDLE_VALUE)
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session != NULL)
     {
-        PurgeComm(commHandle, PURGE_RXCLEAR);
-        CloseHandle(commHandle);
+        API_StopBusScheduler(commHandle);
+        API_StopCardMonitor(commHandle);
+
+        {
+            // Pending asynchronous calls are dropped
+            std::lock_guard<std::mutex> lock(session->monitorMutex);
+            session->async.reset();
+        }
+
+        if (session->baudIndex > 0)
+        {
+            // Back to the default rate, where the next API_OpenComm or discovery looks for the reader
+            std::lock_guard<std::mutex> lock(session->mutex);
+            const unsigned char Code = 0;
+            IDTRONICReply Reply{};
+            session->stepDown = false;
+            Transceive(session, session->baudAddress, CMD_SetBaudrate, &Code, 1, WaitReceive + 10, NoRetryPolicy, Reply,
+                       true);
+        }
+
+        delete session;
         return TRUE;
     }
 
@@ -317,33 +594,28 @@ extern "C" int RFID_API API_SetDeviceAddress(HANDLE commHandle, int DeviceAddres
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
 
-    for (TimeCount = 0; TimeCount < MaxTime; TimeCount++)
-    {
-        if (!StartTransmit(DeviceAddress))
-        {
-            CheckControlCode(0x02);
-            CheckControlCode(CMD_SetAddress);
-            CheckControlCode(NewAddress);
-
-            TransmitData();
-            switch (GetRecData(WaitReceive + 10))
-            {
-                case 0:
-                    Buffer[0] = inBuffer[4];  // return address
-                    return (inBuffer[3]);     // status return
-                case 1:                       // check sum error
-                    return (7);
-            }
-        }
-        else
-		{
-            return (3);
-		}
-    }
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    // The reply may already come from the new address
+    IDTRONICReply Reply{};
+    // Not repeated, a reader that changed its address does not answer the old one any more
+    int Status = Transceive(session, DeviceAddress, CMD_SetAddress, &NewAddress, 1, WaitReceive + 10, NoRetryPolicy,
+                            Reply, true);
 
-    return (4);
+    if (Status != 0)
+	{
+		return (Status);
+	}
+
+    Buffer[0] = FirstDataByte(Reply);  // return address
+    return (Reply.status);             // status return
 }
 
 // 2.API_SetBaudrate
@@ -355,40 +627,27 @@ extern "C" int RFID_API API_SetBaudrate(HANDLE commHandle, int DeviceAddress, un
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
 
-    for (TimeCount = 0; TimeCount < MaxTime; TimeCount++)
-    {
-        if (!StartTransmit(DeviceAddress))
-        {
-            CheckControlCode(0x02);
-            CheckControlCode(CMD_SetBaudrate);
-            CheckControlCode(NewBaud);
-
-            TransmitData();
-            switch (GetRecData(WaitReceive + 10))
-            {
-                case 0:  // check sum success
-                    if (!CheckAddress())
-                    {
-                        Buffer[0] = inBuffer[4];
-                        return (inBuffer[3]);  // status return
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }
-        }
-        else
-		{
-            return (3);
-		}
-    }
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    IDTRONICReply Reply{};
+    // Not repeated, a reader that changed its baud rate does not understand the old one any more
+    int Status =
+        Transceive(session, DeviceAddress, CMD_SetBaudrate, &NewBaud, 1, WaitReceive + 10, NoRetryPolicy, Reply);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
 
-    return (4);
+    Buffer[0] = FirstDataByte(Reply);
+    return (Reply.status);  // status return
 }
 
 // 3.API_SetSerNum
@@ -400,45 +659,26 @@ extern "C" int RFID_API API_SetSerNum(HANDLE commHandle, int DeviceAddress, unsi
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
 
-    for (TimeCount = 0; TimeCount < MaxTime; TimeCount++)
-    {
-        if (!StartTransmit(DeviceAddress))
-        {
-            CheckControlCode(0x09);
-            CheckControlCode(CMD_SetSerialNum);
+    if (session == NULL)
+	{
+		return (3);
+	}
 
-            for (int n = 0; n < 8; n++)
-			{
-				CheckControlCode(NewValue[n]);
-			}
+    std::lock_guard<std::mutex> lock(session->mutex);
 
-            TransmitData();
-
-            switch (GetRecData(WaitReceive + 10))
-            {
-                case 0:  // check sum success
-                    if (!CheckAddress())
-                    {
-                        Buffer[0] = inBuffer[4];  // return DATA[0]
-                        return (inBuffer[3]);     // status return
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }
-        }
-        else
-		{
-            return (3);
-		}
-    }
+    IDTRONICReply Reply{};
+    int Status = Transceive(session, DeviceAddress, CMD_SetSerialNum, NewValue, 8, WaitReceive + 10,
+                            session->retryPolicy, Reply);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
 
-    return (4);
+    Buffer[0] = FirstDataByte(Reply);  // return DATA[0]
+    return (Reply.status);             // status return
 }
 
 // 4.API_GetSerNum
@@ -449,35 +689,28 @@ extern "C" int RFID_API API_GetSerNum(HANDLE commHandle, int DeviceAddress, unsi
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
 
-    for (TimeCount = 0; TimeCount < MaxTime; TimeCount++)
-    {
-        if (!StartTransmit(DeviceAddress))
-        {
-            CheckControlCode(0x01);
-            CheckControlCode(CMD_GetSerialNum);
-
-            TransmitData();
-            switch (GetRecData(WaitReceive + 10))
-            {
-                case 0:
-                {  // check sum success
-                    Buffer[0] = inBuffer[2] - 1;
-                    memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);  // return SerialNum
-                    return (inBuffer[3]);
-                }
-                case 1:  // check sum error
-                    return (7);
-            }
-        }
-        else
-		{
-            return (3);
-		}
-    }
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    IDTRONICReply Reply{};
+    int Status = Transceive(session, DeviceAddress, CMD_GetSerialNum, NULL, 0, WaitReceive + 10, session->retryPolicy,
+                            Reply, true);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
 
-    return (4);
+    // return SerialNum
+    Buffer[0] = (unsigned char)Reply.dataLength;
+    memcpy(&Buffer[1], Reply.data, Reply.dataLength);
+    return (Reply.status);
 }
 
 // 7.API_GetVersionNum
@@ -488,425 +721,359 @@ extern "C" int RFID_API API_GetVersionNum(HANDLE commHandle, int DeviceAddress,
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
 
-    // delay()
-    TimeCount = GetTickCount64();
+    IDTRONICReply Reply{};
+    int Status =
+        Transceive(session, DeviceAddress, CMD_GetVersionNum, NULL, 0, WaitReceive, session->retryPolicy, Reply);
 
-    for (int timeout = TimeCount + 200; TimeCount < timeout;)
+    if (Status != 0)
 	{
-		TimeCount = GetTickCount64();
+		return (Status);
 	}
 
-    for (TimeCount = 0; TimeCount < MaxTime; TimeCount++)
+    if (Reply.status == OK)
     {
-        if (!StartTransmit(DeviceAddress))
-        {
-            CheckControlCode(0x01);
-            CheckControlCode(CMD_GetVersionNum);
-
-            TransmitData();
-            switch (GetRecData(WaitReceive))
-            {
-                case 0:  // check sum success
-                    if (!CheckAddress())
-                    {
-                        if (inBuffer[3] == OK)
-                        {
-                            memcpy(VersionNum, &inBuffer[4], inBuffer[2] - 1);  // nBytesRead
-                        }
-
-                        return (inBuffer[3]);
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }
-        }
-        else
-		{
-            return (3);
-		}
+        memcpy(VersionNum, Reply.data, Reply.dataLength);  // nBytesRead
     }
 
-    return (4);
+    return (Reply.status);
 }
 
-/******************************************************* API Mifare Application Function *********************************************************/
-
-// 1.API_MF_Read()
-extern "C" int RFID_API API_MF_Read(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char blk_add,
-                                    unsigned char num_blk, unsigned char* key, unsigned char* Buffer)
+// 8.API_GetRttEstimate
+extern "C" int RFID_API API_GetRttEstimate(HANDLE commHandle, RttEstimate* Estimates, int Capacity, int* Count)
 {
-    int StartCnt;
+    RFIDSession* session = GetSession(commHandle);
 
-    if (DeviceAddress > MaxAddress || num_blk <= 0)
+    if (session == NULL)
 	{
-		return (10);
+		return (3);
 	}
 
-    hComm = commHandle;
-
-    for (int Retry = 0; Retry < MaxTime; Retry++)
+    if (Capacity < 0 || Count == NULL)
     {
-        if (!StartTransmit(DeviceAddress))
-        {
-            if (key != NULL)
-            {
-                CheckControlCode(0x0A);
-                CheckControlCode(CMD_MF_Read);
-                CheckControlCode(mode);
-                CheckControlCode(num_blk);
-                CheckControlCode(blk_add);
-
-                for (int i = 0; i < 6; i++)
-				{
-					CheckControlCode(key[i]);
-				}
-            }
-            else
-            {
-                CheckControlCode(0x04);
-                CheckControlCode(CMD_MF_Read);
-                CheckControlCode(mode);
-                CheckControlCode(num_blk);
-                CheckControlCode(blk_add);
-            }
-
-            TransmitData();
-
-            StartCnt = (WaitReceive + (num_blk >> 4) * WaitReceive + 30);
-
-            switch (GetRecData(StartCnt))
-            {
-                case 0:  // check sum success
-                    if (CheckAddress() == 0x00)
-                    {
-                        if (inBuffer[3] == OK)
-                        {
-                            Buffer[0] = inBuffer[2] - 1;
-                            memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);
-                        }
-                        else
-                        {
-                            Buffer[0] = inBuffer[4];
-                        }
-
-                        return (inBuffer[3]);
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }  // End of switch case deoce recevied data
-        }
-        else
-		{
-            return (3);
-		}
+        return (10);
     }
 
-    return (4);
+    *Count = (int)session->rtt.estimates(Estimates, Capacity);
+    return (0);
 }
 
-// 2.API_MF_Write()
-extern "C" int RFID_API API_MF_Write(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char blk_add,
-                                     unsigned char num_blk, unsigned char* key, unsigned char* senddata,
-                                     unsigned char* Buffer)
+// 9.API_SetRetryPolicy
+extern "C" int RFID_API API_SetRetryPolicy(HANDLE commHandle, int Resends, int Retries, int Backoff, int MaxBackoff)
 {
-    int length, WaitTick;
+    RFIDSession* session = GetSession(commHandle);
 
-    if (DeviceAddress > MaxAddress || num_blk > MaxPage || num_blk <= 0x00)
+    if (session == NULL)
 	{
-		return (10);
+		return (3);
 	}
 
-    hComm = commHandle;
-
-    for (int TimeCount = 0; TimeCount < MaxTime; TimeCount++)
+    if (Resends < 0 || Retries < 0 || Backoff < 0 || MaxBackoff < Backoff)
     {
-        if (!StartTransmit(DeviceAddress))
-        {
-            if (key != NULL)
-            {
-                length = num_blk * 16;
-                CheckControlCode(length + 0x0A);
-                CheckControlCode(CMD_MF_Write);
-                CheckControlCode(mode);
-                CheckControlCode(num_blk);
-                CheckControlCode(blk_add);
-
-                for (int i = 0; i < 6; i++)
-                {
-                    CheckControlCode(key[i]);
-                }
-
-                for (int i = 0; i < length; i++)
-                {
-                    CheckControlCode(senddata[i]);
-                }
-            }
-            else
-            {
-                length = num_blk * 4;
-                CheckControlCode(length + 0x04);
-                CheckControlCode(CMD_MF_Write);
-                CheckControlCode(mode);
-                CheckControlCode(num_blk);
-                CheckControlCode(blk_add);
-
-                for (int i = 0; i < 4; i++)
-                {
-                    CheckControlCode(senddata[i]);
-                }
-            }
-
-            TransmitData();
-
-            WaitTick = (WaitReceive + num_blk * WaitReceive);
-
-            switch (GetRecData(WaitTick))
-            {
-                case 0:  // check sum success
-                    if (!CheckAddress())
-                    {
-                        if (inBuffer[3] == OK)
-                        {
-                            Buffer[0] = inBuffer[2] - 1;
-                            memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);
-                        }
-                        else
-                        {
-                            Buffer[0] = inBuffer[4];
-                        }
-
-                        return (inBuffer[3]);  // return status
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }  // End of switch case deoce recevied data
-        }
-        else
-		{
-            return (3);
-		}
+        return (10);
     }
 
-    return (4);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->retryPolicy = {(unsigned int)Resends, (unsigned int)Retries, std::chrono::milliseconds(Backoff),
+                            std::chrono::milliseconds(MaxBackoff)};
+    return (0);
 }
 
-// 3.API_MF_InitVal()
-extern "C" int RFID_API API_MF_InitVal(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char sec_num,
-                                       unsigned char* key, unsigned char* value, unsigned char* Buffer)
+// 10.API_GetRetryCounters
+extern "C" int RFID_API API_GetRetryCounters(HANDLE commHandle, RetryCounters* Counters)
 {
-    int WaitTick;
+    RFIDSession* session = GetSession(commHandle);
 
-    if (DeviceAddress > MaxAddress)
+    if (session == NULL)
 	{
-		return (10);
+		return (3);
 	}
 
-    hComm = commHandle;
-
-    for (int TimeCount = 0; TimeCount < MaxTime; TimeCount++)
+    if (Counters == NULL)
     {
-        if (!StartTransmit(DeviceAddress))
-        {
-            CheckControlCode(0x0D);
-            CheckControlCode(CMD_MF_InitVal);
-            CheckControlCode(mode);
-            CheckControlCode(sec_num);
-            CheckControlCode(key[0]);
-            CheckControlCode(key[1]);
-            CheckControlCode(key[2]);
-            CheckControlCode(key[3]);
-            CheckControlCode(key[4]);
-            CheckControlCode(key[5]);
-
-            CheckControlCode(value[0]);
-            CheckControlCode(value[1]);
-            CheckControlCode(value[2]);
-            CheckControlCode(value[3]);
-
-            TransmitData();
-
-            WaitTick = WaitReceive;
-
-            switch (GetRecData(WaitTick))
-            {
-                case 0:  // check sum success
-                    if (!CheckAddress())
-                    {
-                        if (inBuffer[3] == OK)
-                        {
-                            Buffer[0] = inBuffer[2] - 1;
-                            memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);
-                        }
-                        else
-                        {
-                            Buffer[0] = inBuffer[4];
-                        }
-
-                        return (inBuffer[3]);
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }  // End of switch case deoce recevied data
-        }
-        else
-		{
-            return (3);
-		}
+        return (10);
     }
 
-    return (4);
+    *Counters = session->retrier.counters();
+    return (0);
 }
 
-// 4.API_MF_Dec();
-extern "C" int RFID_API API_MF_Dec(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char sec_num,
-                                   unsigned char* key, unsigned char* value, unsigned char* Buffer)
+// 11.API_NegotiateBaudrate
+extern "C" int RFID_API API_NegotiateBaudrate(HANDLE commHandle, int DeviceAddress, int MaxBaudrate, int* Baudrate)
 {
-    int WaitTick;
-
-    if (DeviceAddress > MaxAddress)
+    if (DeviceAddress > MaxAddress || Baudrate == NULL)
 	{
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
 
-    if (!StartTransmit(DeviceAddress))
+    int Highest = (int)(sizeof(BaudRates) / sizeof(BaudRates[0])) - 1;
+
+    while (Highest >= 0 && BaudRates[Highest] > (unsigned int)MaxBaudrate)
     {
-        CheckControlCode(0x0d);
-        CheckControlCode(CMD_MF_Dec);
-        CheckControlCode(mode);
-        CheckControlCode(sec_num);
-        CheckControlCode(key[0]);
-        CheckControlCode(key[1]);
-        CheckControlCode(key[2]);
-        CheckControlCode(key[3]);
-        CheckControlCode(key[4]);
-        CheckControlCode(key[5]);
-        CheckControlCode(value[0]);
-        CheckControlCode(value[1]);
-        CheckControlCode(value[2]);
-        CheckControlCode(value[3]);
+        Highest--;
+    }
 
-        TransmitData();
+    if (Highest < 0)
+    {
+        return (10);
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->negotiating = true;
+    session->stepDown = false;
+    session->errorHistory = 0;
+
+    // Start from the rate the port was opened with, or search the reader if it does not answer there
+    int Current = BaudIndexOf(session->port->baudRate());
 
-        WaitTick = WaitReceive;
+    if (Current < 0 || !Probe(session, DeviceAddress))
+    {
+        Current = FindBaudrate(session, DeviceAddress);
+    }
 
-        switch (GetRecData(WaitTick))
+    // Try the rates from the highest down, the first one that is stable is kept
+    for (int Index = Highest; Current >= 0 && Index > Current; Index--)
+    {
+        if (SwitchBaudrate(session, DeviceAddress, Index))
         {
-            case 0:  // check sum success
-                if (!CheckAddress())
-                {
-                    if (inBuffer[3] == OK)
-                    {
-                        Buffer[0] = inBuffer[2] - 1;
-                        memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);
-                    }
-                    else
-                    {
-                        Buffer[0] = inBuffer[4];
-                    }
-
-                    return (inBuffer[3]);
-                }
-                else
-				{
-                    return (5);
-				}
-            case 1:  // check sum error
-                return (7);
-        }  // End of switch case deoce recevied data
+            Current = Index;
+        }
+        else if (!RestoreBaudrate(session, DeviceAddress, Current))
+        {
+            Current = FindBaudrate(session, DeviceAddress);
+        }
     }
-    else
+
+    session->baudIndex = Current;
+    session->baudAddress = DeviceAddress;
+    session->negotiating = false;
+
+    if (Current < 0)
+    {
+        return (4);
+    }
+
+    *Baudrate = (int)BaudRates[Current];
+    return (0);
+}
+
+// 12.API_GetStats
+extern "C" int RFID_API API_GetStats(HANDLE commHandle, SessionStats* Stats, CommandStats* Commands, int Capacity,
+                                     int* Count)
+{
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    if (Stats == NULL || Capacity < 0 || Count == NULL)
+    {
+        return (10);
+    }
+
+    {
+        // The card monitor may reopen the port at the same time
+        std::lock_guard<std::mutex> lock(session->mutex);
+        Stats->line = session->port->lineCounters();
+    }
+
+    Stats->retries = session->retrier.counters();
+    *Count = (int)session->stats.commands(Commands, Capacity);
+    return (0);
+}
+
+// 13.API_DumpFrameCapture
+extern "C" int RFID_API API_DumpFrameCapture(HANDLE commHandle, const char* FileName)
+{
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    if (FileName == NULL)
+    {
+        return (10);
+    }
+
+    return (session->capture.dump(FileName) ? 0 : 1);
+}
+
+/******************************************************* API Mifare Application Function *********************************************************/
+
+// 1.API_MF_Read()
+extern "C" int RFID_API API_MF_Read(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char blk_add,
+                                    unsigned char num_blk, unsigned char* key, unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress || num_blk > MaxReadBlocks || num_blk <= 0)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    IDTRONICReply Reply{};
+    int Status = MF_Read(session, DeviceAddress, mode, blk_add, num_blk, key, Reply);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
+
+    return CopyReply(Reply, Buffer);
+}
+
+// 2.API_MF_Write()
+extern "C" int RFID_API API_MF_Write(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char blk_add,
+                                     unsigned char num_blk, unsigned char* key, unsigned char* senddata,
+                                     unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress || num_blk > MaxPage || num_blk <= 0x00)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    IDTRONICReply Reply{};
+    int Status = MF_Write(session, DeviceAddress, mode, blk_add, num_blk, key, senddata, Reply);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
+
+    return CopyReply(Reply, Buffer);
+}
+
+// 3.API_MF_InitVal()
+extern "C" int RFID_API API_MF_InitVal(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char sec_num,
+                                       unsigned char* key, unsigned char* value, unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    const unsigned char Parameters[]{mode,   sec_num, key[0],   key[1],   key[2],   key[3],
+                                     key[4], key[5],  value[0], value[1], value[2], value[3]};
+    IDTRONICReply Reply{};
+    int Status = Transceive(session, DeviceAddress, CMD_MF_InitVal, Parameters, sizeof(Parameters), WaitReceive,
+                            session->retryPolicy, Reply);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
+
+    return CopyReply(Reply, Buffer);
+}
+
+// 4.API_MF_Dec()
+extern "C" int RFID_API API_MF_Dec(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char sec_num,
+                                   unsigned char* key, unsigned char* value, unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
 	{
-        return (3);
+		return (3);
 	}
 
-    return (4);
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    const unsigned char Parameters[]{mode,   sec_num, key[0],   key[1],   key[2],   key[3],
+                                     key[4], key[5],  value[0], value[1], value[2], value[3]};
+    IDTRONICReply Reply{};
+    // Not repeated, the reader may have executed a decrement whose reply was lost
+    int Status = Transceive(session, DeviceAddress, CMD_MF_Dec, Parameters, sizeof(Parameters), WaitReceive,
+                            NoRetryPolicy, Reply);
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
+
+    return CopyReply(Reply, Buffer);
 }
 
 // 5.API_MF_Inc()
 extern "C" int RFID_API API_MF_Inc(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char sec_num,
                                    unsigned char* key, unsigned char* value, unsigned char* Buffer)
 {
-    int WaitTick;
-
     if (DeviceAddress > MaxAddress)
 	{
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
 
-    if (!StartTransmit(DeviceAddress))
-    {
-        CheckControlCode(0x0d);
-        CheckControlCode(CMD_MF_Inc);
-        CheckControlCode(mode);
-        CheckControlCode(sec_num);
-        CheckControlCode(key[0]);
-        CheckControlCode(key[1]);
-        CheckControlCode(key[2]);
-        CheckControlCode(key[3]);
-        CheckControlCode(key[4]);
-        CheckControlCode(key[5]);
-        CheckControlCode(value[0]);
-        CheckControlCode(value[1]);
-        CheckControlCode(value[2]);
-        CheckControlCode(value[3]);
+    if (session == NULL)
+	{
+		return (3);
+	}
 
-        TransmitData();
+    std::lock_guard<std::mutex> lock(session->mutex);
 
-        WaitTick = WaitReceive;
+    const unsigned char Parameters[]{mode,   sec_num, key[0],   key[1],   key[2],   key[3],
+                                     key[4], key[5],  value[0], value[1], value[2], value[3]};
+    IDTRONICReply Reply{};
+    // Not repeated, the reader may have executed an increment whose reply was lost
+    int Status = Transceive(session, DeviceAddress, CMD_MF_Inc, Parameters, sizeof(Parameters), WaitReceive,
+                            NoRetryPolicy, Reply);
 
-        switch (GetRecData(WaitTick))
-        {
-            case 0:  // check sum success
-                if (!CheckAddress())
-                {
-                    if (inBuffer[3] == OK)
-                    {
-                        Buffer[0] = inBuffer[2] - 1;
-                        memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);
-                    }
-                    else
-                    {
-                        Buffer[0] = inBuffer[4];
-                    }
-
-                    return (inBuffer[3]);
-                }
-                else
-				{
-                    return (5);
-				}
-            case 1:  // check sum error
-                return (7);
-        }  // End of switch case deoce recevied data
-    }
-    else
+    if (Status != 0)
 	{
-        return (3);
+		return (Status);
 	}
 
-    return (4);
+    return CopyReply(Reply, Buffer);
 }
 
 // 6.API_MF_GET_SNR()
@@ -918,49 +1085,564 @@ extern "C" int RFID_API API_MF_GET_SNR(HANDLE commHandle, int DeviceAddress, uns
 		return (10);
 	}
 
-    hComm = commHandle;
+    RFIDSession* session = GetSession(commHandle);
 
-    for (int TimeCount = 0; TimeCount < MaxTime; TimeCount++)
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return MF_GET_SNR(session, DeviceAddress, mode, cmd, Buffer, WaitReceive, session->retryPolicy);
+}
+
+// 7.API_MF_ReadRange()
+extern "C" int RFID_API API_MF_ReadRange(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                         unsigned char blk_add, int num_blk, unsigned char* key, unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress || num_blk <= 0 || blk_add + num_blk > 256 || key == NULL)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    // The lock is held for the whole range, so no other command gets in between
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    for (int Block = blk_add; Block < blk_add + num_blk;)
     {
-        if (!StartTransmit(DeviceAddress))
+        // A command authenticates one sector only
+        const int Count = std::min({NextSector(Block) - Block, blk_add + num_blk - Block, MaxReadBlocks});
+        IDTRONICReply Reply{};
+        int Status = MF_Read(session, DeviceAddress, mode, (unsigned char)Block, (unsigned char)Count, key, Reply);
+
+        if (Status != 0)
+		{
+			return (Status);
+		}
+
+        if (Reply.status != OK)
+        {
+            Buffer[0] = FirstDataByte(Reply);
+            return (Reply.status);
+        }
+
+        if (Reply.dataLength != (size_t)Count * BlockSize)
+		{
+			return (5);
+		}
+
+        memcpy(&Buffer[(Block - blk_add) * BlockSize], Reply.data, Reply.dataLength);
+        Block += Count;
+    }
+
+    return (0);
+}
+
+// 8.API_MF_WriteRange()
+extern "C" int RFID_API API_MF_WriteRange(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                          unsigned char blk_add, int num_blk, unsigned char* key,
+                                          unsigned char* senddata, unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress || num_blk <= 0 || blk_add + num_blk > 256 || key == NULL)
+	{
+		return (10);
+	}
+
+    // A wrong trailer can lock a sector for good, so it is never written as part of a range
+    for (int Block = blk_add; Block < blk_add + num_blk; Block++)
+    {
+        if (IsSectorTrailer(Block))
+		{
+			return (10);
+		}
+    }
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    // The lock is held for the whole range, so no other command gets in between
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    for (int Block = blk_add; Block < blk_add + num_blk;)
+    {
+        // A command authenticates one sector only
+        const int Count = std::min({NextSector(Block) - Block, blk_add + num_blk - Block, MaxPage});
+        IDTRONICReply Reply{};
+        int Status = MF_Write(session, DeviceAddress, mode, (unsigned char)Block, (unsigned char)Count, key,
+                              &senddata[(Block - blk_add) * BlockSize], Reply);
+
+        if (Status != 0)
+		{
+			return (Status);
+		}
+
+        if (Reply.status != OK)
         {
-            CheckControlCode(0x03);
-            CheckControlCode(CMD_MF_GET_SNR);
-            CheckControlCode(mode);
-            CheckControlCode(cmd);
-
-            TransmitData();
-
-            switch (GetRecData(WaitReceive))
-            {
-                case 0:  // check sum success
-                    if (!CheckAddress())
-                    {
-                        if (inBuffer[3] == OK)
-                        {
-                            Buffer[0] = inBuffer[2] - 1;
-                            memcpy(&Buffer[1], &inBuffer[4], Buffer[0]);
-                        }
-                        else
-                        {
-                            Buffer[0] = inBuffer[4];
-                        }
-
-                        return (inBuffer[3]);
-                    }
-                    else
-					{
-                        return (5);
-					}
-                case 1:  // check sum error
-                    return (7);
-            }  // End of switch case deoce recevied data
+            Buffer[0] = FirstDataByte(Reply);
+            return (Reply.status);
         }
-        else
+
+        Block += Count;
+    }
+
+    return (0);
+}
+
+// 9.API_MF_ReadProfile()
+extern "C" int RFID_API API_MF_ReadProfile(HANDLE commHandle, int DeviceAddress, const ProfileRange* Ranges,
+                                           int RangeCount, CardProfile* Profile, unsigned char* Buffer)
+{
+    if (DeviceAddress > MaxAddress || RangeCount < 0 || (Ranges == NULL && RangeCount > 0) || Profile == NULL)
+	{
+		return (10);
+	}
+
+    for (int Range = 0; Range < RangeCount; Range++)
+    {
+        if (Ranges[Range].Count == 0 || Ranges[Range].Block + Ranges[Range].Count > 256)
 		{
-            return (3);
+			return (10);
 		}
     }
 
-    return (4);
-}
\ No newline at end of file
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    // The lock is held for the whole profile, so no other command gets in between
+    std::lock_guard<std::mutex> lock(session->mutex);
+
+    *Profile = CardProfile{};
+    const unsigned char Request[]{0x26, 0x00};
+    IDTRONICReply Reply{};
+    int Status = Transceive(session, DeviceAddress, CMD_MF_GET_SNR, Request, sizeof(Request), WaitReceive,
+                            session->retryPolicy, Reply);
+    Profile->Commands = 1;
+
+    if (Status != 0)
+	{
+		return (Status);
+	}
+
+    if (Reply.status != OK)
+    {
+        Buffer[0] = FirstDataByte(Reply);
+        return (Reply.status);
+    }
+
+    // The UID follows the byte that tells whether more than one card answered
+    if (Reply.dataLength < 2 || Reply.dataLength > 1 + sizeof(Profile->Uid))
+	{
+		return (5);
+	}
+
+    Profile->UidTime = Timestamp();
+    Profile->DataTime = Profile->UidTime;
+    Profile->UidLength = (unsigned char)(Reply.dataLength - 1);
+    memcpy(Profile->Uid, &Reply.data[1], Profile->UidLength);
+
+    unsigned char* Data = Buffer;
+    int Range = 0;
+    int Done = 0;  // Blocks of Ranges[Range] that were read
+
+    while (Range < RangeCount)
+    {
+        const ProfileRange& First = Ranges[Range];
+        const int Block = First.Block + Done;
+        int Count = 0;
+
+        // A command authenticates one sector only and takes the following ranges along as long as they continue it
+        while (Range < RangeCount && Count < MaxReadBlocks)
+        {
+            const ProfileRange& Next = Ranges[Range];
+
+            if (Next.Block + Done != Block + Count || Next.Mode != First.Mode || memcmp(Next.Key, First.Key, 6))
+			{
+				break;
+			}
+
+            const int Take =
+                std::min({Next.Count - Done, NextSector(Block) - (Block + Count), MaxReadBlocks - Count});
+            Count += Take;
+            Done += Take;
+
+            if (Done < Next.Count)
+			{
+				break;
+			}
+
+            Range++;
+            Done = 0;
+        }
+
+        Reply = IDTRONICReply{};
+        Status =
+            MF_Read(session, DeviceAddress, First.Mode, (unsigned char)Block, (unsigned char)Count, First.Key, Reply);
+        Profile->Commands++;
+
+        if (Status != 0)
+		{
+			return (Status);
+		}
+
+        if (Reply.status != OK)
+        {
+            Buffer[0] = FirstDataByte(Reply);
+            return (Reply.status);
+        }
+
+        if (Reply.dataLength != (size_t)Count * BlockSize)
+		{
+			return (5);
+		}
+
+        memcpy(Data, Reply.data, Reply.dataLength);
+        Data += Reply.dataLength;
+        Profile->DataTime = Timestamp();
+    }
+
+    return (0);
+}
+
+/******************************************************* API Card Monitor Function *********************************************************/
+
+// 1.API_StartCardMonitor()
+extern "C" int RFID_API API_StartCardMonitor(HANDLE commHandle, int DeviceAddress, CardEventCallback callback,
+                                             int pollInterval)
+{
+    if (DeviceAddress > MaxAddress || pollInterval < 0)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    auto poll = [commHandle, DeviceAddress](BYTE* uid, DWORD& uidLength, bool cardPresent)
+    {
+        unsigned char Buffer[MaxBufferSize];
+        int Status = API_MF_GET_SNR(commHandle, DeviceAddress, 0x26, 0x00, Buffer);
+        return ToPollResult(Status, Buffer, uid, uidLength, cardPresent);
+    };
+
+    auto reconnect = [session, DeviceAddress](unsigned int Attempt)
+    {
+        return Reconnect(session, DeviceAddress, Attempt);
+    };
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+    session->monitor.reset();
+    session->monitor = std::make_unique<CardMonitor>(poll, callback, std::chrono::milliseconds(pollInterval),
+                                                     reconnect, callback == NULL ? &session->events : nullptr);
+    return (0);
+}
+
+// 2.API_StopCardMonitor()
+extern "C" int RFID_API API_StopCardMonitor(HANDLE commHandle)
+{
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (!session->monitor)
+    {
+        return (1);
+    }
+
+    session->monitor.reset();
+    return (0);
+}
+
+// 3.API_DrainCardEvents()
+extern "C" int RFID_API API_DrainCardEvents(HANDLE commHandle, QueuedCardEvent* Events, int Capacity, int* Count,
+                                            int* Dropped)
+{
+    if (Events == NULL || Capacity < 0 || Count == NULL || Dropped == NULL)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    // Neither the session nor the monitor lock is taken, the monitor may be polling meanwhile
+    DWORD Lost = 0;
+    *Count = (int)session->events.drain(Events, (size_t)Capacity, Lost);
+    *Dropped = (int)Lost;
+    return (0);
+}
+
+/******************************************************* API Bus Scheduler Function *********************************************************/
+
+// 1.API_StartBusScheduler()
+extern "C" int RFID_API API_StartBusScheduler(HANDLE commHandle, const unsigned char* Addresses, int Count,
+                                              int NodeTimeout, BusEventCallback callback)
+{
+    if (Addresses == NULL || Count <= 0 || Count > MaxAddress + 1 || NodeTimeout <= 0 || callback == NULL)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    auto poll = [session](int DeviceAddress, BYTE* uid, DWORD& uidLength, bool cardPresent,
+                          std::chrono::milliseconds timeout)
+    {
+        unsigned char Buffer[MaxBufferSize];
+        std::unique_lock<std::mutex> lock(session->mutex);
+
+        // The scheduler counts the timeouts of a node itself, so only corrupted replies are repeated
+        RetryPolicy Policy = session->retryPolicy;
+        Policy.retries = 0;
+        int Status = MF_GET_SNR(session, DeviceAddress, 0x26, 0x00, Buffer, (int)timeout.count(), Policy);
+        lock.unlock();
+        return ToPollResult(Status, Buffer, uid, uidLength, cardPresent);
+    };
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+    session->bus.reset();
+    session->bus = std::make_unique<BusScheduler>(Addresses, (size_t)Count, std::chrono::milliseconds(NodeTimeout),
+                                                  poll, callback);
+    return (0);
+}
+
+// 2.API_StopBusScheduler()
+extern "C" int RFID_API API_StopBusScheduler(HANDLE commHandle)
+{
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (!session->bus)
+    {
+        return (1);
+    }
+
+    session->bus.reset();
+    return (0);
+}
+
+// 3.API_GetBusStatus()
+extern "C" int RFID_API API_GetBusStatus(HANDLE commHandle, BusNodeStatus* Status, int Capacity, int* Count)
+{
+    if (Status == NULL || Capacity < 0 || Count == NULL)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (!session->bus)
+    {
+        return (1);
+    }
+
+    *Count = (int)session->bus->getStatus(Status, (size_t)Capacity);
+    return (0);
+}
+
+/******************************************************* API Asynchronous Function *********************************************************/
+
+static int SubmitAsync(HANDLE commHandle, AsyncQueue::Job job, CompletionCallback callback, DWORD* Token)
+{
+    if (Token == NULL)
+	{
+		return (10);
+	}
+
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (!session->async)
+    {
+        session->async = std::make_unique<AsyncQueue>();
+    }
+
+    *Token = session->async->submit(std::move(job), callback);
+    return (0);
+}
+
+// Copy the Buffer filled by a synchronous API function. Buffer[0] is the number of bytes that follow. A failed
+// command leaves no data.
+static void CopyResult(int Status, const unsigned char* Buffer, std::vector<BYTE>& data)
+{
+    if (Status == 0)
+    {
+        data.assign(Buffer, Buffer + Buffer[0] + 1);
+    }
+}
+
+// 1.API_MF_Read_Async()
+extern "C" int RFID_API API_MF_Read_Async(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                          unsigned char blk_add, unsigned char num_blk, unsigned char* key,
+                                          CompletionCallback callback, DWORD* Token)
+{
+    if (DeviceAddress > MaxAddress || num_blk > MaxReadBlocks || num_blk <= 0x00)
+	{
+		return (10);
+	}
+
+    // The caller may release key as soon as this function returns
+    std::vector<unsigned char> Key;
+
+    if (key != NULL)
+    {
+        Key.assign(key, key + 6);
+    }
+
+    auto job = [=](std::vector<BYTE>& data)
+    {
+        unsigned char Buffer[MaxBufferSize] = {};
+        unsigned char* KeyCopy = Key.empty() ? NULL : const_cast<unsigned char*>(Key.data());
+        int Status = API_MF_Read(commHandle, DeviceAddress, mode, blk_add, num_blk, KeyCopy, Buffer);
+        CopyResult(Status, Buffer, data);
+        return (DWORD)Status;
+    };
+
+    return SubmitAsync(commHandle, job, callback, Token);
+}
+
+// 2.API_MF_Write_Async()
+extern "C" int RFID_API API_MF_Write_Async(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                           unsigned char blk_add, unsigned char num_blk, unsigned char* key,
+                                           unsigned char* senddata, CompletionCallback callback, DWORD* Token)
+{
+    if (DeviceAddress > MaxAddress || num_blk > MaxPage || num_blk <= 0x00 || senddata == NULL)
+	{
+		return (10);
+	}
+
+    // Copy exactly what API_MF_Write sends, the caller may release its buffers as soon as this function returns
+    std::vector<unsigned char> Key;
+    std::vector<unsigned char> SendData;
+
+    if (key != NULL)
+    {
+        Key.assign(key, key + 6);
+        SendData.assign(senddata, senddata + num_blk * 16);
+    }
+    else
+    {
+        SendData.assign(senddata, senddata + 4);
+    }
+
+    auto job = [=](std::vector<BYTE>& data)
+    {
+        unsigned char Buffer[MaxBufferSize] = {};
+        unsigned char* KeyCopy = Key.empty() ? NULL : const_cast<unsigned char*>(Key.data());
+        int Status = API_MF_Write(commHandle, DeviceAddress, mode, blk_add, num_blk, KeyCopy,
+                                  const_cast<unsigned char*>(SendData.data()), Buffer);
+        CopyResult(Status, Buffer, data);
+        return (DWORD)Status;
+    };
+
+    return SubmitAsync(commHandle, job, callback, Token);
+}
+
+// 3.API_MF_GET_SNR_Async()
+extern "C" int RFID_API API_MF_GET_SNR_Async(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                             unsigned char cmd, CompletionCallback callback, DWORD* Token)
+{
+    if (DeviceAddress > MaxAddress)
+	{
+		return (10);
+	}
+
+    auto job = [=](std::vector<BYTE>& data)
+    {
+        unsigned char Buffer[MaxBufferSize] = {};
+        int Status = API_MF_GET_SNR(commHandle, DeviceAddress, mode, cmd, Buffer);
+        CopyResult(Status, Buffer, data);
+        return (DWORD)Status;
+    };
+
+    return SubmitAsync(commHandle, job, callback, Token);
+}
+
+// 4.API_GetAsyncResult()
+extern "C" int RFID_API API_GetAsyncResult(HANDLE commHandle, DWORD Token, unsigned char* Buffer)
+{
+    RFIDSession* session = GetSession(commHandle);
+
+    if (session == NULL)
+	{
+		return (3);
+	}
+
+    std::lock_guard<std::mutex> lock(session->monitorMutex);
+
+    if (!session->async)
+    {
+        return (12);
+    }
+
+    DWORD Status = 0;
+    std::vector<BYTE> data;
+
+    switch (session->async->fetch(Token, Status, data))
+    {
+        case AsyncStatus::PENDING:
+            return (11);
+        case AsyncStatus::UNKNOWN_TOKEN:
+            return (12);
+        default:
+            break;
+    }
+
+    if (!data.empty())
+    {
+        memcpy(Buffer, data.data(), data.size());
+    }
+
+    return ((int)Status);
+}
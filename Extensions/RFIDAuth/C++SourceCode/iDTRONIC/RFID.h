@@ -1,10 +1,23 @@
 #pragma once
-#include "Windows.h"
+#include "Platform.h"
+#include "AsyncQueue.h"
+#include "BusScheduler.h"
+#include "CardEventQueue.h"
+#include "CardMonitor.h"
+#include "ReaderDiscovery.h"
+#include "RetryPolicy.h"
+#include "RttEstimator.h"
+#include "StatsCollector.h"
+#include "TurnaroundScheduler.h"
 
 #define RFID_API __declspec(dllexport) __stdcall
 
 // System Command Function
 extern "C" int RFID_API API_GetSysComm(unsigned char* Buffer);
+// Probe KnownPort for a reader of KnownType, a ReaderType, and if none answers there all serial ports at the same time
+// for iDTRONIC, EKS and Baltech readers. Copies up to Capacity readers into Readers and their number into Count.
+extern "C" int RFID_API API_DiscoverReaders(int KnownPort, int KnownType, DiscoveredReader* Readers, int Capacity,
+                                            int* Count);
 extern "C" HANDLE RFID_API API_OpenComm(int nCom, int nBaudrate);
 extern "C" BOOL RFID_API API_CloseComm(HANDLE commHandle);
 extern "C" int RFID_API API_SetDeviceAddress(HANDLE commHandle, int DeviceAddress, unsigned char NewAddr,
@@ -15,6 +28,26 @@ extern "C" int RFID_API API_SetSerNum(HANDLE commHandle, int DeviceAddress, unsi
                                       unsigned char* Buffer);
 extern "C" int RFID_API API_GetSerNum(HANDLE commHandle, int DeviceAddress, unsigned char* Buffer);
 extern "C" int RFID_API API_GetVersionNum(HANDLE commHandle, int DeviceAddress, char* VersionNum);
+// Copy up to Capacity estimates of the reply times into Estimates and their number into Count. The exchange of an
+// estimate holds the reader address in its third byte, the number of blocks in its second and the command code in its
+// first byte.
+extern "C" int RFID_API API_GetRttEstimate(HANDLE commHandle, RttEstimate* Estimates, int Capacity, int* Count);
+// Number of immediate Resends after a corrupted reply and of Retries after a timeout, with a backoff of Backoff ms
+// doubled for every retry up to MaxBackoff ms. Applies to all commands but API_SetDeviceAddress, API_SetBaudrate,
+// API_MF_Dec and API_MF_Inc, which are never repeated.
+extern "C" int RFID_API API_SetRetryPolicy(HANDLE commHandle, int Resends, int Retries, int Backoff, int MaxBackoff);
+extern "C" int RFID_API API_GetRetryCounters(HANDLE commHandle, RetryCounters* Counters);
+// Switch the reader at DeviceAddress and the port to the highest rate up to MaxBaudrate at which the reader answers
+// without error and return it in Baudrate. Meant for a single reader on the line, the others would keep the old rate.
+// When too many replies are corrupted at the negotiated rate later on, the driver steps down one rate on its own.
+extern "C" int RFID_API API_NegotiateBaudrate(HANDLE commHandle, int DeviceAddress, int MaxBaudrate, int* Baudrate);
+// Copy the line and retry counters into Stats and the counters and latency histograms of up to Capacity commands into
+// Commands, see StatsCollector. Count receives the number of commands. The command of an entry is its command code.
+extern "C" int RFID_API API_GetStats(HANDLE commHandle, SessionStats* Stats, CommandStats* Commands, int Capacity,
+                                     int* Count);
+// Write the last frames sent and received to a pcap file named FileName, see FrameCapture. Returns 1 if the file cannot
+// be written.
+extern "C" int RFID_API API_DumpFrameCapture(HANDLE commHandle, const char* FileName);
 
 // Mifare Application Function
 extern "C" int RFID_API API_MF_Read(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char blk_add,
@@ -29,4 +62,74 @@ extern "C" int RFID_API API_MF_Dec(HANDLE commHandle, int DeviceAddress, unsigne
 extern "C" int RFID_API API_MF_Inc(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char sec_num,
                                    unsigned char* key, unsigned char* value, unsigned char* Buffer);
 extern "C" int RFID_API API_MF_GET_SNR(HANDLE commHandle, int DeviceAddress, unsigned char mode, unsigned char cmd,
-                                       unsigned char* Buffer);
\ No newline at end of file
+                                       unsigned char* Buffer);
+// Read or write num_blk blocks of 16 bytes from blk_add on of a Mifare Classic 1K or 4K card that share one key. The
+// range is split into commands that stay within one sector, which are sent back to back. Buffer receives
+// num_blk * 16 bytes, or Buffer[0] is the error code of the reader when a command failed. Writes to a sector trailer are
+// rejected.
+extern "C" int RFID_API API_MF_ReadRange(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                         unsigned char blk_add, int num_blk, unsigned char* key, unsigned char* Buffer);
+extern "C" int RFID_API API_MF_WriteRange(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                          unsigned char blk_add, int num_blk, unsigned char* key,
+                                          unsigned char* senddata, unsigned char* Buffer);
+
+// Count blocks of 16 bytes from Block on, read with Key in Mode like API_MF_Read
+struct ProfileRange
+{
+    unsigned char Mode;
+    unsigned char Block;
+    unsigned char Count;
+    unsigned char Key[6];
+};
+
+// The times are microseconds since 1970 at which the reply of the UID and of the last block arrived
+struct CardProfile
+{
+    ULONGLONG UidTime;
+    ULONGLONG DataTime;
+    int Commands;  // Number of commands sent to the reader
+    unsigned char UidLength;
+    unsigned char Uid[10];
+};
+
+// Read the UID of the card and the blocks of RangeCount Ranges in one call, with the commands sent back to back while
+// the session is locked. Ranges that follow each other in the same sector with the same Mode and Key are read by one
+// command. Buffer receives the blocks of all ranges in their order, or Buffer[0] is the error code of the reader when a
+// command failed.
+extern "C" int RFID_API API_MF_ReadProfile(HANDLE commHandle, int DeviceAddress, const ProfileRange* Ranges,
+                                           int RangeCount, CardProfile* Profile, unsigned char* Buffer);
+
+// Card Monitor Function
+// Report inserted and removed cards. A lost reader is reported with CONNECTION_LOST, then its port, or the port it
+// shows up on, is reopened until the reader answers again and CONNECTION_RESTORED is reported. Without callback, the
+// events are queued for API_DrainCardEvents instead.
+extern "C" int RFID_API API_StartCardMonitor(HANDLE commHandle, int DeviceAddress, CardEventCallback callback,
+                                             int pollInterval);
+extern "C" int RFID_API API_StopCardMonitor(HANDLE commHandle);
+// Move up to Capacity queued card events into Events, oldest first, and their number into Count. Dropped receives the
+// number of events lost since the last call because the queue was full, see CardEventQueue. Only one thread at a time
+// may drain a handle.
+extern "C" int RFID_API API_DrainCardEvents(HANDLE commHandle, QueuedCardEvent* Events, int Capacity, int* Count,
+                                            int* Dropped);
+
+// Bus Scheduler Function
+// Poll the readers at Addresses on a shared RS-485 line in round-robin order. NodeTimeout is the reply timeout per reader in ms.
+extern "C" int RFID_API API_StartBusScheduler(HANDLE commHandle, const unsigned char* Addresses, int Count,
+                                              int NodeTimeout, BusEventCallback callback);
+extern "C" int RFID_API API_StopBusScheduler(HANDLE commHandle);
+// Copy the status of up to Capacity readers into Status and their number into Count
+extern "C" int RFID_API API_GetBusStatus(HANDLE commHandle, BusNodeStatus* Status, int Capacity, int* Count);
+
+// Asynchronous Function
+// Queue the command on the worker thread of the handle and return right away with the Token of the command. callback
+// receives the return code and, if it is 0, the Buffer of the synchronous function. Without callback, the result is
+// collected with API_GetAsyncResult, which returns 11 while the command is pending and 12 for an unknown Token.
+extern "C" int RFID_API API_MF_Read_Async(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                          unsigned char blk_add, unsigned char num_blk, unsigned char* key,
+                                          CompletionCallback callback, DWORD* Token);
+extern "C" int RFID_API API_MF_Write_Async(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                           unsigned char blk_add, unsigned char num_blk, unsigned char* key,
+                                           unsigned char* senddata, CompletionCallback callback, DWORD* Token);
+extern "C" int RFID_API API_MF_GET_SNR_Async(HANDLE commHandle, int DeviceAddress, unsigned char mode,
+                                             unsigned char cmd, CompletionCallback callback, DWORD* Token);
+extern "C" int RFID_API API_GetAsyncResult(HANDLE commHandle, DWORD Token, unsigned char* Buffer);
@@ -1,6 +1,231 @@
 import koffi = require("koffi");
 koffi.pointer("HANDLE", koffi.opaque());
 
+/** Events reported by the native card monitor of the C++ readers */
+export enum CardEvent {
+    REMOVED = 0,
+    INSERTED = 1,
+    CONNECTION_LOST = 2,
+    CONNECTION_RESTORED = 3
+}
+
+/** Callback of the native card monitor. It is called from the monitoring thread. */
+export const CardEventCallback = koffi.proto("void CardEventCallback(unsigned long event, const uint8_t* uid, unsigned long uidLength, unsigned long long timestamp)");
+
+/** Callback of the asynchronous native functions. It is called from the worker thread of the handle. */
+export const CompletionCallback = koffi.proto("void CompletionCallback(unsigned long token, unsigned long result, const uint8_t* data, unsigned long length)");
+
+/** The reader types that can be configured in settings.json */
+export type DeviceType = "EKS" | "iDTRONIC" | "Baltech";
+
+/** A reader found by the native discovery */
+export interface DiscoveredDevice {
+    comPort: number;
+    deviceType: DeviceType;
+    /** Bus address of an iDTRONIC reader, 0 for the others */
+    address: number;
+}
+
+/** Values of the ReaderType enum of the native discovery */
+const readerTypes: DeviceType[] = [null, "EKS", "iDTRONIC", "Baltech"];
+
+/**
+ * Calls the native discovery function of a reader DLL on a worker thread. It
+ * fills an array of DiscoveredReader structs of three 32 bit values: port,
+ * type and address.
+ * @param discover The bound DiscoverReaders function of the DLL
+ * @param knownPort The port the reader was found on last time
+ * @param knownType The type of the reader found last time
+ */
+export function discoverDevices(discover: koffi.KoffiFunction, knownPort: number, knownType: DeviceType): Promise<DiscoveredDevice[]> {
+    const capacity = 16;
+    const buffer = new Uint8Array(capacity * 12);
+    const count = [0];
+
+    return new Promise((resolve, reject) => {
+        discover.async(knownPort, Math.max(readerTypes.indexOf(knownType), 0), buffer, capacity, count, (err: Error, ret: number) => {
+            if (err || ret) {
+                reject(err ?? new Error(`Error while discovering readers: ${ret}`));
+                return;
+            }
+
+            const view = new DataView(buffer.buffer);
+            const devices: DiscoveredDevice[] = [];
+
+            for (let i = 0; i < count[0]; i++) {
+                devices.push({
+                    comPort: view.getUint32(i * 12, true),
+                    deviceType: readerTypes[view.getUint32(i * 12 + 4, true)],
+                    address: view.getUint32(i * 12 + 8, true)
+                });
+            }
+
+            resolve(devices);
+        });
+    });
+}
+
+/** Upper bounds of the latency buckets of CommandStats in ms, the last bucket has no bound */
+export const latencyBounds = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000];
+
+/** Counters of one command code of a reader */
+export interface CommandStats {
+    command: number;
+    count: number;
+    /** No valid reply after the last repetition */
+    failed: number;
+    /** Attempts without a reply */
+    timeouts: number;
+    /** Attempts with a corrupted reply */
+    checksumErrors: number;
+    /** Number of commands per bucket of latencyBounds */
+    latency: number[];
+}
+
+/** Counters of the line, the repetitions and every command of a reader */
+export interface ReaderStats {
+    bytesSent: number;
+    bytesReceived: number;
+    parityErrors: number;
+    framingErrors: number;
+    overruns: number;
+    breaks: number;
+    resends: number;
+    retries: number;
+    recovered: number;
+    failed: number;
+    commands: CommandStats[];
+}
+
+/** Blocks of 16 bytes of a Mifare Classic card that are read with one key */
+export interface ProfileRange {
+    /** Key type like the mode of MF_Read */
+    mode: number;
+    block: number;
+    count: number;
+    key: number[];
+}
+
+/** UID and blocks of a card read in one call */
+export interface CardProfile {
+    uid: Uint8Array;
+    /** Blocks of all ranges in their order */
+    data: Uint8Array;
+    /** Time in ms since 1970 at which the UID was read */
+    uidTime: number;
+    /** Time in ms since 1970 at which the last block was read */
+    dataTime: number;
+    /** Number of commands sent to the reader */
+    commands: number;
+}
+
+/**
+ * Calls the native GetStats function of a reader DLL. It fills a SessionStats
+ * struct of two 64 bit byte counters followed by eight 32 bit counters and an
+ * array of CommandStats structs of five 32 bit values and the latency buckets.
+ * Returns null if the handle is not open.
+ * @param getStats The bound GetStats function of the DLL
+ * @param handle The handle of the opened reader
+ */
+export function readStats(getStats: koffi.KoffiFunction, handle: koffi.IKoffiCType): ReaderStats | null {
+    const capacity = 16;
+    const commandSize = (5 + latencyBounds.length + 1) * 4;
+    const session = new Uint8Array(48);
+    const buffer = new Uint8Array(capacity * commandSize);
+    const count = [0];
+
+    if (!handle || getStats(handle, session, buffer, capacity, count)) {
+        return null;
+    }
+
+    const view = new DataView(session.buffer);
+    const counter = (i: number) => view.getUint32(16 + i * 4, true);
+    const stats: ReaderStats = {
+        bytesSent: Number(view.getBigUint64(0, true)),
+        bytesReceived: Number(view.getBigUint64(8, true)),
+        parityErrors: counter(0),
+        framingErrors: counter(1),
+        overruns: counter(2),
+        breaks: counter(3),
+        resends: counter(4),
+        retries: counter(5),
+        recovered: counter(6),
+        failed: counter(7),
+        commands: []
+    };
+    const commands = new DataView(buffer.buffer);
+
+    for (let i = 0; i < count[0]; i++) {
+        const values = Array.from({ length: commandSize / 4 }, (_, j) => commands.getUint32(i * commandSize + j * 4, true));
+        stats.commands.push({
+            command: values[0],
+            count: values[1],
+            failed: values[2],
+            timeouts: values[3],
+            checksumErrors: values[4],
+            latency: values.slice(5)
+        });
+    }
+
+    return stats;
+}
+
+/**
+ * Drains the native card event queue of a reader on a timer. Each drain moves
+ * all pending events in one call into buffers that are allocated once, so a
+ * drain without events allocates nothing.
+ */
+export class CardEventDrain {
+    /** Size of a QueuedCardEvent struct: event, UID length, a 64 bit timestamp and 32 bytes of UID */
+    private static readonly eventSize = 48;
+    private static readonly capacity = 64;
+
+    private readonly events = new Uint8Array(CardEventDrain.capacity * CardEventDrain.eventSize);
+    private readonly view = new DataView(this.events.buffer);
+    private readonly count = [0];
+    private readonly dropped = [0];
+    private timer: NodeJS.Timeout = null;
+
+    /**
+     * @param drain The bound drain function of the DLL
+     * @param onEvent Called for every event, oldest first. The UID is only valid during the call.
+     * @param onDropped Called when events were lost because the queue was full, the card needs to be read again
+     */
+    constructor(private drain: koffi.KoffiFunction, private onEvent: (event: CardEvent, uid: Uint8Array) => void, private onDropped: () => void) {}
+
+    /**
+     * Starts draining the queue of the handle every interval ms
+     */
+    start(handle: koffi.IKoffiCType, interval: number): void {
+        this.stop();
+        // Unreferenced like the polling timer of RFIDLogic, so it does not keep the event loop alive
+        this.timer = setInterval(() => this.poll(handle), interval).unref();
+    }
+
+    stop(): void {
+        clearInterval(this.timer);
+        this.timer = null;
+    }
+
+    private poll(handle: koffi.IKoffiCType) {
+        do {
+            if (this.drain(handle, this.events, CardEventDrain.capacity, this.count, this.dropped)) {
+                return;
+            }
+
+            for (let i = 0; i < this.count[0]; i++) {
+                const offset = i * CardEventDrain.eventSize;
+                const uidLength = this.view.getUint32(offset + 4, true);
+                this.onEvent(this.view.getUint32(offset, true), this.events.subarray(offset + 16, offset + 16 + uidLength));
+            }
+
+            if (this.dropped[0]) {
+                this.onDropped();
+            }
+        } while (this.count[0] === CardEventDrain.capacity);
+    }
+}
+
 export interface IDeviceConnection {
     /**
      * Opens the communication with a COM port
@@ -17,10 +242,52 @@ export interface IDeviceConnection {
      * @param forConfigPage True if the returned UID is displayed on the config page
      */
     readSerialNumber(forConfigPage?: boolean): string | false;
+    /**
+     * Reads the serial number like `readSerialNumber` without blocking the
+     * event loop while the reader answers
+     */
+    readSerialNumberAsync?(): Promise<string | false>;
     /**
      * Gets a list of all available COM ports
      */
     listComPorts(): Uint8Array | Promise<Uint8Array>;
+    /**
+     * Probes the known port and, if no reader answers there, all COM ports at
+     * the same time for the supported readers
+     * @param knownPort The port the reader was found on last time
+     * @param knownType The type of the reader found last time
+     */
+    discover?(knownPort: number, knownType: DeviceType): Promise<DiscoveredDevice[]>;
+    /**
+     * Starts watching the reader on a native thread. Readers without this
+     * function are polled with `readSerialNumber` instead. The native thread
+     * reopens the port of a lost reader by itself.
+     * @param onCardChanged Called with the UID of an inserted card or false if the card is removed
+     * @param onConnectionLost Called when the reader stops responding
+     * @param onConnectionRestored Called when the reader answers again after the port was reopened
+     */
+    startMonitoring?(onCardChanged: (uid: string | false) => void, onConnectionLost: () => void, onConnectionRestored: () => void): void;
+    /**
+     * Stops watching the reader
+     */
+    stopMonitoring?(): void;
+    /**
+     * Gets the counters of the line, the repetitions and every command since
+     * the port was opened, or null if it is not open
+     */
+    getStats?(): ReaderStats | null;
+    /**
+     * Writes the last frames sent to and received from the reader to a pcap
+     * file. Returns false if the port is not open or the file cannot be written.
+     * @param file Path of the capture file
+     */
+    dumpCapture?(file: string): boolean;
+    /**
+     * Reads the UID and the blocks of the ranges with a single native call.
+     * Returns false if no card is detected.
+     * @param ranges Blocks to read, ranges that continue each other with the same key share a command
+     */
+    readProfile?(ranges: ProfileRange[]): CardProfile | false;
 }
 
 /**
@@ -6,9 +6,20 @@ export class RFIDLogic {
     /** A function that is executed when a `ConnectionError` occurs with the
      * RFID reader */
     onDeviceError: () => void = null;
+    /** A function that is executed when the RFID reader answers again after
+     * a `ConnectionError` */
+    onDeviceRestored: () => void = null;
     private updateHandlers: ((uid: string | null) => void)[] = [];
     private timeout: NodeJS.Timeout = null;
     private rfidCom: IDeviceConnection;
+    private comPort: number = null;
+    private reconnectTimeout: NodeJS.Timeout = null;
+    private reconnectDelay = RFIDLogic.minReconnectDelay;
+
+    /** Delays between two attempts to open the COM port again, the same as
+     * the native card monitors use */
+    private static readonly minReconnectDelay = 50; //ms
+    private static readonly maxReconnectDelay = 400; //ms
 
     /**
      * This function is called when a card is detected or removed
@@ -18,6 +29,10 @@ export class RFIDLogic {
     }
 
     private stopPolling(): void {
+        if (this.rfidCom.stopMonitoring) {
+            this.rfidCom.stopMonitoring();
+        }
+
         if (!this.timeout) {
             return;
         }
@@ -27,33 +42,110 @@ export class RFIDLogic {
     }
 
     /**
-     * This function is called every 250ms
+     * This function is called when the reader reports a UID or no card
+     */
+    private updateUid(res: string | false) {
+        // A new card is detected
+        if (res !== this.currentUid && typeof res === "string") {
+            this.currentUid = res;
+            this.invokeUpdateHandlers();
+            // The current card is removed
+        } else if (res === false && typeof this.currentUid === "string") {
+            this.currentUid = null;
+            this.invokeUpdateHandlers();
+        }
+    }
+
+    /**
+     * This function is called when the connection to the reader is lost
+     */
+    private handleConnectionError() {
+        if (this.onDeviceError) {
+            this.onDeviceError();
+        }
+
+        // A native card monitor reopens the port by itself
+        if (this.rfidCom.startMonitoring) {
+            return;
+        }
+
+        // Readers that are polled are opened again, which closes the old connection
+        this.stopPolling();
+        this.scheduleReconnect();
+    }
+
+    /**
+     * This function is called when the reader answers again after a connection error
+     */
+    private handleConnectionRestored() {
+        if (this.onDeviceRestored) {
+            this.onDeviceRestored();
+        }
+    }
+
+    /**
+     * Try to open the COM port again after a delay that doubles with every
+     * failed attempt
+     */
+    private scheduleReconnect() {
+        if (this.reconnectTimeout) {
+            return;
+        }
+
+        // Unreferenced like the polling interval, so it does not keep the event loop alive
+        this.reconnectTimeout = setTimeout(() => {
+            this.reconnectTimeout = null;
+            this.reconnectDelay = Math.min(this.reconnectDelay * 2, RFIDLogic.maxReconnectDelay);
+
+            if (this.connect()) {
+                this.handleConnectionRestored();
+            } else {
+                this.scheduleReconnect();
+            }
+        }, this.reconnectDelay).unref();
+    }
+
+    /**
+     * Opens the COM port and starts watching the reader. Returns false if the
+     * port cannot be opened.
+     */
+    private connect(): boolean {
+        try {
+            this.rfidCom.open(this.comPort);
+
+            // Readers with a native card monitor report cards themselves
+            if (this.rfidCom.startMonitoring) {
+                this.rfidCom.startMonitoring(this.updateUid.bind(this), this.handleConnectionError.bind(this), this.handleConnectionRestored.bind(this));
+            } else if (!this.timeout) {
+                // The timeout needs to be unreferenced or it might block the
+                // event loop when the program exits. The 'onShutdown' method
+                // cannot be executed then.
+                this.timeout = setInterval(this.pollReader.bind(this), this.pollingInterval).unref();
+            }
+        } catch (err: unknown) {
+            if (err instanceof ConnectionError) {
+                return false;
+            }
+
+            throw err;
+        }
+
+        this.reconnectDelay = RFIDLogic.minReconnectDelay;
+        return true;
+    }
+
+    /**
+     * This function is called every 250ms for readers without a native
+     * card monitor
      */
     private pollReader() {
         // If the RFIDCommunication object is null, the polling is stopped
         // Try to read the serial number from the RFID reader
         try {
-            const res = this.rfidCom.readSerialNumber();
-
-            // A new card is detected
-            if (res !== this.currentUid && typeof res === "string") {
-                this.currentUid = res;
-                this.invokeUpdateHandlers();
-                // The current card is removed
-            } else if (res === false && typeof this.currentUid === "string") {
-                this.currentUid = null;
-                this.invokeUpdateHandlers();
-            }
+            this.updateUid(this.rfidCom.readSerialNumber());
         } catch (err) {
-            // If a connection error occurs, the polling is stopped for
-            // performance reasons
             if (err instanceof ConnectionError) {
-                this.stopPolling();
-
-                if (this.onDeviceError) {
-                    this.onDeviceError();
-                }
-
+                this.handleConnectionError();
                 return;
             }
 
@@ -73,29 +165,23 @@ export class RFIDLogic {
     }
 
     /**
-     * Opens a connection to the COM port and start polling the RFID reader for UIDs
+     * Opens a connection to the COM port and start watching the RFID reader for UIDs.
+     * If the port cannot be opened, it is tried again until the reader is
+     * plugged in.
      * @param comPort The number of the COM port to connect to
      */
     start(comPort: number): void {
-        try {
-            this.rfidCom.open(comPort);
+        this.comPort = comPort;
+        this.reconnectDelay = RFIDLogic.minReconnectDelay;
+        clearTimeout(this.reconnectTimeout);
+        this.reconnectTimeout = null;
 
-            if (!this.timeout) {
-                // The timeout needs to be unreferenced or it might block the
-                // event loop when the program exits. The 'onShutdown' method
-                // cannot be executed then.
-                this.timeout = setInterval(this.pollReader.bind(this), this.pollingInterval).unref();
+        if (!this.connect()) {
+            if (this.onDeviceError) {
+                this.onDeviceError();
             }
-        } catch (err: unknown) {
-            if (err instanceof ConnectionError) {
-                if (this.onDeviceError) {
-                    this.onDeviceError();
-                }
 
-                return;
-            }
-
-            throw err;
+            this.scheduleReconnect();
         }
     }
 }
@@ -45,7 +45,10 @@ export class Baltech implements IDeviceConnection {
     }
 
     close(): void {
-        this.serialConnection.close();
+        // The port may be gone already after a connection error
+        if (this.serialConnection?.isOpen) {
+            this.serialConnection.close();
+        }
     }
 
     readSerialNumber(forConfigPage?: boolean): string | false {
@@ -1,5 +1,5 @@
 // This reader implementation uses a custom C++ API for device communication
-import { IDeviceConnection, ConnectionError } from "../RFIDCommunication";
+import { IDeviceConnection, ConnectionError, CardEvent, CardEventDrain, CompletionCallback, DeviceType, DiscoveredDevice, discoverDevices, ReaderStats, readStats } from "../RFIDCommunication";
 import os = require("os");
 import path = require("path");
 import koffi = require("koffi");
@@ -26,14 +26,114 @@ enum ResponseCodes {
     ERR_WRITE_PROTECTED = 0x50,
     ERR_IO = 0xF1,
     ERR_COMMUNICATION = 0xF2,
-    ERR_CONNECTION = 0xF3
+    ERR_CONNECTION = 0xF3,
+    PENDING = 0xF4,
+    ERR_UNKNOWN_TOKEN = 0xF5,
+    ERR_INVALID_PARAMETER = 0xF6,
+    ERR_VERIFY = 0xF7
 }
 
 export class EKSCom implements IDeviceConnection {
 
     private handle: koffi.IKoffiCType;
-    private api: { GetSysComm: koffi.KoffiFunction; OpenComm: koffi.KoffiFunction; CloseComm: koffi.KoffiFunction; GetSerialNumber: koffi.KoffiFunction; GetKeyStatus: koffi.KoffiFunction; };
+    private api: { GetSysComm: koffi.KoffiFunction; OpenComm: koffi.KoffiFunction; CloseComm: koffi.KoffiFunction; GetSerialNumber: koffi.KoffiFunction; GetKeyStatus: koffi.KoffiFunction; StartKeyMonitor: koffi.KoffiFunction; StopKeyMonitor: koffi.KoffiFunction; GetSerialNumberAsync: koffi.KoffiFunction; DiscoverReaders: koffi.KoffiFunction; GetStats: koffi.KoffiFunction; DumpFrameCapture: koffi.KoffiFunction; DrainKeyEvents: koffi.KoffiFunction; };
     private lastSerialNumber: string = null;
+    private eventDrain: CardEventDrain;
+    private monitorHandlers: { onCardChanged: (uid: string | false) => void; onConnectionLost: () => void; onConnectionRestored: () => void; } = null;
+    private completionCallback: koffi.IKoffiRegisteredCallback = null;
+    private pendingCommands = new Map<number, (ret: number, data: Uint8Array) => void>();
+
+    /** The native key monitor sleeps until CTS changes, the interval only spaces two polls */
+    private static readonly monitorInterval = 10; //ms
+    /** Pause between two drains of the events the key monitor queued */
+    private static readonly drainInterval = 20; //ms
+
+    /**
+     * Convert the bytes of a serial number to a hex string
+     */
+    private static toUidString(buffer: Uint8Array): string {
+        return buffer.reduce((acc, cur) => acc += cur.toString(16), "");
+    }
+
+    /**
+     * This function is called for every event the native key monitor queued
+     */
+    private onKeyEvent(event: CardEvent, uid: Uint8Array) {
+        if (!this.monitorHandlers) {
+            return;
+        }
+
+        switch (event) {
+        case CardEvent.INSERTED:
+            this.lastSerialNumber = EKSCom.toUidString(uid);
+            this.monitorHandlers.onCardChanged(this.lastSerialNumber);
+            break;
+        case CardEvent.REMOVED:
+            this.lastSerialNumber = null;
+            this.monitorHandlers.onCardChanged(false);
+            break;
+        case CardEvent.CONNECTION_LOST:
+            this.monitorHandlers.onConnectionLost();
+            break;
+        case CardEvent.CONNECTION_RESTORED:
+            this.monitorHandlers.onConnectionRestored();
+            break;
+        }
+    }
+
+    /**
+     * Read the key again after queued events were lost. A lost connection is
+     * reported by the native key monitor itself.
+     */
+    private onEventsDropped() {
+        if (!this.monitorHandlers) {
+            return;
+        }
+
+        try {
+            this.lastSerialNumber = null;
+            this.monitorHandlers.onCardChanged(this.readSerialNumber());
+        } catch (err) {
+            if (!(err instanceof ConnectionError)) {
+                throw err;
+            }
+        }
+    }
+
+    /**
+     * This function is called by the native worker thread when an asynchronous command completed
+     */
+    private onCompletion(token: number, ret: number, data: Uint8Array) {
+        const complete = this.pendingCommands.get(token);
+
+        if (complete) {
+            this.pendingCommands.delete(token);
+            complete(ret, data);
+        }
+    }
+
+    /**
+     * Convert the result of GetSerialNumber
+     */
+    private toSerialNumber(ret: number, buffer: Uint8Array): false | string {
+        switch (ret) {
+        case ResponseCodes.SUCCESS:
+        {
+            // Convert Bytes to hex string
+            const uid = EKSCom.toUidString(buffer);
+            this.lastSerialNumber = uid;
+            return uid;
+        }
+        case ResponseCodes.ERR_NO_KEY_DETECTED:
+            // When no key is detected, return false
+            this.lastSerialNumber = null;
+            return false;
+        case ResponseCodes.ERR_CONNECTION:
+            throw new ConnectionError("The handle is invalid");
+        default:
+            throw new Error(`Error while reading serial number: ${ret}`);
+        }
+    }
 
     /**
      * Get a list of all available COM ports
@@ -58,8 +158,28 @@ export class EKSCom implements IDeviceConnection {
             OpenComm: dll.func("HANDLE OpenComm(unsigned char, unsigned int)"),
             CloseComm: dll.func("void CloseComm(HANDLE)"),
             GetSerialNumber: dll.func("unsigned long GetSerialNumber(HANDLE, unsigned char*)"),
-            GetKeyStatus: dll.func("unsigned long GetKeyStatus(HANDLE)")
+            GetKeyStatus: dll.func("unsigned long GetKeyStatus(HANDLE)"),
+            StartKeyMonitor: dll.func("unsigned long StartKeyMonitor(HANDLE, CardEventCallback*, unsigned long)"),
+            StopKeyMonitor: dll.func("void StopKeyMonitor(HANDLE)"),
+            GetSerialNumberAsync: dll.func("unsigned long GetSerialNumberAsync(HANDLE, CompletionCallback*, _Out_ unsigned long*)"),
+            DiscoverReaders: dll.func("unsigned long DiscoverReaders(unsigned long, unsigned long, unsigned char*, unsigned long, _Out_ unsigned long*)"),
+            GetStats: dll.func("unsigned long GetStats(HANDLE, unsigned char*, unsigned char*, unsigned long, _Out_ unsigned long*)"),
+            DumpFrameCapture: dll.func("unsigned long DumpFrameCapture(HANDLE, const char*)"),
+            DrainKeyEvents: dll.func("unsigned long DrainKeyEvents(HANDLE, unsigned char*, unsigned long, _Out_ unsigned long*, _Out_ unsigned long*)")
         };
+        this.eventDrain = new CardEventDrain(this.api.DrainKeyEvents, this.onKeyEvent.bind(this), this.onEventsDropped.bind(this));
+    }
+
+    discover(knownPort: number, knownType: DeviceType): Promise<DiscoveredDevice[]> {
+        return discoverDevices(this.api.DiscoverReaders, knownPort, knownType);
+    }
+
+    getStats(): ReaderStats | null {
+        return readStats(this.api.GetStats, this.handle);
+    }
+
+    dumpCapture(file: string): boolean {
+        return !!this.handle && this.api.DumpFrameCapture(this.handle, file) === ResponseCodes.SUCCESS;
     }
 
     open(comPort: number): void {
@@ -75,7 +195,15 @@ export class EKSCom implements IDeviceConnection {
     }
 
     close(): void {
+        this.eventDrain.stop();
         this.api.CloseComm(this.handle);
+
+        // Commands that are still queued are dropped by the native API
+        for (const complete of this.pendingCommands.values()) {
+            complete(ResponseCodes.ERR_CONNECTION, null);
+        }
+
+        this.pendingCommands.clear();
     }
 
     readSerialNumber(): false | string {
@@ -91,23 +219,58 @@ export class EKSCom implements IDeviceConnection {
 
         const buffer = new Uint8Array(8);
         const ret = this.api.GetSerialNumber(this.handle, buffer);
+        return this.toSerialNumber(ret, buffer);
+    }
 
-        switch (ret) {
-        case ResponseCodes.SUCCESS:
-        {
-            // Convert Bytes to hex string
-            const uid = buffer.reduce((acc, cur) => acc += cur.toString(16), "");
-            this.lastSerialNumber = uid;
-            return uid;
+    readSerialNumberAsync(): Promise<false | string> {
+        // Querying CTS does not block, only the read of the serial number does
+        if (this.lastSerialNumber && this.api.GetKeyStatus(this.handle) === ResponseCodes.SUCCESS) {
+            return Promise.resolve(this.lastSerialNumber);
         }
-        case ResponseCodes.ERR_NO_KEY_DETECTED:
-            // When no key is detected, return false
-            this.lastSerialNumber = null;
-            return false;
-        case ResponseCodes.ERR_CONNECTION:
+
+        // Registered once like the monitor callback, a completion may arrive after close
+        if (!this.completionCallback) {
+            this.completionCallback = koffi.register(
+                (token: number, ret: number, data: unknown, length: number) => this.onCompletion(token, ret, length ? Uint8Array.from(koffi.decode(data, "uint8_t", length)) : null),
+                koffi.pointer(CompletionCallback)
+            );
+        }
+
+        return new Promise((resolve, reject) => {
+            const token = [0];
+            const ret = this.api.GetSerialNumberAsync(this.handle, this.completionCallback, token);
+
+            if (ret !== ResponseCodes.SUCCESS) {
+                reject(new ConnectionError("The handle is invalid"));
+                return;
+            }
+
+            this.pendingCommands.set(token[0], (ret, data) => {
+                try {
+                    resolve(this.toSerialNumber(ret, data));
+                } catch (err) {
+                    reject(err);
+                }
+            });
+        });
+    }
+
+    startMonitoring(onCardChanged: (uid: string | false) => void, onConnectionLost: () => void, onConnectionRestored: () => void): void {
+        // Without callback the native monitor queues its events, so a burst of
+        // key swaps neither waits for the event loop nor gets lost
+        this.monitorHandlers = { onCardChanged, onConnectionLost, onConnectionRestored };
+        const ret = this.api.StartKeyMonitor(this.handle, null, EKSCom.monitorInterval);
+
+        if (ret !== ResponseCodes.SUCCESS) {
             throw new ConnectionError("The handle is invalid");
-        default:
-            throw new Error(`Error while reading serial number: ${ret}`);
         }
+
+        this.eventDrain.start(this.handle, EKSCom.drainInterval);
+    }
+
+    stopMonitoring(): void {
+        this.monitorHandlers = null;
+        this.eventDrain.stop();
+        this.api.StopKeyMonitor(this.handle);
     }
 }
@@ -1,4 +1,4 @@
-import { IDeviceConnection, ConnectionError } from "../RFIDCommunication";
+import { IDeviceConnection, ConnectionError, CardEvent, CardEventDrain, CompletionCallback, DeviceType, DiscoveredDevice, discoverDevices, ReaderStats, readStats, ProfileRange, CardProfile } from "../RFIDCommunication";
 import os = require("os");
 import path = require("path");
 import koffi = require("koffi");
@@ -21,10 +21,109 @@ export class IDTRONICCom implements IDeviceConnection {
     private api: {
         GetSysComm: koffi.KoffiFunction;
         OpenComm: koffi.KoffiFunction;
+        NegotiateBaudrate: koffi.KoffiFunction;
         CloseComm: koffi.KoffiFunction;
         MF_GET_SNR: koffi.KoffiFunction;
         MF_Read: koffi.KoffiFunction;
+        StartCardMonitor: koffi.KoffiFunction;
+        StopCardMonitor: koffi.KoffiFunction;
+        MF_GET_SNR_Async: koffi.KoffiFunction;
+        DiscoverReaders: koffi.KoffiFunction;
+        GetStats: koffi.KoffiFunction;
+        DumpFrameCapture: koffi.KoffiFunction;
+        MF_ReadProfile: koffi.KoffiFunction;
+        DrainCardEvents: koffi.KoffiFunction;
     };
+    private eventDrain: CardEventDrain;
+    private monitorHandlers: { onCardChanged: (uid: string | false) => void; onConnectionLost: () => void; onConnectionRestored: () => void; } = null;
+    private completionCallback: koffi.IKoffiRegisteredCallback = null;
+    private pendingCommands = new Map<number, (ret: number, data: Uint8Array) => void>();
+
+    /** Pause between two requests of the card monitor. The reader's response time adds to this. */
+    private static readonly monitorInterval = 20; //ms
+    /** Pause between two drains of the events the card monitor queued */
+    private static readonly drainInterval = 20; //ms
+
+    /**
+     * Convert the bytes of a UID to a hex string with reversed endianness
+     */
+    private static toUidString(uid: Uint8Array): string {
+        return uid.reverse().reduce((acc, cur) => acc += cur.toString(16).padStart(2, "0"), "");
+    }
+
+    /**
+     * This function is called for every event the native card monitor queued
+     */
+    private onCardEvent(event: CardEvent, uid: Uint8Array) {
+        if (!this.monitorHandlers) {
+            return;
+        }
+
+        switch (event) {
+        case CardEvent.INSERTED:
+            this.monitorHandlers.onCardChanged(IDTRONICCom.toUidString(uid));
+            break;
+        case CardEvent.REMOVED:
+            this.monitorHandlers.onCardChanged(false);
+            break;
+        case CardEvent.CONNECTION_LOST:
+            this.monitorHandlers.onConnectionLost();
+            break;
+        case CardEvent.CONNECTION_RESTORED:
+            this.monitorHandlers.onConnectionRestored();
+            break;
+        }
+    }
+
+    /**
+     * Read the card again after queued events were lost. A lost connection is
+     * reported by the native card monitor itself.
+     */
+    private onEventsDropped() {
+        if (!this.monitorHandlers) {
+            return;
+        }
+
+        try {
+            this.monitorHandlers.onCardChanged(this.readSerialNumber());
+        } catch (err) {
+            if (!(err instanceof ConnectionError)) {
+                throw err;
+            }
+        }
+    }
+
+    /**
+     * This function is called by the native worker thread when an asynchronous command completed
+     */
+    private onCompletion(token: number, ret: number, data: Uint8Array) {
+        const complete = this.pendingCommands.get(token);
+
+        if (complete) {
+            this.pendingCommands.delete(token);
+            complete(ret, data);
+        }
+    }
+
+    /**
+     * Convert the result of API_MF_GET_SNR
+     */
+    private static toSerialNumber(ret: number, buffer: Uint8Array): false | string {
+        if (ret) {
+            // 1: No card detected
+            if (ret === 1) {
+                return false;
+            }
+
+            // 4: Connection error
+            if (ret === 4) {
+                throw new ConnectionError("Connection lost while reading serial number");
+            }
+        }
+
+        // Get variable length uid from buffer
+        return IDTRONICCom.toUidString(buffer.subarray(2, buffer[0] + 1));
+    }
 
     constructor() {
         const dllName = path.join(".", "bin", `iDTRONIC${isx64 ? "x64" : ""}.dll`);
@@ -32,9 +131,64 @@ export class IDTRONICCom implements IDeviceConnection {
         this.api = {
             GetSysComm: dll.func("int API_GetSysComm(unsigned char*)"),
             OpenComm: dll.func("HANDLE API_OpenComm(int, int)"),
+            NegotiateBaudrate: dll.func("int API_NegotiateBaudrate(HANDLE, int, int, _Out_ int*)"),
             CloseComm: dll.func("int API_CloseComm(HANDLE)"),
             MF_GET_SNR: dll.func("int API_MF_GET_SNR(HANDLE, int, unsigned char, unsigned char, unsigned char*)"),
-            MF_Read: dll.func("int API_MF_Read(HANDLE, int, unsigned char, unsigned char, unsigned char, unsigned char*, unsigned char*)")
+            MF_Read: dll.func("int API_MF_Read(HANDLE, int, unsigned char, unsigned char, unsigned char, unsigned char*, unsigned char*)"),
+            StartCardMonitor: dll.func("int API_StartCardMonitor(HANDLE, int, CardEventCallback*, int)"),
+            StopCardMonitor: dll.func("int API_StopCardMonitor(HANDLE)"),
+            MF_GET_SNR_Async: dll.func("int API_MF_GET_SNR_Async(HANDLE, int, unsigned char, unsigned char, CompletionCallback*, _Out_ unsigned long*)"),
+            DiscoverReaders: dll.func("int API_DiscoverReaders(int, int, unsigned char*, int, _Out_ int*)"),
+            GetStats: dll.func("int API_GetStats(HANDLE, unsigned char*, unsigned char*, int, _Out_ int*)"),
+            DumpFrameCapture: dll.func("int API_DumpFrameCapture(HANDLE, const char*)"),
+            MF_ReadProfile: dll.func("int API_MF_ReadProfile(HANDLE, int, unsigned char*, int, unsigned char*, unsigned char*)"),
+            DrainCardEvents: dll.func("int API_DrainCardEvents(HANDLE, unsigned char*, int, _Out_ int*, _Out_ int*)")
+        };
+        this.eventDrain = new CardEventDrain(this.api.DrainCardEvents, this.onCardEvent.bind(this), this.onEventsDropped.bind(this));
+    }
+
+    discover(knownPort: number, knownType: DeviceType): Promise<DiscoveredDevice[]> {
+        return discoverDevices(this.api.DiscoverReaders, knownPort, knownType);
+    }
+
+    getStats(): ReaderStats | null {
+        return readStats(this.api.GetStats, this.handle);
+    }
+
+    dumpCapture(file: string): boolean {
+        return !!this.handle && this.api.DumpFrameCapture(this.handle, file) === 0;
+    }
+
+    readProfile(ranges: ProfileRange[]): CardProfile | false {
+        // ProfileRange structs of mode, block, count and key, the CardProfile struct holds two 64 bit times, the
+        // number of commands, the UID length and 10 bytes of UID
+        const descriptor = new Uint8Array(ranges.length * 9);
+        ranges.forEach((range, i) => descriptor.set([range.mode, range.block, range.count, ...range.key.slice(0, 6)], i * 9));
+        const profile = new Uint8Array(32);
+        const buffer = new Uint8Array(Math.max(1, ranges.reduce((acc, cur) => acc + cur.count * 16, 0)));
+        const ret = this.api.MF_ReadProfile(this.handle, 0x00, descriptor, ranges.length, profile, buffer);
+
+        if (ret) {
+            // 1: No card detected
+            if (ret === 1) {
+                return false;
+            }
+
+            // 4: Connection error
+            if (ret === 4) {
+                throw new ConnectionError("Connection lost while reading card profile");
+            }
+
+            throw new Error(`Reading the card profile failed with ${ret}`);
+        }
+
+        const view = new DataView(profile.buffer);
+        return {
+            uid: profile.slice(21, 21 + profile[20]),
+            data: buffer,
+            uidTime: Number(view.getBigUint64(0, true)) / 1000,
+            dataTime: Number(view.getBigUint64(8, true)) / 1000,
+            commands: view.getInt32(16, true)
         };
     }
 
@@ -60,32 +214,74 @@ export class IDTRONICCom implements IDeviceConnection {
         if (!this.handle) {
             throw new ConnectionError(`Unable to open COM${comPort}`);
         }
+
+        // The reader starts at 9600 baud and is switched to the fastest rate the line carries.
+        // If it does not answer, it stays at 9600 and the next command reports the error.
+        this.api.NegotiateBaudrate(this.handle, 0x00, 115200, [0]);
     }
 
     close(): void {
+        this.eventDrain.stop();
         this.api.CloseComm(this.handle);
+
+        // Calls that are still queued are dropped by the native API
+        for (const complete of this.pendingCommands.values()) {
+            complete(4, null);
+        }
+
+        this.pendingCommands.clear();
     }
 
     readSerialNumber(): false | string {
         const buffer = new Uint8Array(16);
         const ret = this.api.MF_GET_SNR(this.handle, 0x00, 0x26, 0x00, buffer);
+        return IDTRONICCom.toSerialNumber(ret, buffer);
+    }
 
-        if (ret) {
-            // 1: No card detected
-            if (ret === 1) {
-                return false;
-            }
+    readSerialNumberAsync(): Promise<false | string> {
+        // Registered once like the monitor callback, a completion may arrive after close
+        if (!this.completionCallback) {
+            this.completionCallback = koffi.register(
+                (token: number, ret: number, data: unknown, length: number) => this.onCompletion(token, ret, length ? Uint8Array.from(koffi.decode(data, "uint8_t", length)) : null),
+                koffi.pointer(CompletionCallback)
+            );
+        }
 
-            // 4: Connection error
-            if (ret === 4) {
-                throw new ConnectionError("Connection lost while reading serial number");
+        return new Promise((resolve, reject) => {
+            const token = [0];
+            const ret = this.api.MF_GET_SNR_Async(this.handle, 0x00, 0x26, 0x00, this.completionCallback, token);
+
+            if (ret) {
+                reject(new ConnectionError("Unable to queue the serial number request"));
+                return;
             }
+
+            this.pendingCommands.set(token[0], (ret, data) => {
+                try {
+                    resolve(IDTRONICCom.toSerialNumber(ret, data));
+                } catch (err) {
+                    reject(err);
+                }
+            });
+        });
+    }
+
+    startMonitoring(onCardChanged: (uid: string | false) => void, onConnectionLost: () => void, onConnectionRestored: () => void): void {
+        // Without callback the native monitor queues its events, so a burst of
+        // card swaps neither waits for the event loop nor gets lost
+        this.monitorHandlers = { onCardChanged, onConnectionLost, onConnectionRestored };
+        const ret = this.api.StartCardMonitor(this.handle, 0x00, null, IDTRONICCom.monitorInterval);
+
+        if (ret) {
+            throw new ConnectionError("Unable to start the card monitor");
         }
 
-        // Get variable length uid from buffer and reverse endianness
-        const uidBuffer = buffer.subarray(2, buffer[0] + 1).reverse();
-        // Convert Bytes to hex string
-        const uidString = uidBuffer.reduce((acc, cur) => acc += cur.toString(16).padStart(2, "0"), "");
-        return uidString;
+        this.eventDrain.start(this.handle, IDTRONICCom.drainInterval);
+    }
+
+    stopMonitoring(): void {
+        this.monitorHandlers = null;
+        this.eventDrain.stop();
+        this.api.StopCardMonitor(this.handle);
     }
 }
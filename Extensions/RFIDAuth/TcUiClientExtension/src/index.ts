@@ -1,8 +1,10 @@
 import { TcUiClientExt, MenuItemConstructor } from "@beckhoff/tc-ui-client-ext";
 import fs = require("fs");
+import os = require("os");
+import path = require("path");
 import { validate } from "jsonschema";
 import { RFIDLogic } from "./RFIDLogic";
-import { IDeviceConnection } from "./RFIDCommunication";
+import { IDeviceConnection, DeviceType } from "./RFIDCommunication";
 import ReaderImplementations = require("./ReaderImpl/index");
 
 class RFIDAuth extends TcUiClientExt {
@@ -15,7 +17,7 @@ class RFIDAuth extends TcUiClientExt {
         logoutOnCardRemoved:boolean;
         loginWhenCardDetected: boolean;
         loginDomain: string;
-        deviceType: "EKS" | "iDTRONIC" | "Baltech";
+        deviceType: DeviceType;
     };
 
     /**
@@ -42,9 +44,34 @@ class RFIDAuth extends TcUiClientExt {
         this.deviceError.active = false;
     }
 
-    private getCurrentUid(): { uid?: string, error?: { message: string, details: string, code: string } } {
+    /**
+     * Look for the reader on the port it was found on last time, and on all
+     * ports if it is not there any more. A reader found elsewhere is
+     * remembered at once, so the next start probes only its port.
+     */
+    private async discoverReader(): Promise<void> {
+        if (!this.rfidCom.discover) {
+            return;
+        }
+
+        try {
+            const readers = await this.rfidCom.discover(this.settings.comPort, this.settings.deviceType);
+            const reader = readers.find(value => value.deviceType === this.settings.deviceType);
+
+            if (reader && reader.comPort !== this.settings.comPort) {
+                this.settings.comPort = reader.comPort;
+                fs.writeFileSync("settings.json", JSON.stringify(this.settings, null, 4));
+            }
+        } catch {
+            // Keep the configured port, opening it reports the error
+        }
+    }
+
+    private async getCurrentUid(): Promise<{ uid?: string, error?: { message: string, details: string, code: string } }> {
         try {
-            const uid = this.rfidCom.readSerialNumber(true);
+            const uid = this.rfidCom.readSerialNumberAsync
+                ? await this.rfidCom.readSerialNumberAsync()
+                : this.rfidCom.readSerialNumber(true);
 
             if (!uid) {
                 return { error: { message: "No card detected", details: "", code: "RFID_NO_CARD_DETECTED" } };
@@ -111,7 +138,13 @@ class RFIDAuth extends TcUiClientExt {
             }
         }).bind(this);
 
-        // Start polling with the RFIDLogic instance
+        // The reader was reconnected, the error is not shown any more
+        this.rfidLogic.onDeviceRestored = (() => {
+            this.deviceError.active = false;
+        }).bind(this);
+
+        // Find the port of the reader, then start polling with the RFIDLogic instance
+        await this.discoverReader();
         this.rfidLogic.start(this.settings.comPort);
 
         // Get a list of available COM ports and display them in the application menu
@@ -170,6 +203,19 @@ class RFIDAuth extends TcUiClientExt {
             if (args?.doNotShowAgain) this.deviceError.show = false;
             this.deviceError.acknowledged = true;
             return;
+        // Counters and latency histograms of the reader for diagnostics, null for readers without them
+        case "getReaderStats":
+            return this.rfidCom.getStats?.() ?? null;
+        // Write the last frames on the line to a capture file that can be attached to a ticket. Returns its path or
+        // null for readers without a capture.
+        case "dumpFrameCapture": {
+            const file = args?.path ?? path.join(os.tmpdir(), `RFIDAuth-COM${this.settings.comPort}-${Date.now()}.pcap`);
+            return this.rfidCom.dumpCapture?.(file) ? file : null;
+        }
+        // Read the UID and the data blocks of a badge in one native call. Returns false without a card and null for
+        // readers without profiles.
+        case "readCardProfile":
+            return this.rfidCom.readProfile?.(args?.ranges ?? []) ?? null;
 
         }
     }